@@ -0,0 +1,91 @@
+/* Embedding API of liboctarine, implemented by the OCT_EMBED block at the end of src/octarine.cpp */
+#ifndef OCTARINE_H
+#define OCTARINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The library defines OCT_IMPORT as its export attribute before including this header */
+#ifndef OCT_IMPORT
+#if defined(_WIN32) && defined(OCT_SHARED)
+#define OCT_IMPORT __declspec(dllimport)
+#else
+#define OCT_IMPORT
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OctRuntime OctRuntime;
+typedef struct OctContext OctContext;
+typedef struct OctFunction OctFunction;
+typedef struct OctArray OctArray;
+typedef struct OctString OctString;
+
+/* One unboxed argument or result slot */
+typedef union OctValue {
+	int64_t i;
+	double f;
+	void* p;
+} OctValue;
+
+enum {
+	OCT_RUNTIME_DEFAULT = 0,
+	OCT_RUNTIME_NO_JIT = 1, /* Only runs code loaded with oct_load_native */
+	OCT_RUNTIME_PERF_MAP = 2, /* Write /tmp/perf-<pid>.map and /tmp/jit-<pid>.dump, Linux only */
+	OCT_RUNTIME_GDB_JIT = 4 /* Register debug info of JITed code with GDB */
+};
+
+enum {
+	OCT_OK = 0,
+	OCT_ERROR, /* Exception kind + OCT_ERROR */
+	OCT_UNBOUND = OCT_ERROR + 16, /* The function has no compiled frame entry */
+	OCT_UNSUPPORTED = OCT_ERROR + 17 /* Not compiled in */
+};
+
+typedef struct OctHeapStats {
+	uint64_t liveObjects;
+	uint64_t liveBytes;
+	uint64_t peakLiveBytes;
+	uint64_t totalObjects;
+	uint64_t totalBytes;
+	uint64_t peakResidentBytes;
+} OctHeapStats;
+
+OCT_IMPORT const char* oct_last_error(void);
+OCT_IMPORT OctRuntime* oct_runtime_create(unsigned flags);
+OCT_IMPORT void oct_runtime_destroy(OctRuntime* rt);
+OCT_IMPORT OctContext* oct_context_main(OctRuntime* rt);
+OCT_IMPORT OctContext* oct_context_create(OctRuntime* rt);
+OCT_IMPORT void oct_context_destroy(OctContext* ctx);
+OCT_IMPORT int oct_load_native(OctContext* ctx, const char* path);
+/* Snapshot of every namespace's names, plain data values and the symbols. skipped gets the
+   number of values left out because they hold pointers or code, those names restore unbound. */
+OCT_IMPORT int oct_image_write(OctContext* ctx, const char* path, size_t* skipped);
+/* Interns the names of an oct_image_write snapshot and defines those that have a value, bound
+   gets how many. The image stays mapped until the runtime is destroyed. */
+OCT_IMPORT int oct_image_restore(OctContext* ctx, const char* path, size_t* bound);
+OCT_IMPORT OctFunction* oct_function_lookup(OctContext* ctx, const char* name);
+OCT_IMPORT void oct_function_release(OctFunction* fn);
+OCT_IMPORT int oct_call(OctContext* ctx, OctFunction* fn, const OctValue* args, OctValue* result);
+OCT_IMPORT int oct_call_batch(OctContext* ctx, OctFunction* fn, const OctValue* args, size_t stride, OctValue* results, size_t count, size_t* done);
+OCT_IMPORT const void* oct_array_data(const OctArray* array, size_t* length);
+OCT_IMPORT const uint8_t* oct_string_bytes(const OctString* string, size_t* size);
+OCT_IMPORT int oct_heap_stats(OctRuntime* rt, OctHeapStats* stats);
+OCT_IMPORT int oct_heap_context_stats(OctContext* ctx, uint64_t* objects, uint64_t* bytes, double* bytesPerSecond);
+OCT_IMPORT void oct_heap_set_sample_interval(OctRuntime* rt, size_t bytes);
+OCT_IMPORT void oct_heap_report(OctRuntime* rt, FILE* out);
+OCT_IMPORT int oct_trace_start(OctRuntime* rt, const char* path);
+OCT_IMPORT void oct_trace_stop(OctRuntime* rt);
+
+/* The octarine executable: prints the forms read from the files in argv, or from stdin */
+OCT_IMPORT int oct_main(int argc, char* argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+// Micro-benchmarks of the runtime primitives. The runtime source is compiled into this file,
+// so the internals are reachable. Results go to stdout as one JSON document, times are the
+// best of several runs in nanoseconds per operation.
+#define OCT_EMBED
+#include "octarine.cpp"
+
+namespace octarine {
+
+	// ## 01 ## Harness
+	static volatile Uword sink;
+
+	const U64 BENCH_MIN_NANOS = 20 * 1000 * 1000; // Per run, grows the iteration count until reached
+	const Uword BENCH_RUNS = 5;
+
+	struct BenchResult {
+		const char* name;
+		Uword param;
+		Uword iterations;
+		F64 nanosPerOp;
+	};
+
+	static std::vector<BenchResult> results;
+
+	// fn(iterations) does iterations operations
+	template <typename F>
+	static void bench(const char* name, Uword param, F fn, Uword maxIterations = ~(Uword)0) {
+		Uword iterations = 1;
+		U64 elapsed = 0;
+		while(true) {
+			U64 start = SYS.nanoTimestamp();
+			fn(iterations);
+			elapsed = SYS.nanoTimestamp() - start;
+			if(elapsed >= BENCH_MIN_NANOS || iterations >= maxIterations) {
+				break;
+			}
+			iterations *= 2;
+		}
+		F64 best = (F64)elapsed / iterations;
+		for(Uword run = 1; run < BENCH_RUNS; ++run) {
+			U64 start = SYS.nanoTimestamp();
+			fn(iterations);
+			F64 nanos = (F64)(SYS.nanoTimestamp() - start) / iterations;
+			if(nanos < best) {
+				best = nanos;
+			}
+		}
+		BenchResult result = { name, param, iterations, best };
+		results.push_back(result);
+	}
+
+	static void printResults(FILE* out) {
+		fprintf(out, "{\n\t\"processors\": %lu,\n\t\"cpu_features\": %lu,\n\t\"benchmarks\": [\n",
+			(unsigned long)SYS.processorCount(), (unsigned long)SYS.cpuFeatures());
+		for(Uword i = 0; i < results.size(); ++i) {
+			fprintf(out, "\t\t{\"name\": \"%s\", \"param\": %lu, \"iterations\": %lu, \"ns_per_op\": %.3f}%s\n",
+				results[i].name, (unsigned long)results[i].param, (unsigned long)results[i].iterations,
+				results[i].nanosPerOp, i + 1 < results.size() ? "," : "");
+		}
+		fprintf(out, "\t]\n}\n");
+	}
+
+	// ## 02 ## ExchangeHeap
+	struct BenchSmall { Uword a, b; };
+
+	static void benchExchangeHeap(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		bench("exchange_heap_alloc_free_object", sizeof(BenchSmall), [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				Owned<BenchSmall> obj = heap.alloc<BenchSmall>(ctx);
+				sink = (Uword)obj.obj;
+				heap.free(obj.obj);
+			}
+		});
+		// Up to the sizes that come straight from the OS as pages
+		const Uword sizes[] = { 16, 64, 256, 1024, 4096, 65536, HUGE_PAGE_SIZE, 4 * HUGE_PAGE_SIZE };
+		for(Uword s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+			Uword size = sizes[s];
+			bench("exchange_heap_alloc_free_array", size, [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					Owned< Array<U8> > arr = heap.allocArray<U8>(ctx, size);
+					sink = (Uword)arr.obj;
+					heap.free(arr.obj);
+				}
+			});
+			// Same bytes as elements of a typed array, which records its element type
+			bench("exchange_heap_alloc_free_array_f64", size, [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					Owned< Array<F64> > arr = heap.allocArray<F64>(ctx, size / sizeof(F64));
+					sink = (Uword)arr.obj;
+					heap.free(arr.obj);
+				}
+			});
+		}
+	}
+
+	// ## 03 ## Hashtable
+	const Uword BENCH_HASHTABLE_SLOTS = 4096;
+
+	static void benchHashtable(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		// The table grows past HASHTABLE_MAX_LOAD_PERCENT, so that is the highest load measured
+		const Uword loadPercents[] = { 25, 50, HASHTABLE_MAX_LOAD_PERCENT };
+		char name[32];
+		for(Uword l = 0; l < sizeof(loadPercents) / sizeof(loadPercents[0]); ++l) {
+			Hashtable<String, Uword> table;
+			table.ctor(ctx, BENCH_HASHTABLE_SLOTS);
+			// The key count sets the load factor. The table is filled before timing; put then
+			// overwrites present keys, so it never grows and the load stays fixed.
+			Uword count = table.entries->size * loadPercents[l] / 100;
+			std::vector<String> keys;
+			std::vector<String> missing;
+			for(Uword i = 0; i < count; ++i) {
+				snprintf(name, sizeof(name), "key%lu", (unsigned long)i);
+				keys.push_back(String::createFromCString(ctx, name));
+				snprintf(name, sizeof(name), "missing%lu", (unsigned long)i);
+				missing.push_back(String::createFromCString(ctx, name));
+				table.put(ctx, keys[i], i);
+			}
+			bench("hashtable_put_existing", loadPercents[l], [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					table.put(ctx, keys[i % count], i);
+				}
+			});
+			bench("hashtable_get_hit", loadPercents[l], [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					sink = table.get(ctx, keys[i % count]).hasValue();
+				}
+			});
+			bench("hashtable_get_miss", loadPercents[l], [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					sink = table.get(ctx, missing[i % count]).hasValue();
+				}
+			});
+			for(Uword i = 0; i < count; ++i) {
+				heap.free(keys[i].data.obj);
+				heap.free(missing[i].data.obj);
+			}
+			table.dtor(ctx);
+		}
+	}
+
+	// ## 04 ## String
+	static void benchString(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		const Uword lengths[] = { 8, 64, 1024, 65536 };
+		for(Uword l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+			std::string source(lengths[l], 'x');
+			bench("string_create_from_cstring", lengths[l], [&](Uword n) {
+				for(Uword i = 0; i < n; ++i) {
+					String s = String::createFromCString(ctx, source.c_str());
+					sink = s.numCodepoints;
+					heap.free(s.data.obj);
+				}
+			});
+		}
+	}
+
+	// ## 05 ## Protocol dispatch
+	struct BenchKey { Uword value; };
+
+	static Uword benchKeyHash(Context* ctx, Borrowed<BenchKey> self) {
+		return self.obj->value * 0x9e3779b97f4a7c15ULL;
+	}
+
+	static void benchKeyDtor(Context* ctx, Borrowed<BenchKey> self) {
+		sink = self.obj->value;
+	}
+
+	// Calls go through the protocol wrappers, like runtime code does. The vtable pointer is
+	// reloaded from a volatile on every call so the compiler cannot see through it.
+	static void benchDispatch(Context* ctx) {
+		BenchKey key = { 42 };
+		HashableVTable<BenchKey> hashable;
+		hashable.type = nullptr;
+		hashable.fns.hash = benchKeyHash;
+		HashableVTable<BenchKey>* volatile hashableVt = &hashable;
+		Hashable<BenchKey> hashableObj;
+		hashableObj.self = &key;
+		bench("protocol_dispatch_hashable", 0, [&](Uword n) {
+			Uword h = 0;
+			for(Uword i = 0; i < n; ++i) {
+				hashableObj.vtable = hashableVt;
+				h += hashableObj.hash(ctx);
+			}
+			sink = h;
+		});
+		ObjectVTable<BenchKey> object;
+		object.type = nullptr;
+		object.fns.dtor = benchKeyDtor;
+		object.fns.gc_mark = benchKeyDtor;
+		ObjectVTable<BenchKey>* volatile objectVt = &object;
+		Object<BenchKey> objectObj;
+		objectObj.self = &key;
+		bench("protocol_dispatch_object", 0, [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				objectObj.vtable = objectVt;
+				objectObj.dtor(ctx);
+			}
+		});
+	}
+
+	// ## 06 ## Runtime
+	static void benchRuntime() {
+		// Each one creates an execution engine, few iterations are enough
+		bench("runtime_construct_destroy", 0, [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				Runtime rt;
+				sink = (Uword)rt.getCurrentContext();
+			}
+		}, 64);
+		bench("runtime_construct_destroy_no_jit", 0, [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				Runtime rt(RUNTIME_NO_JIT);
+				sink = (Uword)rt.getCurrentContext();
+			}
+		}, 64);
+	}
+
+	// ## 07 ## System
+	static void benchSystem() {
+		static volatile Uword word = 0;
+		bench("system_atomic_get", 0, [&](Uword n) {
+			Uword v = 0;
+			for(Uword i = 0; i < n; ++i) {
+				v += SYS.atomicGetUword(&word);
+			}
+			sink = v;
+		});
+		bench("system_atomic_set", 0, [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				SYS.atomicSetUword(&word, i);
+			}
+		});
+		bench("system_atomic_compare_exchange", 0, [&](Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				SYS.atomicCompareExchangeUword(&word, i, i + 1);
+			}
+		});
+		bench("system_nano_timestamp", 0, [&](Uword n) {
+			U64 t = 0;
+			for(Uword i = 0; i < n; ++i) {
+				t += SYS.nanoTimestamp();
+			}
+			sink = (Uword)t;
+		});
+	}
+
+} // namespace octarine
+
+int main(int argc, char* argv[]) {
+	octarine::Runtime rt;
+	octarine::Context* ctx = rt.getCurrentContext();
+	octarine::benchExchangeHeap(ctx);
+	octarine::benchHashtable(ctx);
+	octarine::benchString(ctx);
+	octarine::benchDispatch(ctx);
+	octarine::benchRuntime();
+	octarine::benchSystem();
+	octarine::printResults(stdout);
+	return 0;
+}
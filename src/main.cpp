@@ -0,0 +1,6 @@
+// The octarine executable, a REPL linked against the static runtime library
+#include "octarine.h"
+
+int main(int argv, char* argc[]) {
+	return oct_main(argv, argc);
+}
@@ -1,5 +1,5 @@
-#ifndef octarine
-#define octarine
+#ifndef OCTARINE_CPP
+#define OCTARINE_CPP
 
 // ## 01 ## Standard library includes
 #include <iostream>
@@ -9,22 +9,76 @@
 #include <exception>
 #include <cstring>
 #include <memory>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 
 // ## 02 ## LLVM includes
 #include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Analysis/DebugInfo.h>
+#include <llvm/Target/TargetOptions.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/DynamicLibrary.h>
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
+#include <llvm/PassManager.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/FormattedStream.h>
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/GlobalVariable.h>
 
 // ## 03 ## Platform includes
 #ifdef _WIN32
 #include <Windows.h>
+#include <intrin.h>
+#include <psapi.h>
 #elif defined (__APPLE__)
 #include <pthread.h>
 #include <libkern/OSAtomic.h>
 #include <mach/mach_time.h>
 #include <time.h>
 #include <unistd.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#elif defined (__linux__)
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <execinfo.h>
+// Guard regions that do not split the mapping, Linux 6.13 and later
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+#endif
+
+// Vector scanning in the reader, SSE2 and NEON are part of the 64 bit baselines
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#elif defined (__aarch64__)
+#include <arm_neon.h>
 #endif
 
 namespace octarine {
@@ -60,6 +114,18 @@ namespace octarine {
 	#define OCT_DEBUG
 	#endif
 
+	#define OCT_THREAD_LOCAL __declspec(thread)
+	#define OCT_LIKELY(x) (x)
+	#define OCT_UNLIKELY(x) (x)
+	#define OCT_ALWAYS_INLINE __forceinline
+	#ifdef OCT_SHARED
+	#define OCT_EXPORT __declspec(dllexport)
+	#else
+	#define OCT_EXPORT
+	#endif
+	// MSVC has no per function instruction sets, the SIMD kernels only get the baseline
+	#define OCT_TARGET(isa)
+
 	#elif defined (__APPLE__)
 
 	typedef int8_t   I8;
@@ -90,10 +156,94 @@ namespace octarine {
 	#define OCT_DEBUG
 	#endif
 
+	#define OCT_THREAD_LOCAL __thread
+	#define OCT_LIKELY(x) __builtin_expect(!!(x), 1)
+	#define OCT_UNLIKELY(x) __builtin_expect(!!(x), 0)
+	#define OCT_ALWAYS_INLINE inline __attribute__((always_inline))
+	// The library is built with hidden visibility, only the C API is exported
+	#define OCT_EXPORT __attribute__((visibility("default")))
+
+	#if defined (__x86_64__) || defined (__i386__)
+	#define OCT_SIMD_X86
+	#define OCT_TARGET(isa) __attribute__((target(isa)))
+	#else
+	#define OCT_TARGET(isa)
+	#endif
+
+	#elif defined (__linux__)
+
+	typedef int8_t   I8;
+	typedef uint8_t  U8;
+	typedef int16_t  I16;
+	typedef uint16_t U16;
+	typedef int32_t  I32;
+	typedef uint32_t U32;
+	typedef int64_t  I64;
+	typedef uint64_t U64;
+	typedef float    F32;
+	typedef double   F64;
+
+	typedef U8 Bool;
+	typedef I32 Char;
+
+	#ifdef __LP64__
+	#define OCT_64
+	typedef I64 Word;
+	typedef U64 Uword;
+	#else
+	#define OCT_32
+	typedef I32 Word;
+	typedef U32 Uword;
+	#endif
+
+	#ifndef NDEBUG
+	#define OCT_DEBUG
+	#endif
+
+	// initial-exec makes a TLS access a single load relative to the thread pointer. A shared
+	// library can be dlopened after startup, when there may be no static TLS space left.
+	#ifdef OCT_SHARED
+	#define OCT_THREAD_LOCAL __thread
+	#else
+	#define OCT_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+	#endif
+	#define OCT_LIKELY(x) __builtin_expect(!!(x), 1)
+	#define OCT_UNLIKELY(x) __builtin_expect(!!(x), 0)
+	#define OCT_ALWAYS_INLINE inline __attribute__((always_inline))
+	// The library is built with hidden visibility, only the C API is exported
+	#define OCT_EXPORT __attribute__((visibility("default")))
+
+	// Lets the SIMD kernels be compiled for several instruction sets in one binary
+	#if defined (__x86_64__) || defined (__i386__)
+	#define OCT_SIMD_X86
+	#define OCT_TARGET(isa) __attribute__((target(isa)))
+	#else
+	#define OCT_TARGET(isa)
+	#endif
+
 	#else
 
 	#endif
 
+	// Instruction set extensions, see System::cpuFeatures
+	enum CpuFeature {
+		CPU_SSE42 = 1,
+		CPU_AVX2 = 2,
+		CPU_AVX512 = 4, // F and BW
+		CPU_NEON = 8
+	};
+
+	// How a memory range is going to be read, see System::adviseAccess
+	enum AccessAdvice {
+		ACCESS_NORMAL = 0,
+		ACCESS_SEQUENTIAL,
+		ACCESS_RANDOM,
+		ACCESS_WILLNEED // Start reading it in now
+	};
+
+	// Huge page size on the platforms that have transparent huge pages, see System::tryAllocPages
+	const Uword HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
 	// ## 05 ## Platform specific code
 	#ifdef _WIN32
 	class System {
@@ -119,6 +269,54 @@ namespace octarine {
 				TlsSetValue(_index, val);
 			}
 		};
+		// One-permit parking spot for a single thread. unpark before park makes park return immediately.
+		class Parker {
+		private:
+			HANDLE _event;
+		public:
+			Parker() {
+				_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+			}
+			~Parker() {
+				CloseHandle(_event);
+			}
+			void park() {
+				WaitForSingleObject(_event, INFINITE);
+			}
+			void unpark() {
+				SetEvent(_event);
+			}
+		};
+		// Blocking lock for short critical sections, waiters sleep in the kernel instead of spinning
+		class Mutex {
+		private:
+			SRWLOCK _lock;
+			Mutex(const Mutex& other);
+			Mutex& operator=(const Mutex& other);
+		public:
+			Mutex() {
+				InitializeSRWLock(&_lock);
+			}
+			void lock() {
+				AcquireSRWLockExclusive(&_lock);
+			}
+			void unlock() {
+				ReleaseSRWLockExclusive(&_lock);
+			}
+		};
+		typedef HANDLE Thread;
+	private:
+		struct ThreadStart {
+			void (*fn)(void* arg);
+			void* arg;
+		};
+		static DWORD WINAPI threadEntry(LPVOID param) {
+			ThreadStart start = *(ThreadStart*)param;
+			::free(param);
+			start.fn(start.arg);
+			return 0;
+		}
+	public:
 		System() {
 			LARGE_INTEGER freq;
 			QueryPerformanceFrequency(&freq);
@@ -132,6 +330,12 @@ namespace octarine {
 			}
 			return place;
 		}
+		void* tryAlloc(Uword size) {
+			return ::malloc(size);
+		}
+		void* tryRealloc(void* place, Uword size) {
+			return ::realloc(place, size);
+		}
 		void free(void* place) {
 			::free(place);
 		}
@@ -147,11 +351,103 @@ namespace octarine {
 		bool atomicCompareExchangeUword(volatile Uword* place, Uword expected, Uword newValue) {
 			return InterlockedCompareExchange(place, newValue, expected) == expected;
 		}
+		// Only orders the stores before it, cheaper than atomicSetUword for publishing
+		void atomicStoreReleaseUword(volatile Uword* place, Uword value) {
+			_ReadWriteBarrier();
+			*place = value;
+		}
+		// Returns the new value
+		Uword atomicAddUword(volatile Uword* place, Uword delta) {
+		#ifdef OCT_64
+			return (Uword)InterlockedExchangeAdd64((volatile LONG64*)place, (LONG64)delta) + delta;
+		#else
+			return (Uword)InterlockedExchangeAdd((volatile LONG*)place, (LONG)delta) + delta;
+		#endif
+		}
+		void memoryBarrier() {
+			MemoryBarrier();
+		}
+		Uword captureBacktrace(void** frames, Uword max) {
+			return CaptureStackBackTrace(1, (DWORD)max, frames, nullptr);
+		}
+		void printBacktrace(void** frames, Uword count) {
+			// TODO: symbolize through dbghelp
+			for(Uword i = 0; i < count; ++i) {
+				fprintf(stderr, "  %p\n", frames[i]);
+			}
+		}
+		Thread startThread(void (*fn)(void* arg), void* arg) {
+			ThreadStart* start = (ThreadStart*)alloc(sizeof(ThreadStart));
+			start->fn = fn;
+			start->arg = arg;
+			HANDLE thread = CreateThread(nullptr, 0, threadEntry, start, 0, nullptr);
+			if(!thread) {
+				::free(start);
+				throw std::bad_alloc();
+			}
+			return thread;
+		}
+		void joinThread(Thread thread) {
+			WaitForSingleObject(thread, INFINITE);
+			CloseHandle(thread);
+		}
+		Uword processorCount() {
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwNumberOfProcessors;
+		}
+		Uword processId() {
+			return (Uword)GetCurrentProcessId();
+		}
+		Uword peakResidentBytes() {
+			PROCESS_MEMORY_COUNTERS counters;
+			if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+				return 0;
+			}
+			return counters.PeakWorkingSetSize;
+		}
+		Uword cpuFeatures() {
+			Uword features = 0;
+		#if defined (_M_X64) || defined (_M_IX86)
+			int info[4];
+			__cpuid(info, 0);
+			int maxLeaf = info[0];
+			__cpuid(info, 1);
+			if(info[2] & (1 << 20)) {
+				features |= CPU_SSE42;
+			}
+			// The OS must save the wide registers too (OSXSAVE and XCR0)
+			if(!(info[2] & (1 << 27)) || maxLeaf < 7) {
+				return features;
+			}
+			U64 xcr0 = _xgetbv(0);
+			__cpuidex(info, 7, 0);
+			if((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5))) {
+				features |= CPU_AVX2;
+			}
+			if((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) && (info[1] & (1 << 30))) {
+				features |= CPU_AVX512;
+			}
+		#elif defined (_M_ARM64)
+			features |= CPU_NEON;
+		#endif
+			return features;
+		}
 		U64 nanoTimestamp() {
 			LARGE_INTEGER now;
 			QueryPerformanceCounter(&now);
 			return U64(double(now.QuadPart)/timerFreq);
 		}
+		// Raw ticks for tracing, a few cycles to read but no fixed unit
+		U64 cycleTimestamp() {
+		#if defined (_M_X64) || defined (_M_IX86)
+			return __rdtsc();
+		#else
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			return now.QuadPart;
+		#endif
+		}
 		void sleep(Uword millis) {
 			Sleep((DWORD)millis);
 		}
@@ -162,6 +458,125 @@ namespace octarine {
 				Sleep(0);
 			}
 		}
+		// Maps a whole file with copy-on-write pages. Returns nullptr on failure.
+		void* mapFile(const char* path, Uword* size, void* preferredAddress = nullptr) {
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(file == INVALID_HANDLE_VALUE) {
+				return nullptr;
+			}
+			LARGE_INTEGER fileSize;
+			if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+				CloseHandle(file);
+				return nullptr;
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			CloseHandle(file);
+			if(!mapping) {
+				return nullptr;
+			}
+			void* place = MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, 0, preferredAddress);
+			if(!place && preferredAddress) {
+				place = MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, 0, nullptr);
+			}
+			// The view keeps the mapping object alive
+			CloseHandle(mapping);
+			*size = (Uword)fileSize.QuadPart;
+			return place;
+		}
+		void unmapFile(void* place, Uword size) {
+			UnmapViewOfFile(place);
+		}
+		Uword mappingGranularity() {
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwAllocationGranularity;
+		}
+		// Maps a whole file read-only and shared with the page cache, right behind lead bytes of
+		// private memory (a multiple of mappingGranularity). Returns the start of the lead, or
+		// nullptr on failure.
+		void* mapFileReadOnly(const char* path, Uword lead, Uword* size) {
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(file == INVALID_HANDLE_VALUE) {
+				return nullptr;
+			}
+			LARGE_INTEGER fileSize;
+			if(!GetFileSizeEx(file, &fileSize)) {
+				CloseHandle(file);
+				return nullptr;
+			}
+			HANDLE mapping = nullptr;
+			if(fileSize.QuadPart) {
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if(!mapping) {
+					CloseHandle(file);
+					return nullptr;
+				}
+			}
+			CloseHandle(file);
+			U8* place = nullptr;
+			// There is no mapping over a reservation here, so find a hole big enough for both and
+			// fill it. Another thread can take the hole in between, then try again.
+			for(int attempt = 0; attempt < 16 && !place; ++attempt) {
+				U8* hole = (U8*)VirtualAlloc(nullptr, lead + (Uword)fileSize.QuadPart, MEM_RESERVE, PAGE_NOACCESS);
+				if(!hole) {
+					break;
+				}
+				VirtualFree(hole, 0, MEM_RELEASE);
+				if(mapping && !MapViewOfFileEx(mapping, FILE_MAP_READ, 0, 0, 0, hole + lead)) {
+					continue;
+				}
+				place = (U8*)VirtualAlloc(hole, lead, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				if(!place && mapping) {
+					UnmapViewOfFile(hole + lead);
+				}
+			}
+			if(mapping) {
+				CloseHandle(mapping);
+			}
+			*size = (Uword)fileSize.QuadPart;
+			return place;
+		}
+		void unmapFileReadOnly(void* place, Uword lead, Uword size) {
+			if(size) {
+				UnmapViewOfFile(((U8*)place) + lead);
+			}
+			VirtualFree(place, 0, MEM_RELEASE);
+		}
+		// Native code compiled ahead of time. nullptr if the library cannot be loaded.
+		void* loadLibrary(const char* path) {
+			return LoadLibraryA(path);
+		}
+		void* findSymbol(void* library, const char* name) {
+			return (void*)GetProcAddress((HMODULE)library, name);
+		}
+		void unloadLibrary(void* library) {
+			FreeLibrary((HMODULE)library);
+		}
+		void adviseAccess(void* place, Uword size, AccessAdvice advice) {
+			// Only prefetching has a counterpart
+			if(advice == ACCESS_WILLNEED) {
+				WIN32_MEMORY_RANGE_ENTRY range;
+				range.VirtualAddress = place;
+				range.NumberOfBytes = size;
+				PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+			}
+		}
+		// Whole pages straight from the OS. Large pages need a privilege most processes do not
+		// have, so huge is ignored here.
+		void* tryAllocPages(Uword size, bool huge) {
+			return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		}
+		void freePages(void* place, Uword size) {
+			VirtualFree(place, 0, MEM_RELEASE);
+		}
+		void* tryReallocPages(void* place, Uword oldSize, Uword size, bool huge) {
+			void* moved = tryAllocPages(size, huge);
+			if(moved) {
+				memcpy(moved, place, oldSize < size ? oldSize : size);
+				freePages(place, oldSize);
+			}
+			return moved;
+		}
 	};
     #elif defined (__APPLE__)
 	class System {
@@ -187,6 +602,69 @@ namespace octarine {
                 pthread_setspecific(_key, val);
 			}
 		};
+		// One-permit parking spot for a single thread. unpark before park makes park return immediately.
+		class Parker {
+		private:
+			pthread_mutex_t _mutex;
+			pthread_cond_t _cond;
+			bool _permit;
+		public:
+			Parker(): _permit(false) {
+				pthread_mutex_init(&_mutex, nullptr);
+				pthread_cond_init(&_cond, nullptr);
+			}
+			~Parker() {
+				pthread_cond_destroy(&_cond);
+				pthread_mutex_destroy(&_mutex);
+			}
+			void park() {
+				pthread_mutex_lock(&_mutex);
+				while(!_permit) {
+					pthread_cond_wait(&_cond, &_mutex);
+				}
+				_permit = false;
+				pthread_mutex_unlock(&_mutex);
+			}
+			void unpark() {
+				pthread_mutex_lock(&_mutex);
+				_permit = true;
+				pthread_cond_signal(&_cond);
+				pthread_mutex_unlock(&_mutex);
+			}
+		};
+		// Blocking lock for short critical sections, waiters sleep in the kernel instead of spinning
+		class Mutex {
+		private:
+			pthread_mutex_t _mutex;
+			Mutex(const Mutex& other);
+			Mutex& operator=(const Mutex& other);
+		public:
+			Mutex() {
+				pthread_mutex_init(&_mutex, nullptr);
+			}
+			~Mutex() {
+				pthread_mutex_destroy(&_mutex);
+			}
+			void lock() {
+				pthread_mutex_lock(&_mutex);
+			}
+			void unlock() {
+				pthread_mutex_unlock(&_mutex);
+			}
+		};
+		typedef pthread_t Thread;
+	private:
+		struct ThreadStart {
+			void (*fn)(void* arg);
+			void* arg;
+		};
+		static void* threadEntry(void* param) {
+			ThreadStart start = *(ThreadStart*)param;
+			::free(param);
+			start.fn(start.arg);
+			return nullptr;
+		}
+	public:
 		System() {
             mach_timebase_info(&_timebaseInfo);
 		}
@@ -198,6 +676,12 @@ namespace octarine {
 			}
 			return place;
 		}
+		void* tryAlloc(Uword size) {
+			return ::malloc(size);
+		}
+		void* tryRealloc(void* place, Uword size) {
+			return ::realloc(place, size);
+		}
 		void free(void* place) {
 			::free(place);
 		}
@@ -226,12 +710,80 @@ namespace octarine {
                 return OSAtomicCompareAndSwap64Barrier((int64_t)expected, (int64_t)newValue, (volatile int64_t*)place);
             #endif
 		}
+		// Only orders the stores before it, cheaper than atomicSetUword for publishing
+		void atomicStoreReleaseUword(volatile Uword* place, Uword value) {
+			__atomic_store_n(place, value, __ATOMIC_RELEASE);
+		}
+		// Returns the new value
+		Uword atomicAddUword(volatile Uword* place, Uword delta) {
+            #ifdef OCT_64
+                return (Uword)OSAtomicAdd64Barrier((int64_t)delta, (volatile int64_t*)place);
+            #endif
+		}
+		void memoryBarrier() {
+			OSMemoryBarrier();
+		}
+		Uword captureBacktrace(void** frames, Uword max) {
+			int count = backtrace(frames, (int)max);
+			return count > 0 ? (Uword)count : 0;
+		}
+		void printBacktrace(void** frames, Uword count) {
+			backtrace_symbols_fd(frames, (int)count, 2);
+		}
+		Thread startThread(void (*fn)(void* arg), void* arg) {
+			ThreadStart* start = (ThreadStart*)alloc(sizeof(ThreadStart));
+			start->fn = fn;
+			start->arg = arg;
+			pthread_t thread;
+			if(pthread_create(&thread, nullptr, threadEntry, start) != 0) {
+				::free(start);
+				throw std::bad_alloc();
+			}
+			return thread;
+		}
+		void joinThread(Thread thread) {
+			pthread_join(thread, nullptr);
+		}
+		Uword processorCount() {
+			long count = sysconf(_SC_NPROCESSORS_ONLN);
+			return count > 0 ? (Uword)count : 1;
+		}
+		Uword processId() {
+			return (Uword)getpid();
+		}
+		Uword peakResidentBytes() {
+			struct rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			return (Uword)usage.ru_maxrss; // Bytes here
+		}
+		Uword cpuFeatures() {
+			Uword features = 0;
+		#ifdef OCT_SIMD_X86
+			__builtin_cpu_init();
+			if(__builtin_cpu_supports("sse4.2")) {
+				features |= CPU_SSE42;
+			}
+			if(__builtin_cpu_supports("avx2")) {
+				features |= CPU_AVX2;
+			}
+			if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+				features |= CPU_AVX512;
+			}
+		#elif defined (__aarch64__) || defined (__ARM_NEON)
+			features |= CPU_NEON;
+		#endif
+			return features;
+		}
 		U64 nanoTimestamp() {
 			U64 ts = mach_absolute_time();
             ts *= _timebaseInfo.numer;
             ts /= _timebaseInfo.denom;
 			return ts;
 		}
+		// Raw ticks for tracing, a few cycles to read but no fixed unit
+		U64 cycleTimestamp() {
+			return mach_absolute_time();
+		}
 		void sleep(Uword millis) {
             usleep(millis * 1000);
 		}
@@ -241,65 +793,739 @@ namespace octarine {
             ts.tv_nsec = nanos;
             nanosleep(&ts, nullptr);
 		}
+		// Maps a whole file with copy-on-write pages. Returns nullptr on failure.
+		void* mapFile(const char* path, Uword* size, void* preferredAddress = nullptr) {
+			int fd = open(path, O_RDONLY);
+			if(fd == -1) {
+				return nullptr;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0 || st.st_size == 0) {
+				close(fd);
+				return nullptr;
+			}
+			void* place = mmap(preferredAddress, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(place == MAP_FAILED) {
+				return nullptr;
+			}
+			*size = (Uword)st.st_size;
+			return place;
+		}
+		void unmapFile(void* place, Uword size) {
+			munmap(place, size);
+		}
+		Uword mappingGranularity() {
+			return (Uword)sysconf(_SC_PAGESIZE);
+		}
+		// Maps a whole file read-only and shared with the page cache, right behind lead bytes of
+		// private memory (a multiple of mappingGranularity). Returns the start of the lead, or
+		// nullptr on failure.
+		void* mapFileReadOnly(const char* path, Uword lead, Uword* size) {
+			int fd = open(path, O_RDONLY);
+			if(fd == -1) {
+				return nullptr;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0) {
+				close(fd);
+				return nullptr;
+			}
+			U8* place = (U8*)mmap(nullptr, lead + st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+			if(place == MAP_FAILED) {
+				close(fd);
+				return nullptr;
+			}
+			// The file replaces the anonymous pages past the lead
+			if(st.st_size && mmap(place + lead, st.st_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				munmap(place, lead + st.st_size);
+				close(fd);
+				return nullptr;
+			}
+			close(fd);
+			*size = (Uword)st.st_size;
+			return place;
+		}
+		void unmapFileReadOnly(void* place, Uword lead, Uword size) {
+			munmap(place, lead + size);
+		}
+		// Native code compiled ahead of time. nullptr if the library cannot be loaded.
+		void* loadLibrary(const char* path) {
+			return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+		}
+		void* findSymbol(void* library, const char* name) {
+			return dlsym(library, name);
+		}
+		void unloadLibrary(void* library) {
+			dlclose(library);
+		}
+		void adviseAccess(void* place, Uword size, AccessAdvice advice) {
+			// madvise wants a page aligned start
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			Uword start = (Uword)place & ~(page - 1);
+			size += (Uword)place - start;
+			int flags[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+			madvise((void*)start, size, flags[advice]);
+		}
+		// Whole pages straight from the OS. There are no transparent huge pages, so huge is ignored.
+		void* tryAllocPages(Uword size, bool huge) {
+			void* place = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+			return place == MAP_FAILED ? nullptr : place;
+		}
+		void freePages(void* place, Uword size) {
+			munmap(place, size);
+		}
+		void* tryReallocPages(void* place, Uword oldSize, Uword size, bool huge) {
+			void* moved = tryAllocPages(size, huge);
+			if(moved) {
+				memcpy(moved, place, oldSize < size ? oldSize : size);
+				freePages(place, oldSize);
+			}
+			return moved;
+		}
+		// Reserves a fiber stack with a guard page at the low end. Pages are only backed by
+		// memory once they are touched, so a large reservation costs little for small fibers.
+		void* allocStack(Uword size) {
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			void* place = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+			if(place == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+			mprotect(place, page, PROT_NONE);
+			return ((U8*)place) + page;
+		}
+		void freeStack(void* stack, Uword size) {
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			munmap(((U8*)stack) - page, size + page);
+		}
 	};
-	#endif
-
-	static System SYS;
-
-	// ## 05.01 ## Forward declarations
-	class Context;
-	struct Type;
-	struct Namespace;
-	template <typename TSelf>
-	struct HashtableKey;
-	struct Nothing;
-
-	// ## 07 ## Global constants
-	const Bool True = 1;
-	const Bool False = 0;
-
-	// ## 08 ## Template functions and values
-	namespace t {
-
+	#elif defined (__linux__)
+	class System {
+	public:
 		template <typename T>
-		struct is_protocol {
-			static const bool value = false;
+		class ThreadLocal {
+		private:
+			pthread_key_t _key;
+		public:
+			ThreadLocal(T* val = nullptr) {
+				pthread_key_create(&_key, nullptr);
+				pthread_setspecific(_key, val);
+			}
+			~ThreadLocal() {
+				pthread_key_delete(_key);
+			}
+			T* get() const {
+				return (T*)pthread_getspecific(_key);
+			}
+			void set(T* val) {
+				pthread_setspecific(_key, val);
+			}
 		};
+		// One-permit parking spot for a single thread. unpark before park makes park return immediately.
+		class Parker {
+		private:
+			volatile I32 _permit; // futex word
+		public:
+			Parker(): _permit(0) {
+			}
+			void park() {
+				while(!__sync_bool_compare_and_swap(&_permit, 1, 0)) {
+					syscall(SYS_futex, &_permit, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+				}
+			}
+			void unpark() {
+				if(__sync_lock_test_and_set(&_permit, 1) == 0) {
+					syscall(SYS_futex, &_permit, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+				}
+			}
+		};
+		// Blocking lock for short critical sections, waiters sleep in the kernel instead of spinning
+		class Mutex {
+		private:
+			pthread_mutex_t _mutex;
+			Mutex(const Mutex& other);
+			Mutex& operator=(const Mutex& other);
+		public:
+			Mutex() {
+				pthread_mutex_init(&_mutex, nullptr);
+			}
+			~Mutex() {
+				pthread_mutex_destroy(&_mutex);
+			}
+			void lock() {
+				pthread_mutex_lock(&_mutex);
+			}
+			void unlock() {
+				pthread_mutex_unlock(&_mutex);
+			}
+		};
+		typedef pthread_t Thread;
+	private:
+		struct ThreadStart {
+			void (*fn)(void* arg);
+			void* arg;
+		};
+		static void* threadEntry(void* param) {
+			ThreadStart start = *(ThreadStart*)param;
+			::free(param);
+			start.fn(start.arg);
+			return nullptr;
+		}
+	public:
+		System() { }
+		~System() { }
+		void* alloc(Uword size) {
+			void* place = ::malloc(size);
+			if(!place) {
+				throw std::bad_alloc();
+			}
+			return place;
+		}
+		void* tryAlloc(Uword size) {
+			return ::malloc(size);
+		}
+		void* tryRealloc(void* place, Uword size) {
+			return ::realloc(place, size);
+		}
+		void free(void* place) {
+			::free(place);
+		}
+		void atomicSetUword(volatile Uword* place, Uword value) {
+			__sync_synchronize();
+			*place = value;
+			__sync_synchronize();
+		}
+		Uword atomicGetUword(volatile Uword* place) {
+			Uword val = *place;
+			__sync_synchronize();
+			return val;
+		}
+		bool atomicCompareExchangeUword(volatile Uword* place, Uword expected, Uword newValue) {
+			return __sync_bool_compare_and_swap(place, expected, newValue);
+		}
+		// Only orders the stores before it, cheaper than atomicSetUword for publishing
+		void atomicStoreReleaseUword(volatile Uword* place, Uword value) {
+			__atomic_store_n(place, value, __ATOMIC_RELEASE);
+		}
+		// Returns the new value
+		Uword atomicAddUword(volatile Uword* place, Uword delta) {
+			return __sync_add_and_fetch(place, delta);
+		}
+		void memoryBarrier() {
+			__sync_synchronize();
+		}
+		Uword captureBacktrace(void** frames, Uword max) {
+			int count = backtrace(frames, (int)max);
+			return count > 0 ? (Uword)count : 0;
+		}
+		void printBacktrace(void** frames, Uword count) {
+			backtrace_symbols_fd(frames, (int)count, 2);
+		}
+		Thread startThread(void (*fn)(void* arg), void* arg) {
+			ThreadStart* start = (ThreadStart*)alloc(sizeof(ThreadStart));
+			start->fn = fn;
+			start->arg = arg;
+			pthread_t thread;
+			if(pthread_create(&thread, nullptr, threadEntry, start) != 0) {
+				::free(start);
+				throw std::bad_alloc();
+			}
+			return thread;
+		}
+		void joinThread(Thread thread) {
+			pthread_join(thread, nullptr);
+		}
+		Uword processorCount() {
+			long count = sysconf(_SC_NPROCESSORS_ONLN);
+			return count > 0 ? (Uword)count : 1;
+		}
+		Uword processId() {
+			return (Uword)getpid();
+		}
+		Uword peakResidentBytes() {
+			struct rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			return (Uword)usage.ru_maxrss * 1024; // Kilobytes here
+		}
+		Uword cpuFeatures() {
+			Uword features = 0;
+		#ifdef OCT_SIMD_X86
+			__builtin_cpu_init();
+			if(__builtin_cpu_supports("sse4.2")) {
+				features |= CPU_SSE42;
+			}
+			if(__builtin_cpu_supports("avx2")) {
+				features |= CPU_AVX2;
+			}
+			if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+				features |= CPU_AVX512;
+			}
+		#elif defined (__aarch64__) || defined (__ARM_NEON)
+			features |= CPU_NEON;
+		#endif
+			return features;
+		}
+		U64 nanoTimestamp() {
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return U64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+		// Raw ticks for tracing, a few cycles to read but no fixed unit
+		U64 cycleTimestamp() {
+		#if defined (__x86_64__) || defined (__i386__)
+			return __builtin_ia32_rdtsc();
+		#elif defined (__aarch64__)
+			U64 ticks;
+			__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+			return ticks;
+		#else
+			return nanoTimestamp();
+		#endif
+		}
+		void sleep(Uword millis) {
+			usleep(millis * 1000);
+		}
+		void sleepNanos(U64 nanos) {
+			timespec ts;
+			ts.tv_sec = nanos / 1000000000;
+			ts.tv_nsec = nanos % 1000000000;
+			nanosleep(&ts, nullptr);
+		}
+		// Maps a whole file with copy-on-write pages. Returns nullptr on failure.
+		void* mapFile(const char* path, Uword* size, void* preferredAddress = nullptr) {
+			int fd = open(path, O_RDONLY);
+			if(fd == -1) {
+				return nullptr;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0 || st.st_size == 0) {
+				close(fd);
+				return nullptr;
+			}
+			void* place = mmap(preferredAddress, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(place == MAP_FAILED) {
+				return nullptr;
+			}
+			*size = (Uword)st.st_size;
+			return place;
+		}
+		void unmapFile(void* place, Uword size) {
+			munmap(place, size);
+		}
+		Uword mappingGranularity() {
+			return (Uword)sysconf(_SC_PAGESIZE);
+		}
+		// Maps a whole file read-only and shared with the page cache, right behind lead bytes of
+		// private memory (a multiple of mappingGranularity). Returns the start of the lead, or
+		// nullptr on failure.
+		void* mapFileReadOnly(const char* path, Uword lead, Uword* size) {
+			int fd = open(path, O_RDONLY);
+			if(fd == -1) {
+				return nullptr;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0) {
+				close(fd);
+				return nullptr;
+			}
+			U8* place = (U8*)mmap(nullptr, lead + st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+			if(place == MAP_FAILED) {
+				close(fd);
+				return nullptr;
+			}
+			// The file replaces the anonymous pages past the lead
+			if(st.st_size && mmap(place + lead, st.st_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				munmap(place, lead + st.st_size);
+				close(fd);
+				return nullptr;
+			}
+			close(fd);
+			*size = (Uword)st.st_size;
+			return place;
+		}
+		void unmapFileReadOnly(void* place, Uword lead, Uword size) {
+			munmap(place, lead + size);
+		}
+		// Native code compiled ahead of time. nullptr if the library cannot be loaded.
+		void* loadLibrary(const char* path) {
+			return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+		}
+		void* findSymbol(void* library, const char* name) {
+			return dlsym(library, name);
+		}
+		void unloadLibrary(void* library) {
+			dlclose(library);
+		}
+		void adviseAccess(void* place, Uword size, AccessAdvice advice) {
+			// madvise wants a page aligned start
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			Uword start = (Uword)place & ~(page - 1);
+			size += (Uword)place - start;
+			int flags[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+			madvise((void*)start, size, flags[advice]);
+		}
+		// Whole pages straight from the OS. With huge set the range is aligned to a huge page and
+		// the kernel is asked to back it with transparent huge pages, which cuts TLB misses when
+		// streaming over large arrays.
+		void* tryAllocPages(Uword size, bool huge) {
+			if(!huge) {
+				void* place = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				return place == MAP_FAILED ? nullptr : place;
+			}
+			// Over-reserve, then trim both ends so the range starts on a huge page boundary. The
+			// tail can only be unmapped from a page boundary.
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			size = (size + page - 1) & ~(page - 1);
+			U8* place = (U8*)mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(place == MAP_FAILED) {
+				return nullptr;
+			}
+			U8* aligned = (U8*)(((Uword)place + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+			if(aligned != place) {
+				munmap(place, aligned - place);
+			}
+			munmap(aligned + size, (place + size + HUGE_PAGE_SIZE) - (aligned + size));
+		#ifdef MADV_HUGEPAGE
+			madvise(aligned, size, MADV_HUGEPAGE);
+		#endif
+			return aligned;
+		}
+		void freePages(void* place, Uword size) {
+			munmap(place, size);
+		}
+		// Lets the kernel move the page table entries instead of copying the contents
+		void* tryReallocPages(void* place, Uword oldSize, Uword size, bool huge) {
+			void* moved = mremap(place, oldSize, size, MREMAP_MAYMOVE);
+			if(moved == MAP_FAILED) {
+				return nullptr;
+			}
+		#ifdef MADV_HUGEPAGE
+			if(huge) {
+				madvise(moved, size, MADV_HUGEPAGE);
+			}
+		#endif
+			return moved;
+		}
+		// Reserves a fiber stack with a guard page at the low end. Pages are only backed by
+		// memory once they are touched, so a large reservation costs little for small fibers.
+		// A guard region keeps the stack in one VMA, and adjacent stacks merge into one, so
+		// vm.max_map_count does not cap the number of fibers. Older kernels get mprotect,
+		// which costs a second VMA per stack.
+		void* allocStack(Uword size) {
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			void* place = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if(place == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+			if(madvise(place, page, MADV_GUARD_INSTALL) != 0) {
+				mprotect(place, page, PROT_NONE);
+			}
+			return ((U8*)place) + page;
+		}
+		void freeStack(void* stack, Uword size) {
+			Uword page = (Uword)sysconf(_SC_PAGESIZE);
+			munmap(((U8*)stack) - page, size + page);
+		}
+	};
+	#endif
+
+	static System SYS;
+
+	// Holds a System::Mutex for the rest of the scope, also when an exception leaves it
+	class MutexLock {
+	private:
+		System::Mutex& _mutex;
+		MutexLock(const MutexLock& other);
+		MutexLock& operator=(const MutexLock& other);
+	public:
+		explicit MutexLock(System::Mutex& mutex): _mutex(mutex) {
+			_mutex.lock();
+		}
+		~MutexLock() {
+			_mutex.unlock();
+		}
+	};
+
+	// Fiber stack switching. Windows has native fibers, everywhere else we swap the
+	// callee-saved registers, the floating point control state and the stack pointer
+	// ourselves. Other architectures get no fibers, Scheduler::spawnFiber throws there.
+	#if defined (_WIN32) || defined (__x86_64__) || defined (__aarch64__)
+	#define OCT_FIBERS
+	#endif
+
+	#if !defined (_WIN32) && defined (OCT_FIBERS)
+
+	// Hidden keeps the helpers out of the shared library's exports. Type and size let
+	// debuggers and profilers symbolize them, the CFI lets unwinders walk through them.
+	#ifdef __APPLE__
+	#define OCT_ASM_SYMBOL(name) "_" #name
+	#define OCT_ASM_HIDDEN(name) ".private_extern _" #name "\n"
+	#define OCT_ASM_TYPE(name)
+	#define OCT_ASM_SIZE(name)
+	#else
+	#define OCT_ASM_SYMBOL(name) #name
+	#define OCT_ASM_HIDDEN(name) ".hidden " #name "\n"
+	#define OCT_ASM_TYPE(name) ".type " #name ", %function\n"
+	#define OCT_ASM_SIZE(name) ".size " #name ", .-" #name "\n"
+	#endif
+
+	// Pushes the callee-saved registers, stores the stack pointer in *from, then
+	// switches to the stack at to and pops the registers that were saved there. Both
+	// stacks hold the same frame layout, so one set of CFI describes either side.
+	extern "C" void oct_fiber_switch(void** from, void* to);
+	// Bottom frame of a new fiber. Calls the function in the second saved register
+	// with the first saved register as its argument. The return address is marked
+	// undefined, so unwinders stop here. The function never returns.
+	extern "C" void oct_fiber_trampoline();
+
+	#if defined (__x86_64__)
+	__asm__(
+		".text\n"
+		".globl " OCT_ASM_SYMBOL(oct_fiber_switch) "\n"
+		OCT_ASM_HIDDEN(oct_fiber_switch)
+		OCT_ASM_TYPE(oct_fiber_switch)
+		".p2align 4\n"
+		OCT_ASM_SYMBOL(oct_fiber_switch) ":\n"
+		"	.cfi_startproc\n"
+		"	pushq %rbp\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %rbp, 0\n"
+		"	pushq %rbx\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %rbx, 0\n"
+		"	pushq %r12\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %r12, 0\n"
+		"	pushq %r13\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %r13, 0\n"
+		"	pushq %r14\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %r14, 0\n"
+		"	pushq %r15\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	.cfi_rel_offset %r15, 0\n"
+		"	subq $8, %rsp\n"
+		"	.cfi_adjust_cfa_offset 8\n"
+		"	stmxcsr (%rsp)\n"
+		"	fnstcw 4(%rsp)\n"
+		"	movq %rsp, (%rdi)\n"
+		"	movq %rsi, %rsp\n"
+		"	ldmxcsr (%rsp)\n"
+		"	fldcw 4(%rsp)\n"
+		"	addq $8, %rsp\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	popq %r15\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %r15\n"
+		"	popq %r14\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %r14\n"
+		"	popq %r13\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %r13\n"
+		"	popq %r12\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %r12\n"
+		"	popq %rbx\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %rbx\n"
+		"	popq %rbp\n"
+		"	.cfi_adjust_cfa_offset -8\n"
+		"	.cfi_restore %rbp\n"
+		"	ret\n"
+		"	.cfi_endproc\n"
+		OCT_ASM_SIZE(oct_fiber_switch)
+		".globl " OCT_ASM_SYMBOL(oct_fiber_trampoline) "\n"
+		OCT_ASM_HIDDEN(oct_fiber_trampoline)
+		OCT_ASM_TYPE(oct_fiber_trampoline)
+		".p2align 4\n"
+		OCT_ASM_SYMBOL(oct_fiber_trampoline) ":\n"
+		"	.cfi_startproc\n"
+		"	.cfi_undefined %rip\n"
+		"	movq %r12, %rdi\n"
+		"	callq *%r13\n"
+		"	ud2\n"
+		"	.cfi_endproc\n"
+		OCT_ASM_SIZE(oct_fiber_trampoline)
+	);
+	#elif defined (__aarch64__)
+	__asm__(
+		".text\n"
+		".globl " OCT_ASM_SYMBOL(oct_fiber_switch) "\n"
+		OCT_ASM_HIDDEN(oct_fiber_switch)
+		OCT_ASM_TYPE(oct_fiber_switch)
+		".p2align 4\n"
+		OCT_ASM_SYMBOL(oct_fiber_switch) ":\n"
+		"	.cfi_startproc\n"
+		"	sub sp, sp, #176\n"
+		"	.cfi_def_cfa_offset 176\n"
+		"	stp x19, x20, [sp, #0]\n"
+		"	stp x21, x22, [sp, #16]\n"
+		"	stp x23, x24, [sp, #32]\n"
+		"	stp x25, x26, [sp, #48]\n"
+		"	stp x27, x28, [sp, #64]\n"
+		"	stp x29, x30, [sp, #80]\n"
+		"	stp d8, d9, [sp, #96]\n"
+		"	stp d10, d11, [sp, #112]\n"
+		"	stp d12, d13, [sp, #128]\n"
+		"	stp d14, d15, [sp, #144]\n"
+		"	mrs x9, fpcr\n"
+		"	str x9, [sp, #160]\n"
+		"	.cfi_offset x19, -176\n"
+		"	.cfi_offset x20, -168\n"
+		"	.cfi_offset x21, -160\n"
+		"	.cfi_offset x22, -152\n"
+		"	.cfi_offset x23, -144\n"
+		"	.cfi_offset x24, -136\n"
+		"	.cfi_offset x25, -128\n"
+		"	.cfi_offset x26, -120\n"
+		"	.cfi_offset x27, -112\n"
+		"	.cfi_offset x28, -104\n"
+		"	.cfi_offset x29, -96\n"
+		"	.cfi_offset x30, -88\n"
+		"	.cfi_offset d8, -80\n"
+		"	.cfi_offset d9, -72\n"
+		"	.cfi_offset d10, -64\n"
+		"	.cfi_offset d11, -56\n"
+		"	.cfi_offset d12, -48\n"
+		"	.cfi_offset d13, -40\n"
+		"	.cfi_offset d14, -32\n"
+		"	.cfi_offset d15, -24\n"
+		"	mov x9, sp\n"
+		"	str x9, [x0]\n"
+		"	mov sp, x1\n"
+		"	ldp x19, x20, [sp, #0]\n"
+		"	ldp x21, x22, [sp, #16]\n"
+		"	ldp x23, x24, [sp, #32]\n"
+		"	ldp x25, x26, [sp, #48]\n"
+		"	ldp x27, x28, [sp, #64]\n"
+		"	ldp x29, x30, [sp, #80]\n"
+		"	ldp d8, d9, [sp, #96]\n"
+		"	ldp d10, d11, [sp, #112]\n"
+		"	ldp d12, d13, [sp, #128]\n"
+		"	ldp d14, d15, [sp, #144]\n"
+		"	ldr x9, [sp, #160]\n"
+		"	msr fpcr, x9\n"
+		"	add sp, sp, #176\n"
+		"	.cfi_def_cfa_offset 0\n"
+		"	ret\n"
+		"	.cfi_endproc\n"
+		OCT_ASM_SIZE(oct_fiber_switch)
+		".globl " OCT_ASM_SYMBOL(oct_fiber_trampoline) "\n"
+		OCT_ASM_HIDDEN(oct_fiber_trampoline)
+		OCT_ASM_TYPE(oct_fiber_trampoline)
+		".p2align 4\n"
+		OCT_ASM_SYMBOL(oct_fiber_trampoline) ":\n"
+		"	.cfi_startproc\n"
+		"	.cfi_undefined x30\n"
+		"	mov x0, x19\n"
+		"	blr x20\n"
+		"	brk #0\n"
+		"	.cfi_endproc\n"
+		OCT_ASM_SIZE(oct_fiber_trampoline)
+	);
+	#endif
+
+	#endif
+
+	// ## 05.01 ## Forward declarations
+	class Context;
+	struct Type;
+	struct Namespace;
+	struct NamespaceCell;
+	struct OwnedBoxHeader;
+	template <typename TSelf>
+	struct HashtableKey;
+	template <typename T>
+	struct Object;
+	template <typename T>
+	struct EqComparable;
+	template <typename T>
+	struct Hashable;
+	struct Nothing;
+	class Scheduler;
+	class Fiber;
+	struct Worker;
+	class Image;
+
+	// ## 07 ## Global constants
+	const Bool True = 1;
+	const Bool False = 0;
+	// Alignment of ALLOC_ALIGNED array data, a cache line, which is also the widest SIMD register
+	const Uword ARRAY_ALIGNMENT = 64;
+
+	// ## 08 ## Template functions and values
+	namespace t {
+
+		template <typename T>
+		struct is_protocol {
+			static const bool value = false;
+		};
+
+		// Must be visible before the first Pointer to a protocol is instantiated
+		template <typename T>
+		struct is_protocol< Object<T> > {
+			static const bool value = true;
+		};
+
+		template <typename T>
+		struct is_protocol< EqComparable<T> > {
+			static const bool value = true;
+		};
+
+		template <typename T>
+		struct is_protocol< Hashable<T> > {
+			static const bool value = true;
+		};
+
+		template <typename T>
+		struct is_protocol< HashtableKey<T> > {
+			static const bool value = true;
+		};
+
+		// Whether an object may be moved with memcpy, which lets arrays of it grow with realloc.
+		// Specialize to false for types that keep pointers into themselves.
+		template <typename T>
+		struct trivially_relocatable {
+			static const bool value = std::is_trivially_copyable<T>::value;
+		};
+
+	} // namespace t
+
+	// ## 06 ## Declarations
+
+	// DEC Unknown. Use this type when the type is known only at runtime
+	struct Unknown { };
+
+	// DEC Nothing. A type that, with variadic types, replaces the use of null pointers.
+#if defined (__APPLE__) || defined (__linux__)
+	struct Nothing { Nothing() {} };
+#elif defined _WIN32
+	struct Nothing { };
+#endif
+	static const Nothing nil;
+
+	// DEC OwnageType for pointers
+	enum OwnageType {
+		OWNED = 0,
+		BORROWED,
+		MANAGED,
+		CONSTANT
+	};
+
+	// DEC Pointer
+	template <OwnageType OT, typename T, bool is_pobject>
+	struct PointerBase {
+		T* obj;
+
+		static const OwnageType ownage = OT;
+		static const Bool pobject = False;
+		T* operator->() { return obj; }
+		void dtor(Context* ctx);
+	};
 
-	} // namespace t
-
-	// ## 06 ## Declarations
-
-	// DEC Unknown. Use this type when the type is known only at runtime
-	struct Unknown { };
-
-	// DEC Nothing. A type that, with variadic types, replaces the use of null pointers.
-#ifdef __APPLE__
-	struct Nothing { Nothing() {} };
-#elif defined _WIN32
-	struct Nothing { };
-#endif
-	static const Nothing nil;
-
-	// DEC OwnageType for pointers
-	enum OwnageType {
-		OWNED = 0,
-		BORROWED,
-		MANAGED,
-		CONSTANT
-	};
-
-	// DEC Pointer
-	template <OwnageType OT, typename T, bool is_pobject>
-	struct PointerBase {
-		T* obj;
-
-		static const OwnageType ownage = OT;
-		static const Bool pobject = False;
-		T* operator->() { return obj; }
-		void dtor(Context* ctx);
-	};
-
 	template <OwnageType OT, typename T>
 	struct PointerBase<OT, T, true> {
 		T obj;
@@ -340,21 +1566,145 @@ namespace octarine {
 		T data[size];
 	};
 
-	// DEC ExchangeHeap
-	class ExchangeHeap {
+	// DEC Simd. Bulk kernels over arrays of F32, F64, I32, I64 and U8. Every kernel is compiled
+	// once per instruction set and the best one for the running CPU is picked at startup.
+	// JITed code calls the same kernels through the oct_simd_<kernel>_<type> symbols.
+	enum SimdOp {
+		SIMD_ADD = 0,
+		SIMD_SUB,
+		SIMD_MUL,
+		SIMD_MIN,
+		SIMD_MAX
+	};
+
+	enum SimdCmp {
+		SIMD_EQ = 0,
+		SIMD_NE,
+		SIMD_LT,
+		SIMD_LE,
+		SIMD_GT,
+		SIMD_GE
+	};
+
+	// Result of reduce and dot. Sums and products are accumulated in Acc, so U8 does not wrap
+	// at 256, I32 does not overflow and F32 keeps its precision. Integers accumulate unsigned,
+	// where wrapping is defined, and come back as the signed result.
+	template <typename T>
+	struct SimdWide;
+	template <> struct SimdWide<F32> { typedef F64 Type; typedef F64 Acc; };
+	template <> struct SimdWide<F64> { typedef F64 Type; typedef F64 Acc; };
+	template <> struct SimdWide<I32> { typedef I64 Type; typedef U64 Acc; };
+	template <> struct SimdWide<I64> { typedef I64 Type; typedef U64 Acc; };
+	template <> struct SimdWide<U8> { typedef U64 Type; typedef U64 Acc; };
+
+	// The raw kernels work on pointers and a length. out may alias an input except in
+	// prefixSum, gather and scatter.
+	template <typename T>
+	struct SimdKernels {
+		typedef typename SimdWide<T>::Type Wide;
+		void (*map)(SimdOp op, const T* a, const T* b, T* out, Uword n);
+		void (*mapScalar)(SimdOp op, const T* a, T b, T* out, Uword n);
+		Wide (*reduce)(SimdOp op, const T* a, Uword n); // n > 0 for SIMD_MIN and SIMD_MAX
+		Wide (*dot)(const T* a, const T* b, Uword n);
+		void (*prefixSum)(const T* a, T* out, Uword n);
+		void (*compare)(SimdCmp cmp, const T* a, const T* b, U8* out, Uword n);
+		void (*compareScalar)(SimdCmp cmp, const T* a, T b, U8* out, Uword n);
+		void (*select)(const U8* mask, const T* a, const T* b, T* out, Uword n);
+		Uword (*argMin)(const T* a, Uword n);
+		Uword (*argMax)(const T* a, Uword n);
+		void (*gather)(const T* src, const Uword* indices, T* out, Uword n);
+		void (*scatter)(const T* src, const Uword* indices, T* out, Uword n);
+		const char* isa;
+	};
+
+	// Array front end to the kernels. Lengths are checked and BAD_ARGUMENT is thrown when they
+	// do not match; gather and scatter indices are only checked in debug builds.
+	template <typename T>
+	class Simd {
 	private:
+		static SimdKernels<T> pickKernels();
 	public:
-		ExchangeHeap();
-		~ExchangeHeap();
+		typedef typename SimdWide<T>::Type Wide;
+		static const SimdKernels<T>& getKernels(); // Picked on the first call
+		static void map(SimdOp op, const Array<T>* a, const Array<T>* b, Array<T>* out);
+		static void map(SimdOp op, const Array<T>* a, T b, Array<T>* out);
+		static Wide reduce(SimdOp op, const Array<T>* a); // Any op but SIMD_SUB
+		static Wide dot(const Array<T>* a, const Array<T>* b);
+		static void prefixSum(const Array<T>* a, Array<T>* out); // Inclusive
+		static void compare(SimdCmp cmp, const Array<T>* a, const Array<T>* b, Array<U8>* out); // 1 where true
+		static void compare(SimdCmp cmp, const Array<T>* a, T b, Array<U8>* out);
+		static void select(const Array<U8>* mask, const Array<T>* a, const Array<T>* b, Array<T>* out); // a where mask is set, else b
+		static T min(const Array<T>* a);
+		static T max(const Array<T>* a);
+		static Uword argMin(const Array<T>* a); // First index of the smallest element
+		static Uword argMax(const Array<T>* a);
+		static void gather(const Array<T>* src, const Array<Uword>* indices, Array<T>* out); // out[i] = src[indices[i]]
+		static void scatter(const Array<T>* src, const Array<Uword>* indices, Array<T>* out); // out[indices[i]] = src[i]
+	};
+
+	// DEC Niche. A bit pattern that is never a valid value of a type. Option stores NOTHING
+	// in it instead of carrying a separate variant.
+	namespace t {
+
 		template <typename T>
-		Owned<T> alloc(Context* ctx);
+		struct niche {
+			static const bool value = false;
+		};
+
 		template <typename T>
-		Owned< Array<T> > allocArray(Context* ctx, Uword length);
-		void free(void* object);
-	};
+		struct niche<T*> {
+			static const bool value = true;
+			static bool isNiche(T* const& v) { return v == nullptr; }
+			static void setNiche(T*& v) { v = nullptr; }
+		};
+
+		// Pointer wrappers are null when they point at nothing, protocol objects when self is null
+		template <typename P, bool pobject>
+		struct pointer_niche {
+			static const bool value = true;
+			static bool isNiche(const P& p) { return p.obj == nullptr; }
+			static void setNiche(P& p) { p.obj = nullptr; }
+		};
+
+		template <typename P>
+		struct pointer_niche<P, true> {
+			static const bool value = true;
+			static bool isNiche(const P& p) { return p.obj.self == nullptr; }
+			static void setNiche(P& p) { p.obj.self = nullptr; }
+		};
+
+		template <typename T>
+		struct niche< Owned<T> > : pointer_niche< Owned<T>, is_protocol<T>::value > { };
+
+		template <typename T>
+		struct niche< Borrowed<T> > : pointer_niche< Borrowed<T>, is_protocol<T>::value > { };
+
+		template <typename T>
+		struct niche< Managed<T> > : pointer_niche< Managed<T>, is_protocol<T>::value > { };
+
+		template <typename T>
+		struct niche< Constant<T> > : pointer_niche< Constant<T>, is_protocol<T>::value > { };
+
+		template <typename T>
+		struct protocol_niche {
+			static const bool value = true;
+			static bool isNiche(const T& p) { return p.self == nullptr; }
+			static void setNiche(T& p) { p.self = nullptr; }
+		};
+
+		template <typename T>
+		struct niche< Object<T> > : protocol_niche< Object<T> > { };
+
+		// The empty key of a hashtable slot
+		template <typename T>
+		struct niche< HashtableKey<T> > : protocol_niche< HashtableKey<T> > { };
+
+	} // namespace t
 
 	// DEC Option
-	template <typename T>
+	// getValue on NOTHING throws in debug builds only. Release builds skip the check, so
+	// test hasValue first unless the value is known to be there.
+	template <typename T, bool niche = t::niche<T>::value>
 	struct Option {
 		enum Variant {
 			NOTHING = 0,
@@ -365,53 +1715,454 @@ namespace octarine {
 			Nothing nothing;
 			T value;
 		};
+		Option(): variant(NOTHING), nothing() { }
+		Option(T val): variant(SOMETHING), value(val) { }
 		bool hasValue();
 		T getValue();
 	};
 
-	// DEC Hashtable
-	template <typename TKey, typename TVal>
-	struct HashtableEntry {
-		Option<TKey> key;
-		TVal val;
+	template <typename T>
+	struct Option<T, true> {
+		T value; // Holds the niche when NOTHING
+		Option() { t::niche<T>::setNiche(value); }
+		Option(T val): value(val) { }
+		bool hasValue();
+		T getValue();
 	};
 
-	template <typename TKey, typename TVal>
-	struct Hashtable {
-		Owned< Array< HashtableEntry<HashtableKey<TKey>, TVal> > > entries;
-        void ctor(Context* ctx);
-		void dtor(Context* ctx);
-		void put(TKey key, TVal val);
-		Option<TVal> get(TKey key); // TODO: borrow a value instead of removing it
+	// DEC ExchangeHeap
+	// Arrays are compact by default, their data only as aligned as the element type needs.
+	// ALLOC_ALIGNED puts the data on a cache line and pads it to whole lines, so SIMD loads
+	// never split a line and no other object shares the array's lines. A reallocation keeps
+	// the alignment the array was created with.
+	enum AllocFlags {
+		ALLOC_DEFAULT = 0,
+		ALLOC_HUGE_PAGES = 1, // Back arrays of at least HUGE_PAGE_SIZE bytes with huge pages where possible
+		ALLOC_ALIGNED = 2 // Data aligned to ARRAY_ALIGNMENT and padded to it
 	};
 
-	// DEC String. UTF-8 encoded character sequence.
-	struct String {
-		Uword numCodepoints;
+	// Allocation counters, only kept when built with OCT_HEAP_STATS. Reserved bytes include the
+	// header, alignment padding and page rounding; the gap to the requested bytes per size class
+	// is the fragmentation the allocator adds. Allocations without a Type count as untyped.
+	const Uword HEAP_SIZE_CLASSES = 24; // Powers of two from 16 bytes, the last one takes the rest
+	const Uword HEAP_TYPE_SLOTS = 256;
+	const Uword HEAP_SAMPLES = 256;
+	const Uword HEAP_SAMPLE_FRAMES = 16;
+	const Uword HEAP_DEFAULT_SAMPLE_INTERVAL = 512 * 1024;
+
+	struct HeapClassStats {
+		volatile Uword liveObjects;
+		volatile Uword requestedBytes;
+		volatile Uword reservedBytes;
+	};
+
+	struct HeapTypeStats {
+		Type* volatile type;
+		volatile Uword liveObjects;
+		volatile Uword liveBytes;
+	};
+
+	// One allocation every sampleInterval bytes of a Context, with the stack that made it
+	struct HeapSample {
+		Uword size;
+		Type* type;
+		Uword numFrames;
+		void* frames[HEAP_SAMPLE_FRAMES];
+	};
+
+	struct HeapStats {
+		volatile Uword liveObjects;
+		volatile Uword liveBytes;
+		volatile Uword peakLiveBytes;
+		volatile Uword totalObjects;
+		volatile Uword totalBytes;
+		volatile Uword sampleInterval; // Zero turns sampling off
+		volatile Uword numSamples; // Ever taken, the last HEAP_SAMPLES are kept
+		HeapClassStats classes[HEAP_SIZE_CLASSES];
+		HeapTypeStats untyped; // Also takes the types that did not fit into types
+		HeapTypeStats types[HEAP_TYPE_SLOTS];
+		HeapSample samples[HEAP_SAMPLES];
+	};
+
+	// Kept by each Context for its own allocations, so no atomics
+	struct ContextHeapStats {
+		Uword allocatedObjects;
+		Uword allocatedBytes;
+		U64 since; // nanoTimestamp when the context was created
+		Uword nextSample; // allocatedBytes that triggers the next sample
+	};
+
+	class ExchangeHeap {
+	private:
+		static const Uword PAGES_TAG = 1; // Set in OwnedBoxHeader::allocBase for page allocations
+		static const Uword ALIGNED_TAG = 2; // Set in OwnedBoxHeader::allocBase for ALLOC_ALIGNED arrays
+		static const Uword MALLOC_ALIGNMENT = 2 * sizeof(Uword); // Guaranteed by SYS.tryAlloc
+	#ifdef OCT_HEAP_STATS
+		HeapStats _stats;
+		HeapTypeStats* getTypeStats(Type* type);
+		void recordAlloc(Context* ctx, OwnedBoxHeader* header, Uword requested, Type* type);
+		void recordFree(OwnedBoxHeader* header);
+	#endif
+		void* tryAllocAligned(Uword dataOffset, Uword dataSize, Uword elementAlignment, Uword flags);
+		void* tryReallocAligned(void* box, Uword dataOffset, Uword keepSize, Uword dataSize, Uword elementAlignment, Uword flags);
+		void freeBox(void* box);
+	public:
+		static const Uword MAPPED_TAG = 4; // Set in OwnedBoxHeader::allocBase by MappedFile, freeing the box releases the mapping
+		ExchangeHeap();
+		~ExchangeHeap();
+		template <typename T>
+		Owned<T> alloc(Context* ctx);
+		template <typename T>
+		Owned< Array<T> > allocArray(Context* ctx, Uword length, Uword flags = ALLOC_DEFAULT);
+		// Same as above but return NOTHING instead of throwing when out of memory
+		template <typename T>
+		Option< Owned<T> > tryAlloc(Context* ctx);
+		template <typename T>
+		Option< Owned< Array<T> > > tryAllocArray(Context* ctx, Uword length, Uword flags = ALLOC_DEFAULT);
+		// Resizes arr, keeping the elements that fit. Trivially relocatable elements are moved
+		// with realloc, which grows in place when it can. The try variant leaves arr untouched
+		// when out of memory.
+		template <typename T>
+		Owned< Array<T> > reallocArray(Context* ctx, Owned< Array<T> > arr, Uword length, Uword flags = ALLOC_DEFAULT);
+		template <typename T>
+		Option< Owned< Array<T> > > tryReallocArray(Context* ctx, Owned< Array<T> > arr, Uword length, Uword flags = ALLOC_DEFAULT);
+		// Arrays of elements only known at runtime, elementType->size bytes each and aligned to
+		// elementType->alignment. The elements are always moved with realloc.
+		Owned< Array<Unknown> > allocArray(Context* ctx, Type* elementType, Uword length, Uword flags = ALLOC_DEFAULT);
+		Owned< Array<Unknown> > reallocArray(Context* ctx, Owned< Array<Unknown> > arr, Uword length, Uword flags = ALLOC_DEFAULT);
+		void free(void* object);
+		HeapStats* getStats(); // nullptr without OCT_HEAP_STATS
+		void setSampleInterval(Uword bytes);
+		void printStats(FILE* out); // Readable report, also for the REPL's :heap command
+	};
+
+	// DEC Hashtable. Open addressing with linear probing over a power of two number of slots,
+	// which double once more than HASHTABLE_MAX_LOAD_PERCENT of them are taken. Keys hash and
+	// compare through their HashtableKey protocol, see HashtableKeyTraits. put copies a new key
+	// into storage the table owns and dtor frees it; a table copied with ctor(ctx, other) shares
+	// the keys with other, only one of them may be destroyed with dtor.
+	const Uword HASHTABLE_MIN_CAPACITY = 16;
+	const Uword HASHTABLE_MAX_LOAD_PERCENT = 75;
+
+	template <typename TKey, typename TVal>
+	struct HashtableEntry {
+		Option<TKey> key;
+		TVal val;
+	};
+
+	template <typename TKey, typename TVal>
+	struct Hashtable {
+		typedef HashtableEntry< HashtableKey<TKey>, TVal > Entry;
+		Owned< Array<Entry> > entries; // entries->size is the number of slots
+		Uword count;
+		static Entry* find(Context* ctx, Array<Entry>* slots, TKey& key); // The key's slot, or the empty one it would go to
+		void grow(Context* ctx);
+		void ctor(Context* ctx, Uword capacity = HASHTABLE_MIN_CAPACITY); // Rounded up to a power of two
+		void ctor(Context* ctx, Hashtable<TKey, TVal>* other); // Shallow copy of other's entries
+		void dtor(Context* ctx);
+		void put(Context* ctx, TKey key, TVal val); // Replaces the value of a present key
+		Option<TVal> get(Context* ctx, TKey key); // TODO: borrow a value instead of removing it
+	};
+
+	// DEC String. UTF-8 encoded character sequence.
+	struct String {
+		Uword numCodepoints;
 		Owned< Array<U8> > data;
 		static String createFromCString(Context* ctx, const char* str);
 	};
 
+	// DEC Vector. Growable array on the exchange heap. The capacity doubles when it runs out, so
+	// appending is amortized constant time. Only the first size slots hold constructed elements.
+	// Storage of HUGE_PAGE_SIZE and up comes from pages, which the OS can grow in place.
+	template <typename T>
+	struct Vector {
+		Owned< Array<T> > items; // items->size is the capacity, null until the first element
+		Uword size;
+		void setCapacity(Context* ctx, Uword capacity); // Moves the elements to new storage
+		void ctor(Context* ctx, Uword capacity = 0);
+		void dtor(Context* ctx);
+		Uword getCapacity();
+		T* at(Uword index);
+		void append(Context* ctx, T val);
+		void append(Context* ctx, const Array<T>* vals);
+		void append(Context* ctx, const T* vals, Uword count); // A view into any contiguous run
+		void reserve(Context* ctx, Uword capacity); // Never shrinks
+		void shrink(Context* ctx); // Gives back the capacity beyond size
+		void clear();
+	};
+
+	// DEC Table. Records of one Type stored column by column, one aligned array per field, so a
+	// scan only pulls the fields it reads through the cache and runs the SIMD kernels over them.
+	// Rows are selected by index; filter produces the indices, project and aggregate consume them.
+	// Out of range fields and rows, and columns read as another type, throw BAD_ARGUMENT.
+	struct Table {
+		Type* recordType;
+		Uword numRows;
+		Uword capacity;
+		Owned< Array< Owned< Array<Unknown> > > > columns; // Column size is numRows
+		void ctor(Context* ctx, Type* recordType, Uword capacity = 0);
+		void dtor(Context* ctx);
+		Array<Unknown>* getColumn(Uword field);
+		template <typename T>
+		Array<T>* getColumn(Uword field); // The field's type must be T's builtin type
+		void reserve(Context* ctx, Uword capacity);
+		void appendRows(Context* ctx, const void* records, Uword count); // Records laid out as recordType
+		void getRows(const Uword* rows, Uword count, void* records); // Writes the rows back in record layout
+		// Appends the indices of the rows whose field compares true against value
+		template <typename T>
+		void filter(Context* ctx, Uword field, SimdCmp cmp, T value, Vector<Uword>* rows);
+		// Reduces a field over all rows, or over the given ones. SIMD_SUB is not allowed.
+		template <typename T>
+		typename SimdWide<T>::Type aggregate(Uword field, SimdOp op);
+		template <typename T>
+		typename SimdWide<T>::Type aggregate(Uword field, SimdOp op, const Uword* rows, Uword count);
+		Owned< Array<Unknown> > project(Context* ctx, Uword field, const Uword* rows, Uword count); // Copy of a field for some rows
+	};
+
+	// DEC Arena. Bump allocator over large chunks, freed all at once. For short lived bulk data
+	// such as the reader's literals, where freeing object by object would only cost time.
+	class Arena {
+	private:
+		struct Chunk {
+			Chunk* next;
+		};
+		Chunk* _chunks;
+		U8* _top;
+		U8* _end;
+		Uword _chunkSize;
+
+		Arena(const Arena& other);
+		Arena& operator=(const Arena& other);
+	public:
+		Arena(Uword chunkSize = 64 * 1024);
+		~Arena();
+		void* alloc(Uword size); // Word aligned
+		void reset(); // Frees everything
+	};
+
+	// DEC Symbol. An interned name. Equal names are the same Symbol, so compare the pointers.
+	struct Symbol {
+		Uword hash;
+		Uword length;
+		U8 name[]; // NUL terminated
+	};
+
+	// Open addressing with linear probing, symbols live in an arena for the table's lifetime.
+	// Readers on several contexts share the runtime's table, interning takes a lock.
+	class SymbolTable {
+	private:
+		System::Mutex _lock;
+		Arena _arena;
+		Symbol** _slots;
+		Uword _mask;
+		Uword _count;
+
+		SymbolTable(const SymbolTable& other);
+		SymbolTable& operator=(const SymbolTable& other);
+		void grow();
+	public:
+		SymbolTable();
+		~SymbolTable();
+		Symbol* intern(const U8* name, Uword length);
+		Symbol* intern(const char* name);
+		Uword getCount();
+		void collect(std::vector<Symbol*>* out);
+		static Uword hash(const U8* bytes, Uword length);
+	};
+
+	// DEC Tracer. Each Context writes fixed size events into its own ring buffer, a single
+	// reader thread drains the rings every TRACE_FLUSH_MILLIS into a Chrome trace file (JSON
+	// array format, Perfetto reads it too). Events are stamped with SYS.cycleTimestamp and
+	// converted to microseconds when flushed. A full ring drops events and counts them.
+	// Without OCT_TRACE the trace points compile to nothing; with it a disabled tracer costs a
+	// load and a branch per trace point.
+	#ifdef OCT_TRACE
+	#define OCT_TRACE_EVENT(ctx, kind, phase, arg0, arg1) do { \
+		Context* traceCtx = (ctx); \
+		if(traceCtx) { traceCtx->trace((kind), (phase), (Uword)(arg0), (Uword)(arg1)); } \
+	} while(0)
+	#else
+	#define OCT_TRACE_EVENT(ctx, kind, phase, arg0, arg1) ((void)0)
+	#endif
+
+	enum TraceKind {
+		TRACE_JIT_COMPILE = 0, // arg0 is the NamespaceCell, or the number of cells for a batch
+		TRACE_JIT_OPTIMIZE,
+		TRACE_JIT_EMIT_OBJECT,
+		TRACE_ALLOC_LARGE, // arg0 is the size in bytes, arg1 the AllocFlags
+		TRACE_SCHEDULER_STEAL, // arg0 is the victim worker's index
+		TRACE_SCHEDULER_PARK,
+		TRACE_SCHEDULER_TASK_FAILED, // arg0 is the worker's index
+		TRACE_CHANNEL_BLOCKED, // arg0 is the channel, arg1 is 0 for send and 1 for receive
+		TRACE_KIND_COUNT
+	};
+
+	enum TracePhase {
+		TRACE_BEGIN = 0,
+		TRACE_END,
+		TRACE_INSTANT
+	};
+
+	struct TraceEvent {
+		U64 cycles;
+		U32 kind;
+		U32 phase;
+		Uword arg0;
+		Uword arg1;
+	};
+
+	const Uword TRACE_BUFFER_EVENTS = 16384; // Power of two
+	const Uword TRACE_FLUSH_MILLIS = 100;
+
+	// Single producer, the owning Context, and single consumer, the flush thread. Buffers live
+	// as long as the Tracer, so the flush thread never sees one go away under it. A destroyed
+	// Context releases its buffer to the next Context that starts tracing; the ring's id, the
+	// tid in the trace, is shared by its successive owners like a reused thread id.
+	struct TraceBuffer {
+		volatile Uword head; // Written by the producer only
+		volatile Uword tail; // Written by the consumer only
+		volatile Uword released; // No Context writes to it
+		Uword cachedTail; // Producer's copy of tail, refreshed when the ring looks full
+		volatile Uword dropped;
+		Uword reportedDropped; // Consumer side from here on
+		Bool named; // thread_name record written
+		Uword id; // Becomes the tid in the trace
+		TraceBuffer* next;
+		TraceEvent events[TRACE_BUFFER_EVENTS];
+	};
+
+	class Tracer {
+	private:
+		TraceBuffer* volatile _buffers;
+		volatile Uword _numBuffers;
+		volatile Uword _enabled;
+		volatile Uword _stop;
+		FILE* _out;
+		bool _firstEvent;
+		System::Thread _flushThread;
+		// Maps cycleTimestamp to nanoTimestamp, the rate is measured again at every flush
+		U64 _startCycles;
+		U64 _startNanos;
+
+		Tracer(const Tracer& other);
+		Tracer& operator=(const Tracer& other);
+		static void flushMain(void* arg);
+		void flush();
+		void writeSeparator();
+	public:
+		Tracer();
+		~Tracer();
+		void start(const char* path); // Throws Exception::IO if path cannot be opened
+		void stop(); // Flushes what is left and closes the file
+		bool isEnabled() const;
+		TraceBuffer* registerBuffer(); // Reuses a released buffer when there is one
+		void releaseBuffer(TraceBuffer* buf);
+	};
+
+	// DEC PerfListener. Makes JITed functions visible to Linux perf. Each function gets a line
+	// in /tmp/perf-<pid>.map, enough for symbols in perf report and flame graphs, and a record
+	// with its code bytes and line table in /tmp/jit-<pid>.dump; `perf record -k mono` followed
+	// by `perf inject --jit` turns those into ELF images, so perf annotate shows source lines.
+	// Line tables come from the DebugLocs the compilers attach to the instructions. The files
+	// are shared by every Runtime of the process. Freed code keeps its map line for the samples
+	// taken while it ran, until new code reuses the range: the map has no timestamps, so it is
+	// rewritten without the stale lines. The jitdump needs no rewrite, each load is timestamped.
+	#ifdef __linux__
+	class PerfListener : public llvm::JITEventListener {
+	private:
+		PerfListener(const PerfListener& other);
+		PerfListener& operator=(const PerfListener& other);
+		void writeDebugInfo(const llvm::Function& fn, void* code, const EmittedFunctionDetails& details, U64 timestamp);
+	public:
+		PerfListener();
+		~PerfListener();
+		virtual void NotifyFunctionEmitted(const llvm::Function& fn, void* code, size_t size, const EmittedFunctionDetails& details);
+		virtual void NotifyFreeingMachineCode(void* code);
+	};
+	#endif
+
 	// DEC Runtime
+	enum RuntimeFlags {
+		RUNTIME_DEFAULT = 0,
+		RUNTIME_NO_JIT = 1, // For processes that only run code loaded with loadNative
+		RUNTIME_PERF_MAP = 2, // Write perf map and jitdump files for JITed code, Linux only
+		RUNTIME_GDB_JIT = 4 // Register debug info of JITed code with GDB, ELF hosts only
+	};
+
+	// Unboxed argument or result slot. Exported definitions get a frame entry, named
+	// FRAME_ENTRY_PREFIX followed by the definition name, that reads its arguments from a
+	// caller owned array of slots; hosts call it through the C API without boxing.
+	union FrameValue {
+		I64 i;
+		F64 f;
+		void* p;
+	};
+	typedef void (*FrameEntry)(Context* ctx, const FrameValue* args, FrameValue* result);
+	const char* const FRAME_ENTRY_PREFIX = "oct_entry_";
+
+	// Entry point of a library built from emitObjectFile output. It binds the namespace's
+	// definitions to objects, types and vtables that live in the library's static data.
+	typedef void (*NativeInit)(Context* ctx, Namespace* ns);
+	const char* const NATIVE_INIT_SYMBOL = "oct_native_init";
+
 	class Runtime {
 	private:
 		llvm::LLVMContext _llvmContext;
 		llvm::Module* _jitModule;
-		llvm::ExecutionEngine* _ee;
+		llvm::ExecutionEngine* _ee; // nullptr with RUNTIME_NO_JIT
+		llvm::JITEventListener* _perf; // nullptr without RUNTIME_PERF_MAP
+		System::Mutex _engineLock; // Held for every change to _ee, the JIT is not thread safe
+		System::Mutex _compileLock; // Dependency edges and modules of all namespaces
+		Uword _markGeneration; // Guarded by _compileLock, see Namespace::collectStale
 		ExchangeHeap _exchangeHeap;
 		System::ThreadLocal<Context> _currentContext;
+		Uword _id; // Never reused, tags the per thread current context cache
+		volatile Uword _epoch;
 		Hashtable< String, Owned<Namespace> > _namespaces;
+		System::Mutex _contextsLock; // createContext may run on any thread while tryAdvanceEpoch scans
 		std::vector<Context*> _contexts;
+		SymbolTable _symbols;
+		struct NativeLibrary {
+			Namespace* ns; // Whose definitions the library bound, only its frame entries are looked up there
+			void* handle;
+		};
+		std::vector<NativeLibrary> _libraries; // Guarded by _compileLock, unloaded after the namespaces that point into them
+		std::vector<Image*> _images; // Unmapped last, like the libraries
+		Tracer _tracer;
 
 		Runtime(const Runtime& other);
 		Runtime(Runtime&& other);
 		Runtime& operator=(const Runtime& other);
 		Runtime& operator=(Runtime&& other);
+		llvm::ExecutionEngine* getEngine();
 	public:
-		Runtime();
+		explicit Runtime(Uword flags = RUNTIME_DEFAULT);
 		~Runtime();
 		ExchangeHeap& getExchangeHeap();
+		SymbolTable& getSymbols();
 		Context* getCurrentContext();
+		void setCurrentContext(Context* ctx);
+		Context* createContext(Namespace* ns);
+		void destroyContext(Context* ctx); // ctx must be idle, its thread is done with it
+		Uword getEpoch();
+		bool tryAdvanceEpoch();
+		llvm::Module* createModule(const char* name); // Empty module in the runtime's LLVM context
+		void installModule(Context* ctx, NamespaceCell* cell, llvm::Module* module); // cell is nullptr for shared modules
+		void releaseModule(llvm::Module* module); // Frees the machine code and deletes the module
+		void optimizeModule(llvm::Module* module); // Whole module -O3, for code that is loaded once
+		void retireModule(Context* ctx, llvm::Module* module);
+		void* getPointerToFunction(llvm::Function* fn); // Compiles fn on first use
+		System::Mutex& getCompileLock();
+		Uword nextMarkGeneration(); // Call with the compile lock held
+		void emitObjectFile(llvm::Module* module, const char* path); // Position independent, for a shared library
+		llvm::Constant* emitType(llvm::Module* module, Type* type); // Type descriptor as constant data of module, type must be named
+		llvm::Constant* emitVTable(llvm::Module* module, const char* protocol, Type* type, llvm::Function** fns, Uword numFns);
+		void loadNative(Context* ctx, Namespace* ns, const char* path);
+		void* mapImage(const char* path); // Root object of the image, mapped for the lifetime of the runtime
+		Uword writeImage(Context* ctx, const char* path); // Namespaces and symbols, returns how many values it left out
+		Uword restoreImage(Context* ctx, const char* path); // Binds the names of a writeImage snapshot, returns how many got values
+		FrameEntry findFrameEntry(Namespace* ns, NamespaceCell* cell, const char* name); // nullptr if not compiled
+		Tracer& getTracer();
 	};
 
 	// DEC Context
@@ -419,17 +2170,311 @@ namespace octarine {
 	private:
 		Runtime* _rt;
 		Namespace* _ns;
+		Scheduler* _scheduler;
+		// Epoch based reclamation, see Runtime::tryAdvanceEpoch
+		struct Retired {
+			void* obj;
+			void (*free)(Context* ctx, void* obj);
+			Uword epoch;
+			Retired* next;
+		};
+		volatile Uword _epochState; // (epoch << 1) | 1 while inside a read section, 0 outside
+		Uword _epochDepth; // Nested read sections, only the outermost one sets _epochState
+		Retired* _retired;
+		ContextHeapStats _heapStats;
+		TraceBuffer* _trace; // Registered with the tracer on the first event
+		void reclaim(bool all);
 	public:
 		Context(Runtime* rt, Namespace* ns);
 		~Context();
 		Namespace* getNamespace() const;
 		void setNamespace(Namespace* ns);
         Runtime* getRuntime() const;
+		Scheduler* getScheduler() const;
+		void setScheduler(Scheduler* scheduler);
+		void yield(); // Called by operations that wait, lets other fibers run on this thread
+		void enterEpoch(); // Objects retired after this stay alive until the matching exitEpoch. Nests
+		void exitEpoch(); // Prefer ReadSection, which also exits when an exception leaves the scope
+		Uword getEpochState();
+		void retire(void* obj, void (*free)(Context* ctx, void* obj)); // Frees obj once no reader can see it
+		void drain(); // Waits until everything retired here is freed, call outside a read section
+		ContextHeapStats& getHeapStats();
+		OCT_ALWAYS_INLINE void trace(U32 kind, U32 phase, Uword arg0, Uword arg1); // Use OCT_TRACE_EVENT
+	};
+
+	// Stays in a read section of ctx for the rest of the scope, also when an exception leaves it
+	class ReadSection {
+	private:
+		Context* _ctx;
+		ReadSection(const ReadSection& other);
+		ReadSection& operator=(const ReadSection& other);
+	public:
+		explicit ReadSection(Context* ctx): _ctx(ctx) {
+			ctx->enterEpoch();
+		}
+		~ReadSection() {
+			_ctx->exitEpoch();
+		}
+	};
+
+	// DEC Scheduler. Runs tasks on a pool of worker threads, one Context per worker.
+	// Each worker owns a Chase-Lev deque; idle workers steal from random victims and
+	// park when there is nothing left to steal.
+	// A fiber task's park state. unpark moves RUNNING to NOTIFIED, which the next park
+	// consumes without suspending, and PARKED back to RUNNING by queueing the fiber again.
+	enum TaskParkState {
+		TASK_RUNNING = 0,
+		TASK_NOTIFIED,
+		TASK_PARKED
+	};
+
+	struct Task {
+		void (*fn)(Context* ctx, void* arg);
+		void* arg;
+		Task* next; // Link in the injection, yield and wake lists
+		Uword stackSize; // Nonzero for tasks that run in their own fiber
+		Fiber* fiber; // Created when a fiber task first runs
+		Worker* worker; // Where the fiber runs, set when it first runs
+		volatile Uword parkState;
+	};
+
+	class WorkDeque {
+	private:
+		struct Buffer {
+			Word capacity; // Always a power of two
+			Buffer* previous; // Retired buffers, thieves may still be reading them
+			Task* volatile tasks[1];
+		};
+		volatile Uword _top;
+		volatile Uword _bottom;
+		Buffer* volatile _buffer;
+
+		static Buffer* createBuffer(Word capacity, Buffer* previous);
+		Buffer* grow(Buffer* buffer, Word top, Word bottom);
+		WorkDeque(const WorkDeque& other);
+		WorkDeque& operator=(const WorkDeque& other);
+	public:
+		WorkDeque();
+		~WorkDeque();
+		void push(Task* task); // Owner only
+		Task* pop(); // Owner only
+		Task* steal(bool* contended); // Any thread
+		bool isEmpty();
+	};
+
+	// DEC Fiber. A user-level thread on its own stack. Fibers are switched cooperatively,
+	// so a fiber waiting on something hands its OS thread to other work.
+	class Fiber {
+	private:
+	#ifdef _WIN32
+		LPVOID _handle;
+		static VOID CALLBACK windowsEntry(LPVOID param);
+	#else
+		void* _sp;
+		void* _stack;
+		Uword _stackSize;
+	#endif
+		void (*_fn)(Context* ctx, void* arg);
+		void* _arg;
+		Context* _ctx;
+		Fiber* _return; // Where suspend goes, set by resume
+		Bool _done;
+		std::exception_ptr _error; // Escaped _fn, rethrown by resume on the resuming side
+
+		static void start(Fiber* self);
+		Fiber(const Fiber& other);
+		Fiber& operator=(const Fiber& other);
+	public:
+		static const Uword DEFAULT_STACK_SIZE = 256 * 1024;
+		Fiber(); // Adopts the calling thread's own stack so it can switch to other fibers
+		Fiber(void (*fn)(Context* ctx, void* arg), void* arg, Context* ctx, Uword stackSize = DEFAULT_STACK_SIZE);
+		~Fiber();
+		void resume(Fiber* from); // Must be called on the thread running from. Rethrows what escaped the fiber
+		void suspend(); // Must be called from inside this fiber
+		bool isDone();
+	};
+
+	// Every this many tasks a worker looks at the injected and yielded queues before its own
+	// deque, so a deque that never runs dry cannot starve them
+	const Uword SCHEDULER_FAIRNESS_INTERVAL = 61;
+
+	struct Worker {
+		Scheduler* scheduler;
+		Context* ctx;
+		Uword index;
+		Uword random;
+		Uword tick; // Tasks taken so far, see SCHEDULER_FAIRNESS_INTERVAL
+		volatile Uword parked;
+		WorkDeque deque;
+		System::Parker parker;
+		System::Thread thread;
+		Fiber* threadFiber;
+		Task* running; // Fiber task currently switched in
+		Bool parking; // Set by park, tells run not to queue the fiber that just suspended
+		Uword numParked; // Fibers of this worker waiting for unpark, shutdown waits for them
+		Task* volatile woken; // Parked fibers unparked by any thread, pushed like _injected
+		Task* readyHead; // Woken fibers taken from woken, in wake order
+		Task* readyTail;
+		Task* yieldedHead; // Started fibers that yielded, they stay on this worker
+		Task* yieldedTail;
+	};
+
+	class Scheduler {
+	private:
+		Runtime* _rt;
+		std::vector<Worker*> _workers;
+		System::ThreadLocal<Worker> _currentWorker;
+		Task* volatile _injected; // Tasks spawned from threads that are not workers
+		volatile Uword _running;
+		volatile Uword _failed;
+
+		static void workerMain(void* arg);
+		static void newTask(Task* task, void (*fn)(Context* ctx, void* arg), void* arg, Uword stackSize);
+		void enqueue(Task* task);
+		void run(Worker* w, Task* task);
+		void failed(Worker* w);
+		Task* findTask(Worker* w);
+		Task* takeInjected(Worker* w);
+		Task* takeYielded(Worker* w);
+		Task* takeWoken(Worker* w);
+		Task* steal(Worker* w);
+		bool hasWork();
+		void wakeOne();
+		Scheduler(const Scheduler& other);
+		Scheduler& operator=(const Scheduler& other);
+	public:
+		Scheduler(Runtime* rt, Uword numWorkers = 0); // 0 means one worker per processor
+		~Scheduler();
+		void spawn(void (*fn)(Context* ctx, void* arg), void* arg);
+		void spawnFiber(void (*fn)(Context* ctx, void* arg), void* arg, Uword stackSize = Fiber::DEFAULT_STACK_SIZE); // Throws UNSUPPORTED without OCT_FIBERS
+		void yield(); // Suspends the current fiber, or gives up the time slice outside of fibers
+		Task* getCurrentFiber(); // nullptr unless called from a fiber task of this scheduler
+		// Suspends the current fiber without queueing it until unpark is called for it. Returns
+		// at once if unpark came first. Wake-ups may be spurious, recheck what was waited for.
+		void park();
+		void unpark(Task* task); // Any thread
+		void shutdown(); // Runs all queued tasks, then joins the workers
+		Uword getWorkerCount();
+		Uword getFailedCount(); // Tasks that threw, what they threw is dropped with them
+	};
+
+	// DEC WaitQueue. Contexts blocked until another one wakes them. A fiber parks through its
+	// Scheduler, which runs other tasks on the worker meanwhile; any other caller parks its
+	// thread. Waiters enqueue, recheck their condition, then park, so a wakeOne between the
+	// two is not lost. Wake-ups may be spurious.
+	class WaitQueue {
+	public:
+		struct Waiter {
+			Scheduler* scheduler;
+			Task* task; // The parked fiber, nullptr when the thread parks
+			System::Parker parker;
+			Bool woken; // Guarded by the queue's mutex
+			Waiter* next;
+		};
+	private:
+		System::Mutex _mutex;
+		Waiter* _head;
+		Waiter* _tail;
+		volatile Uword _count; // Lets wakeOne skip the mutex while nobody waits
+
+		WaitQueue(const WaitQueue& other);
+		WaitQueue& operator=(const WaitQueue& other);
+	public:
+		WaitQueue();
+		void enqueue(Context* ctx, Waiter* waiter);
+		void cancel(Waiter* waiter); // The condition held after all, leave the queue
+		void park(Waiter* waiter); // Until woken
+		void wakeOne();
+	};
+
+	// DEC Channel. Bounded lock-free queue that moves Owned<T> objects between Contexts.
+	// Only the pointer is copied; the object stays where the ExchangeHeap put it.
+	// The kind picks the cheapest algorithm that is safe for the expected number of
+	// producers and consumers.
+	enum ChannelKind {
+		SPSC = 0,
+		MPSC,
+		MPMC
+	};
+
+	template <typename T, ChannelKind K>
+	class Channel {
+	private:
+		struct Slot {
+			volatile Uword sequence; // Unused by SPSC
+			Owned<T> obj;
+		};
+		// Producer and consumer positions live on separate cache lines
+		volatile Uword _tail;
+		Uword _cachedHead; // SPSC producer's last seen _head
+		U8 _pad0[64 - 2 * sizeof(Uword)];
+		volatile Uword _head;
+		Uword _cachedTail; // SPSC consumer's last seen _tail
+		U8 _pad1[64 - 2 * sizeof(Uword)];
+		Uword _mask;
+		Slot* _slots;
+		WaitQueue _senders; // Blocked on a full channel
+		WaitQueue _receivers; // Blocked on an empty channel
+
+		Channel(const Channel& other);
+		Channel& operator=(const Channel& other);
+		// The queue itself, without waking anybody
+		bool push(Owned<T> obj);
+		Option< Owned<T> > pop();
+		Uword pushBatch(Owned<T>* objs, Uword count);
+		Uword popBatch(Owned<T>* objs, Uword max);
+		static void wake(WaitQueue* queue, Uword count);
+	public:
+		Channel(Uword capacity); // Rounded up to a power of two
+		~Channel();
+		Uword getCapacity();
+		bool trySend(Owned<T> obj); // False when full, the caller keeps ownership
+		Option< Owned<T> > tryReceive();
+		Uword trySendBatch(Owned<T>* objs, Uword count); // Returns how many were sent, in order
+		Uword tryReceiveBatch(Owned<T>* objs, Uword max);
+		// The blocking variants park the calling fiber, or thread, until the other side makes
+		// room or sends. Every variant that moves objects wakes the blocked callers it unblocks.
+		void send(Context* ctx, Owned<T> obj);
+		Owned<T> receive(Context* ctx);
 	};
 
 	// DEC Type
+	struct TypeField {
+		Type* type;
+		Uword offset; // From the start of the record
+	};
+
 	struct Type {
+		Uword size;
+		Uword alignment; // Of a single object, arrays of the type honor it. Zero counts as one.
+		Uword numFields; // Zero for scalars
+		TypeField* fields;
+		const char* name; // Stable across processes, names the descriptor in compiled code
+	};
+	const Uword TYPE_MAX_DEPTH = 32; // Records nested deeper are refused where descriptors are walked
+
+	// Scalars have one Type per process. Compiled code refers to them by symbol, oct_type_<name>,
+	// instead of carrying a copy, so they are identified by pointer in every library.
+	extern "C" {
+		OCT_EXPORT extern Type oct_type_U8;
+		OCT_EXPORT extern Type oct_type_I32;
+		OCT_EXPORT extern Type oct_type_I64;
+		OCT_EXPORT extern Type oct_type_F32;
+		OCT_EXPORT extern Type oct_type_F64;
+	}
+	static Type* findBuiltinType(const char* name); // nullptr if not a builtin
+	static bool isSameType(Type* a, Type* b); // The same instance, or both named alike
+
+	// The builtin Type of T, nullptr for the runtime's own structures that have none
+	template <typename T>
+	struct BuiltinType {
+		static Type* get() { return nullptr; }
 	};
+	template <> struct BuiltinType<U8> { static Type* get() { return &oct_type_U8; } };
+	template <> struct BuiltinType<I32> { static Type* get() { return &oct_type_I32; } };
+	template <> struct BuiltinType<I64> { static Type* get() { return &oct_type_I64; } };
+	template <> struct BuiltinType<F32> { static Type* get() { return &oct_type_F32; } };
+	template <> struct BuiltinType<F64> { static Type* get() { return &oct_type_F64; } };
 
 	// DEC ProtocolObject
 	template <typename TS, typename TVT>
@@ -512,6 +2557,18 @@ namespace octarine {
 		Bool equals(Context* ctx, Borrowed< Object<T> > other);
 	};
 
+	// What a Hashtable keyed by T needs: the HashtableKey vtable it stores with each key, and
+	// how to copy a key into the table's storage and free that copy again
+	template <typename T>
+	struct HashtableKeyTraits;
+
+	template <>
+	struct HashtableKeyTraits<String> {
+		static HashtableKeyVTable<String>* getVTable();
+		static void copy(Context* ctx, String* to, String key);
+		static void free(Context* ctx, String* key); // The characters, not the String itself
+	};
+
 	// DEC ManagedBox
 	struct ManagedBoxHeader {
 		Uword gcMarked; // This is a Uword to make the header pointer aligned, do not switch to bool
@@ -526,7 +2583,12 @@ namespace octarine {
 
 	// DEC OwnedBox
 	struct OwnedBoxHeader {
-		Uword dummy; // TODO: remove this header?
+		Uword allocBase; // Start of the underlying allocation, aligned arrays sit further in
+	#ifdef OCT_HEAP_STATS
+		Uword statsRequested;
+		Uword statsReserved;
+		Type* statsType;
+	#endif
 	};
 
 	template <typename T>
@@ -537,18 +2599,20 @@ namespace octarine {
 	};
 
 	// DEC NamespaceEntry
+	// Packed into two words: the variant lives in the low bits of the self pointer, which
+	// are always zero for boxed objects, and both object variants share the vtable word.
 	struct NamespaceEntry {
 		enum Variant {
-			NOTHING,
+			NOTHING = 0,
 			OWNED_OBJECT,
 			CONSTANT_OBJECT
 		};
-		Variant variant;
-		union {
-			Nothing nothing;
-			Owned< Object<Unknown> > owned;
-			Constant< Object<Unknown> > constant;
-		};
+		static const Uword VARIANT_MASK = 3;
+		Uword taggedSelf;
+		ObjectVTable<Unknown>* vtable;
+		NamespaceEntry(): taggedSelf(NOTHING), vtable(nullptr) { }
+		NamespaceEntry(Owned< Object<Unknown> > obj);
+		NamespaceEntry(Constant< Object<Unknown> > obj);
 		bool isNothing();
 		bool isOwned();
 		bool isConstant();
@@ -558,301 +2622,5775 @@ namespace octarine {
 		void dtor(Context* ctx);
 	};
 
+	// DEC NamespaceCell. The stable home of one binding. Compiled code embeds the cell's
+	// address and reaches the current value with a single load; redefinition swaps the
+	// entry pointer, so the cell itself never moves or changes identity.
+	// Each compiled definition lives in its own JIT module. The cell also records which cells
+	// that code reads, and the reverse edges, so a redefinition recompiles only its dependents.
+	struct NamespaceCell {
+		NamespaceEntry* volatile entry; // Immutable once published, nullptr while unbound
+		volatile Uword version; // Bumped on every redefinition, code specialized on the old entry checks it
+		llvm::Module* module; // Machine code of the definition, nullptr until compiled
+		Vector<NamespaceCell*> dependencies; // Cells the definition's code reads
+		Vector<NamespaceCell*> dependents; // Cells whose code reads this one
+		Uword mark; // Scratch for Namespace::collectStale
+		volatile Uword codeVersion; // Bumped whenever the code moves to another module, frame entry caches check it
+		FrameEntry volatile frameEntry; // Published by compileBatch, nullptr means look it up in module
+	};
+
+	// Builds the module for one stale cell and records its dependencies with
+	// Namespace::setDependencies. Returning nullptr leaves the old machine code in place.
+	typedef llvm::Module* (*DefinitionCompiler)(Context* ctx, NamespaceCell* cell, void* data);
+
+	// Adds the code of one definition to a module shared by the whole namespace, for batch mode.
+	typedef void (*DefinitionEmitter)(Context* ctx, NamespaceCell* cell, llvm::Module* module, void* data);
+
+	typedef Hashtable< String, NamespaceCell* > NamespaceBindings;
+
 	// DEC Namespace
+	// Reads are wait-free: the bindings table is never changed in place. Adding a name copies
+	// the current table, changes the copy and publishes it with a CAS, retiring the old table
+	// through the writer's Context once no reader can still be looking at it. Redefining an
+	// existing name only touches its cell. Dependency edges and modules belong to the writers,
+	// which hold the runtime's compile lock, as edges may point into other namespaces.
 	struct Namespace {
 		String name;
-		Hashtable< String, Object<Unknown> > bindings;
+		Hashtable< String, NamespaceCell* >* volatile bindings;
+		volatile Uword version; // Bumped every time a name is added
+		llvm::Module* batchModule; // Code of every definition compiled by compileBatch
+		void ctor(Context* ctx);
 		void dtor(Context* ctx);
+		NamespaceCell* getCell(Context* ctx, String key); // nullptr if the name was never bound
+		NamespaceCell* intern(Context* ctx, String key); // Creates an unbound cell if needed
+		// A define or redefine may free an owned value as soon as no read section can see it, so
+		// the entry is only valid while section is held and must not be kept past it
+		NamespaceEntry lookup(Context* ctx, const ReadSection& section, String key);
+		void define(Context* ctx, String key, NamespaceEntry value);
+		void defineAll(Context* ctx, const String* keys, const NamespaceEntry* values, Uword count); // NOTHING only interns the name
+		void setDependencies(Context* ctx, NamespaceCell* cell, NamespaceCell* const* deps, Uword count);
+		void collectStale(Context* ctx, NamespaceCell* changed, Vector<NamespaceCell*>* out); // Dependencies before dependents
+		void redefine(Context* ctx, String key, NamespaceEntry value, DefinitionCompiler compile, void* data);
+		void compileBatch(Context* ctx, DefinitionEmitter emit, void* data);
+	};
+
+	// DEC Image. A relocatable snapshot of runtime objects, mapped copy-on-write at startup.
+	// Pointers inside the data section are written against baseAddress and listed in the
+	// relocation table that follows the data, so an image mapped at its preferred address
+	// needs no fixups and shares all of its pages with the file. Runtime::mapImage keeps one
+	// mapped for as long as the runtime's objects may point into it.
+	const Uword IMAGE_MAGIC = 0x4f43544d; // "OCTM"
+	const Uword IMAGE_VERSION = 1;
+	#ifdef OCT_64
+	const Uword IMAGE_DEFAULT_BASE = 0x200000000000;
+	#else
+	const Uword IMAGE_DEFAULT_BASE = 0x40000000;
+	#endif
+
+	struct ImageHeader {
+		Uword magic;
+		Uword version;
+		Uword wordSize;
+		Uword baseAddress; // Address of the mapping the pointers were written for
+		Uword dataSize;
+		Uword rootOffset;
+		Uword numRelocations;
+	};
+
+	// Root of a Runtime::writeImage snapshot. Only values whose Type shows plain data are
+	// written; code lives in native libraries (emitObjectFile, loadNative), and anything
+	// holding pointers could not be read back, so such names come back unbound.
+	const Uword IMAGE_RUNTIME_MAGIC = 0x4f435452; // "OCTR"
+
+	struct ImageBinding {
+		String* name;
+		void* object; // nullptr if the name was unbound or its value left out
+		ObjectVTable<Unknown>* vtable;
+	};
+
+	struct ImageNamespace {
+		String* name;
+		Uword numBindings;
+		ImageBinding* bindings;
+	};
+
+	struct ImageRuntime {
+		Uword magic;
+		Uword numNamespaces;
+		ImageNamespace* namespaces;
+		Uword numSymbols;
+		String** symbols;
+	};
+
+	class ImageWriter {
+	private:
+		std::vector<U8> _data;
+		std::vector<Uword> _relocations;
+		Uword _baseAddress;
+		std::map<Type*, Uword> _types; // Each descriptor is written once
+		std::map<Type*, Uword> _vtables;
+	public:
+		ImageWriter(Uword baseAddress = IMAGE_DEFAULT_BASE);
+		Uword reserve(Uword size);
+		void* at(Uword offset);
+		Uword write(const void* src, Uword size);
+		void writePointer(Uword slot, Uword target);
+		Uword writeArray(const void* elements, Uword elementSize, Uword length, Type* elementType = nullptr);
+		Uword writeString(const String& str);
+		Uword writeString(const U8* data, Uword size, Uword numCodepoints); // size includes the NUL
+		Uword writeType(Type* type);
+		Uword writeObject(Type* type, const void* obj);
+		Uword writeObjectVTable(Type* type); // Functions are left out, the reader fills them in
+		void save(const char* path, Uword rootOffset);
+		bool trySave(const char* path, Uword rootOffset);
+	};
+
+	class Image {
+	private:
+		void* _place;
+		Uword _size;
+		ImageHeader* _header;
+
+		Image();
+		bool load(const char* path);
+		bool isValid();
+		Image(const Image& other);
+		Image& operator=(const Image& other);
+	public:
+		Image(const char* path);
+		static Option<Image*> open(const char* path); // NOTHING if the file is missing or not an image
+		~Image();
+		U8* getData();
+		void* getRoot();
+		bool contains(const void* place, Uword count, Uword size); // count objects of size, all in the data
+		bool containsCString(const char* str);
+	};
+
+	// DEC MappedFile. Constant arrays and strings whose data is a read-only mapping of a file, so
+	// loading a large dataset neither copies it nor counts against the heap. The object headers
+	// sit in a private page right in front of the file's first byte. The mapping is reference
+	// counted: it starts at one, every retain needs a release, and the last release unmaps it.
+	// The array's box carries ExchangeHeap::MAPPED_TAG, so freeing it through the heap, as a
+	// String frees its data, releases a reference instead of handing the mapping to free.
+	class MappedFile {
+	private:
+		struct Header {
+			volatile Uword refs;
+			Uword lead;
+			Uword size;
+			String string;
+		};
+		static Header* getHeader(const Array<U8>* arr);
+	public:
+		static Option< Constant< Array<U8> > > tryMapArray(Context* ctx, const char* path, AccessAdvice advice = ACCESS_NORMAL);
+		static Constant< Array<U8> > mapArray(Context* ctx, const char* path, AccessAdvice advice = ACCESS_NORMAL);
+		// The bytes of the file, not NUL terminated. numCodepoints is the byte count like in
+		// createFromCString, counting them would read in the whole file.
+		static Constant<String> mapString(Context* ctx, const char* path, AccessAdvice advice = ACCESS_NORMAL);
+		static void advise(const Array<U8>* arr, AccessAdvice advice);
+		static void retain(const Array<U8>* arr);
+		static void release(const Array<U8>* arr);
+		static void retain(const String* str);
+		static void release(const String* str);
+	};
+
+	// DEC Reader. Turns source text into a flat syntax tree. Nodes are stored in pre-order in one
+	// array: a collection is followed by its elements and its span skips the whole subtree, so
+	// walking a form reads memory front to back. Symbols are interned as they are read and string
+	// literals go to an arena. Input is either fed in pieces (a terminal or a pipe) or given whole
+	// and read in place (a mapped file).
+	enum SyntaxKind {
+		SYNTAX_LIST = 0,
+		SYNTAX_VECTOR,
+		SYNTAX_MAP,
+		SYNTAX_QUOTE, // 'x, one element
+		SYNTAX_SYMBOL,
+		SYNTAX_KEYWORD, // :x, the symbol is the name without the colon
+		SYNTAX_INTEGER,
+		SYNTAX_REAL,
+		SYNTAX_STRING
+	};
+
+	struct SyntaxString {
+		Uword length;
+		U8 data[]; // Escapes resolved, NUL terminated
+	};
+
+	struct SyntaxNode {
+		U32 kind;
+		U32 span; // Nodes in this subtree, this one included. The next sibling is span nodes on.
+		U32 count; // Elements of a collection
+		Uword position; // Byte offset of the node in the input
+		union {
+			I64 integer;
+			F64 real;
+			Symbol* symbol;
+			SyntaxString* string;
+		};
+	};
+
+	class Reader {
+	public:
+		enum Result {
+			FORM = 0,
+			MORE, // The input ends inside a form, feed more or finish
+			END,
+			ERROR
+		};
+	private:
+		Context* _ctx;
+		SymbolTable* _symbols;
+		Arena _arena;
+		Vector<SyntaxNode> _nodes;
+		Vector<Uword> _open; // Collections and quotes still waiting for elements
+		Vector<U8> _buffer; // Fed input that has not been read yet
+		const U8* _input; // _buffer or the input given to setInput
+		Uword _length;
+		Uword _cursor;
+		Uword _consumed; // Bytes dropped from the front of _buffer, keeps positions absolute
+		// A form cut off by the end of fed input stays parsed, read resumes at the token that was
+		// cut off and scans it on from _scanned bytes past its start
+		bool _inForm;
+		Uword _formMark; // Root node of the unfinished form
+		Uword _formStart; // Its position in the input
+		Uword _scanned;
+		bool _escaped; // The unfinished string has escapes in the part scanned so far
+		bool _finished;
+		const char* _error;
+		Uword _errorPosition;
+
+		Reader(const Reader& other);
+		Reader& operator=(const Reader& other);
+		Uword pushNode(SyntaxKind kind, Uword position);
+		Result fail(const char* message, Uword position, Uword mark);
+		Result more(Uword scanned);
+		Result readString(Uword mark);
+		Result readAtom(Uword mark);
+		Uword printNode(FILE* out, Uword index);
+	public:
+		Reader(Context* ctx);
+		~Reader();
+		void feed(const U8* bytes, Uword length); // Copied, read may be called after every piece
+		void setInput(const U8* bytes, Uword length); // All of the input, read in place
+		void finish(); // Nothing comes after what was fed
+		Result read(Uword* form); // Reads one top-level form, form is the index of its root node
+		SyntaxNode* getNode(Uword index);
+		void clear(); // Drops the forms read so far, their node indices become invalid. Not while MORE left a form unfinished.
+		bool isInForm(); // The last read returned MORE inside a form
+		const char* getError();
+		Uword getErrorPosition();
+		void print(FILE* out, Uword form);
 	};
 
-    // DEC Exception
-    class Exception {
-		// TODO: everything :)
+    // DEC Exception. Carries a kind, a static message and, once turned on with
+	// setCaptureBacktraces, the raw return addresses at the throw site. Nothing is allocated
+	// when throwing, so running out of memory can be reported too; OUT_OF_MEMORY never walks
+	// the stack. The message String and the symbolized backtrace are only produced when asked for.
+	// Hot paths that cannot afford unwinding use the try* variants returning Option instead.
+	class Exception : public std::exception {
+	public:
+		enum Kind {
+			GENERIC = 0,
+			OUT_OF_MEMORY,
+			NO_VALUE,
+			IO,
+			BAD_IMAGE,
+			JIT,
+			BAD_ARGUMENT,
+			UNSUPPORTED = 17 // Not compiled in, OCT_UNSUPPORTED in the C API
+		};
+		static const Uword MAX_FRAMES = 32;
+	private:
+		static volatile Uword _captureBacktraces;
+		Kind _kind;
+		const char* _message;
+		void* _frames[MAX_FRAMES];
+		Uword _numFrames; // Zero unless backtraces were on at the throw
+	public:
+		Exception(Kind kind = GENERIC, const char* message = "unknown error");
+		static void setCaptureBacktraces(bool capture); // Process wide, off by default
+		Kind getKind() const;
+		const char* what() const throw();
+		String getMessage(Context* ctx) const;
+		void printBacktrace() const;
 	};
     
 	// DEC End
 
 	// ## 09 ## Definitions
 
-	// DEF Object protocol. Must be satisfied by all octarine types.
-    template <typename T>
-	void Object<T>::dtor(Context* ctx) {
-		this->vtable->fns.dtor(ctx, this->self);
+	// DEF Type
+	Type oct_type_U8 = { sizeof(U8), alignof(U8), 0, nullptr, "U8" };
+	Type oct_type_I32 = { sizeof(I32), alignof(I32), 0, nullptr, "I32" };
+	Type oct_type_I64 = { sizeof(I64), alignof(I64), 0, nullptr, "I64" };
+	Type oct_type_F32 = { sizeof(F32), alignof(F32), 0, nullptr, "F32" };
+	Type oct_type_F64 = { sizeof(F64), alignof(F64), 0, nullptr, "F64" };
+
+	static Type* const builtinTypes[] = { &oct_type_U8, &oct_type_I32, &oct_type_I64, &oct_type_F32, &oct_type_F64 };
+
+	static Type* findBuiltinType(const char* name) {
+		for(Uword i = 0; i < sizeof(builtinTypes) / sizeof(builtinTypes[0]); ++i) {
+			if(strcmp(builtinTypes[i]->name, name) == 0) {
+				return builtinTypes[i];
+			}
+		}
+		return nullptr;
+	}
+
+	static bool isSameType(Type* a, Type* b) {
+		return a == b || (a->name && b->name && strcmp(a->name, b->name) == 0);
+	}
+
+	// JITed code finds the builtins here, native libraries through the dynamic linker
+	static void addBuiltinTypeSymbols() {
+		for(Uword i = 0; i < sizeof(builtinTypes) / sizeof(builtinTypes[0]); ++i) {
+			llvm::sys::DynamicLibrary::AddSymbol(std::string("oct_type_") + builtinTypes[i]->name, builtinTypes[i]);
+		}
+	}
+
+	// DEF Object protocol. Must be satisfied by all octarine types.
+    template <typename T>
+	void Object<T>::dtor(Context* ctx) {
+		Borrowed<T> self;
+		self.obj = this->self;
+		this->vtable->fns.dtor(ctx, self);
+	}
+	
+	template <typename T>
+	void Object<T>::gc_mark(Context *ctx) {
+		Borrowed<T> self;
+		self.obj = this->self;
+		this->vtable->fns.gc_mark(ctx, self);
+	}
+
+	// DEF EqComparable protocol.
+	template <typename T>
+	Bool EqComparable<T>::equals(Context* ctx, Borrowed<Object<T> > other) {
+		return this->vtable->fns.equals(ctx, this->self, other);
+	};
+
+	// DEF OwnedBox
+	template <typename T>
+	OwnedBox<T>* OwnedBox<T>::getBox(T* object) {
+		return (OwnedBox<T>*)(((U8*)object) - sizeof(OwnedBoxHeader));
+	}
+
+	// DEF ManagedBox
+	template <typename T>
+	ManagedBox<T>* ManagedBox<T>::getBox(T* object) {
+		return (ManagedBox<T>*)(((U8*)object) - sizeof(ManagedBoxHeader));
+	}
+
+	// DEF ExchangeHeap
+	ExchangeHeap::ExchangeHeap() {
+	#ifdef OCT_HEAP_STATS
+		memset(&_stats, 0, sizeof(_stats));
+		_stats.sampleInterval = HEAP_DEFAULT_SAMPLE_INTERVAL;
+	#endif
+	}
+
+	ExchangeHeap::~ExchangeHeap() {
+	}
+
+	template <typename T>
+	Owned<T> ExchangeHeap::alloc(Context* ctx) {
+		Option< Owned<T> > ret = tryAlloc<T>(ctx);
+		if(OCT_UNLIKELY(!ret.hasValue())) {
+			throw Exception(Exception::OUT_OF_MEMORY, "exchange heap allocation failed");
+		}
+		return ret.value;
+	}
+	
+	template <typename T>
+	Owned< Array<T> > ExchangeHeap::allocArray(Context* ctx, Uword length, Uword flags) {
+		Option< Owned< Array<T> > > ret = tryAllocArray<T>(ctx, length, flags);
+		if(OCT_UNLIKELY(!ret.hasValue())) {
+			throw Exception(Exception::OUT_OF_MEMORY, "exchange heap array allocation failed");
+		}
+		return ret.value;
+	}
+
+	template <typename T>
+	Option< Owned<T> > ExchangeHeap::tryAlloc(Context* ctx) {
+		Option< Owned<T> > ret;
+		OwnedBox<T>* box = (OwnedBox<T>*)SYS.tryAlloc(sizeof(OwnedBox<T>));
+		if(box) {
+			box->header.allocBase = (Uword)box;
+			ret.value.obj = &box->object;
+		#ifdef OCT_HEAP_STATS
+			box->header.statsReserved = sizeof(OwnedBox<T>);
+			recordAlloc(ctx, &box->header, sizeof(T), BuiltinType<T>::get());
+		#endif
+		}
+		return ret;
+	}
+
+	template <typename T>
+	Option< Owned< Array<T> > > ExchangeHeap::tryAllocArray(Context* ctx, Uword length, Uword flags) {
+		Option< Owned< Array<T> > > ret;
+		Uword dataOffset = offsetof(OwnedBox< Array<T> >, object) + offsetof(Array<T>, data);
+		// Sizes that may go to the OS for pages are the slow path worth tracing
+		bool large = sizeof(T) * length >= HUGE_PAGE_SIZE;
+		if(OCT_UNLIKELY(large)) {
+			OCT_TRACE_EVENT(ctx, TRACE_ALLOC_LARGE, TRACE_BEGIN, sizeof(T) * length, flags);
+		}
+		OwnedBox< Array<T> >* box = (OwnedBox< Array<T> >*)tryAllocAligned(dataOffset, sizeof(T) * length, alignof(T), flags);
+		if(OCT_UNLIKELY(large)) {
+			OCT_TRACE_EVENT(ctx, TRACE_ALLOC_LARGE, TRACE_END, sizeof(T) * length, flags);
+		}
+		if(box) {
+			box->object.elementType = nullptr;
+			box->object.size = length;
+			ret.value.obj = &box->object;
+		#ifdef OCT_HEAP_STATS
+			recordAlloc(ctx, &box->header, sizeof(T) * length, BuiltinType<T>::get());
+		#endif
+		}
+		return ret;
+	}
+
+	template <typename T>
+	Owned< Array<T> > ExchangeHeap::reallocArray(Context* ctx, Owned< Array<T> > arr, Uword length, Uword flags) {
+		Option< Owned< Array<T> > > ret = tryReallocArray<T>(ctx, arr, length, flags);
+		if(OCT_UNLIKELY(!ret.hasValue())) {
+			throw Exception(Exception::OUT_OF_MEMORY, "exchange heap array reallocation failed");
+		}
+		return ret.value;
+	}
+
+	template <typename T>
+	Option< Owned< Array<T> > > ExchangeHeap::tryReallocArray(Context* ctx, Owned< Array<T> > arr, Uword length, Uword flags) {
+		Uword keep = arr->size < length ? arr->size : length;
+		if(!t::trivially_relocatable<T>::value) {
+			// Copy into a fresh array so the elements see their copy constructor
+			if(OwnedBox< Array<T> >::getBox(arr.obj)->header.allocBase & ALIGNED_TAG) {
+				flags |= ALLOC_ALIGNED;
+			}
+			Option< Owned< Array<T> > > ret = tryAllocArray<T>(ctx, length, flags);
+			if(ret.hasValue()) {
+				ret.value->elementType = arr->elementType;
+				for(Uword i = 0; i < keep; ++i) {
+					new (&ret.value->data[i]) T(arr->data[i]);
+					arr->data[i].~T();
+				}
+				free(arr.obj);
+			}
+			return ret;
+		}
+		Option< Owned< Array<T> > > ret;
+		Uword dataOffset = offsetof(OwnedBox< Array<T> >, object) + offsetof(Array<T>, data);
+	#ifdef OCT_HEAP_STATS
+		OwnedBoxHeader old = OwnedBox< Array<T> >::getBox(arr.obj)->header;
+	#endif
+		OwnedBox< Array<T> >* box = (OwnedBox< Array<T> >*)tryReallocAligned(OwnedBox< Array<T> >::getBox(arr.obj),
+			dataOffset, sizeof(T) * keep, sizeof(T) * length, alignof(T), flags);
+		if(box) {
+			box->object.size = length;
+			ret.value.obj = &box->object;
+		#ifdef OCT_HEAP_STATS
+			recordFree(&old);
+			recordAlloc(ctx, &box->header, sizeof(T) * length, old.statsType);
+		#endif
+		}
+		return ret;
+	}
+
+	Owned< Array<Unknown> > ExchangeHeap::allocArray(Context* ctx, Type* elementType, Uword length, Uword flags) {
+		Owned< Array<Unknown> > ret;
+		Uword dataOffset = offsetof(OwnedBox< Array<Unknown> >, object) + offsetof(Array<Unknown>, data);
+		bool large = elementType->size * length >= HUGE_PAGE_SIZE;
+		if(OCT_UNLIKELY(large)) {
+			OCT_TRACE_EVENT(ctx, TRACE_ALLOC_LARGE, TRACE_BEGIN, elementType->size * length, flags);
+		}
+		OwnedBox< Array<Unknown> >* box = (OwnedBox< Array<Unknown> >*)tryAllocAligned(dataOffset, elementType->size * length,
+			elementType->alignment, flags);
+		if(OCT_UNLIKELY(large)) {
+			OCT_TRACE_EVENT(ctx, TRACE_ALLOC_LARGE, TRACE_END, elementType->size * length, flags);
+		}
+		if(OCT_UNLIKELY(!box)) {
+			throw Exception(Exception::OUT_OF_MEMORY, "exchange heap array allocation failed");
+		}
+		box->object.elementType = elementType;
+		box->object.size = length;
+		ret.obj = &box->object;
+	#ifdef OCT_HEAP_STATS
+		recordAlloc(ctx, &box->header, elementType->size * length, elementType);
+	#endif
+		return ret;
+	}
+
+	Owned< Array<Unknown> > ExchangeHeap::reallocArray(Context* ctx, Owned< Array<Unknown> > arr, Uword length, Uword flags) {
+		Owned< Array<Unknown> > ret;
+		Uword elementSize = arr->elementType->size;
+		Uword keep = arr->size < length ? arr->size : length;
+		Uword dataOffset = offsetof(OwnedBox< Array<Unknown> >, object) + offsetof(Array<Unknown>, data);
+	#ifdef OCT_HEAP_STATS
+		OwnedBoxHeader old = OwnedBox< Array<Unknown> >::getBox(arr.obj)->header;
+	#endif
+		OwnedBox< Array<Unknown> >* box = (OwnedBox< Array<Unknown> >*)tryReallocAligned(OwnedBox< Array<Unknown> >::getBox(arr.obj),
+			dataOffset, elementSize * keep, elementSize * length, arr->elementType->alignment, flags);
+		if(OCT_UNLIKELY(!box)) {
+			throw Exception(Exception::OUT_OF_MEMORY, "exchange heap array reallocation failed");
+		}
+		box->object.size = length;
+		ret.obj = &box->object;
+	#ifdef OCT_HEAP_STATS
+		recordFree(&old);
+		recordAlloc(ctx, &box->header, elementSize * length, old.statsType);
+	#endif
+		return ret;
+	}
+
+	// Where the data of an array with elements of elementAlignment ends up, and how many bytes it
+	// takes. Zero alignments come from types that do not care.
+	static Uword arrayAlignment(Uword elementAlignment, Uword flags) {
+		Uword alignment = elementAlignment ? elementAlignment : 1;
+		if((flags & ALLOC_ALIGNED) && alignment < ARRAY_ALIGNMENT) {
+			alignment = ARRAY_ALIGNMENT;
+		}
+		return alignment;
+	}
+
+	static Uword arrayDataSize(Uword dataSize, Uword flags) {
+		return (flags & ALLOC_ALIGNED) ? (dataSize + ARRAY_ALIGNMENT - 1) & ~(ARRAY_ALIGNMENT - 1) : dataSize;
+	}
+
+	// The size kept in front of a page allocation, what the OS reserved for it
+	static Uword pagesSize(Uword size) {
+		Uword granularity = SYS.mappingGranularity();
+		return (size + granularity - 1) & ~(granularity - 1);
+	}
+
+	// Returns a box whose byte at dataOffset is suitably aligned, or nullptr. The space in front
+	// of the header keeps the size of page allocations. A malloc block is already aligned enough
+	// for most arrays; only larger alignments pay for the slack to slide the box into place.
+	void* ExchangeHeap::tryAllocAligned(Uword dataOffset, Uword dataSize, Uword elementAlignment, Uword flags) {
+		Uword alignment = arrayAlignment(elementAlignment, flags);
+		Uword tags = (flags & ALLOC_ALIGNED) ? ALIGNED_TAG : 0;
+		dataSize = arrayDataSize(dataSize, flags);
+		Uword lead = (dataOffset + sizeof(Uword) + alignment - 1) & ~(alignment - 1);
+		if((flags & ALLOC_HUGE_PAGES) && lead + dataSize >= HUGE_PAGE_SIZE) {
+			Uword size = pagesSize(lead + dataSize);
+			U8* base = (U8*)SYS.tryAllocPages(size, true);
+			if(base) {
+				*(Uword*)base = size;
+				OwnedBoxHeader* header = (OwnedBoxHeader*)(base + lead - dataOffset);
+				header->allocBase = (Uword)base | PAGES_TAG | tags;
+			#ifdef OCT_HEAP_STATS
+				header->statsReserved = size;
+			#endif
+				return header;
+			}
+			// No pages left for a mapping, malloc may still find room
+		}
+		Uword slack = (alignment > MALLOC_ALIGNMENT || (dataOffset & (alignment - 1))) ? alignment : 0;
+		Uword total = dataOffset + dataSize + slack;
+		U8* base = (U8*)SYS.tryAlloc(total);
+		if(!base) {
+			return nullptr;
+		}
+		U8* data = (U8*)(((Uword)base + dataOffset + alignment - 1) & ~(alignment - 1));
+		OwnedBoxHeader* header = (OwnedBoxHeader*)(data - dataOffset);
+		header->allocBase = (Uword)base | tags;
+	#ifdef OCT_HEAP_STATS
+		header->statsReserved = total;
+	#endif
+		return header;
+	}
+	
+	// Moves the header and the first keepSize bytes of data of an aligned box into an allocation
+	// for dataSize bytes. Returns nullptr and leaves the box alone when out of memory.
+	void* ExchangeHeap::tryReallocAligned(void* box, Uword dataOffset, Uword keepSize, Uword dataSize, Uword elementAlignment, Uword flags) {
+		Uword base = ((OwnedBoxHeader*)box)->allocBase;
+		assert(!(base & MAPPED_TAG) && "Mapped arrays are read only");
+		if(base & ALIGNED_TAG) {
+			flags |= ALLOC_ALIGNED;
+		}
+		Uword alignment = arrayAlignment(elementAlignment, flags);
+		Uword tags = base & ALIGNED_TAG;
+		Uword alignedSize = arrayDataSize(dataSize, flags);
+		Uword lead = (dataOffset + sizeof(Uword) + alignment - 1) & ~(alignment - 1);
+		bool wantPages = (flags & ALLOC_HUGE_PAGES) && lead + alignedSize >= HUGE_PAGE_SIZE;
+		if((base & PAGES_TAG) && lead + alignedSize >= HUGE_PAGE_SIZE) {
+			// Page allocations keep the data at lead, only the size in front changes
+			U8* pages = (U8*)(base & ~(PAGES_TAG | ALIGNED_TAG));
+			Uword size = pagesSize(lead + alignedSize);
+			U8* moved = (U8*)SYS.tryReallocPages(pages, *(Uword*)pages, size, wantPages);
+			if(!moved) {
+				return nullptr;
+			}
+			*(Uword*)moved = size;
+			OwnedBoxHeader* header = (OwnedBoxHeader*)(moved + lead - dataOffset);
+			header->allocBase = (Uword)moved | PAGES_TAG | tags;
+		#ifdef OCT_HEAP_STATS
+			header->statsReserved = size;
+		#endif
+			return header;
+		}
+		if(!(base & PAGES_TAG) && !wantPages) {
+			// realloc may move the block to a different alignment, then the box slides into place
+			U8* oldBase = (U8*)(base & ~ALIGNED_TAG);
+			Uword shift = (U8*)box - oldBase;
+			Uword slack = (alignment > MALLOC_ALIGNMENT || (dataOffset & (alignment - 1))) ? alignment : 0;
+			Uword total = dataOffset + alignedSize + slack;
+			U8* newBase = (U8*)SYS.tryRealloc(oldBase, total);
+			if(!newBase) {
+				return nullptr;
+			}
+			U8* data = (U8*)(((Uword)newBase + dataOffset + alignment - 1) & ~(alignment - 1));
+			OwnedBoxHeader* header = (OwnedBoxHeader*)(data - dataOffset);
+			if((U8*)header != newBase + shift) {
+				memmove(header, newBase + shift, dataOffset + keepSize);
+			}
+			header->allocBase = (Uword)newBase | tags;
+		#ifdef OCT_HEAP_STATS
+			header->statsReserved = total;
+		#endif
+			return header;
+		}
+		// Switching between malloc and pages
+		U8* header = (U8*)tryAllocAligned(dataOffset, dataSize, elementAlignment, flags);
+		if(!header) {
+			return nullptr;
+		}
+		memcpy(header + sizeof(OwnedBoxHeader), ((U8*)box) + sizeof(OwnedBoxHeader), dataOffset - sizeof(OwnedBoxHeader) + keepSize);
+		freeBox(box);
+		return header;
+	}
+
+	void ExchangeHeap::free(void* object) {
+		// Cast to nothing to please template. Type does not matter here, only THE BOX.
+		OwnedBox<Nothing>* box = OwnedBox<Nothing>::getBox((Nothing*)object);
+	#ifdef OCT_HEAP_STATS
+		if(!(box->header.allocBase & MAPPED_TAG)) {
+			recordFree(&box->header);
+		}
+	#endif
+		freeBox(box);
+	}
+
+	void ExchangeHeap::freeBox(void* box) {
+		Uword base = ((OwnedBoxHeader*)box)->allocBase;
+		if(base & MAPPED_TAG) {
+			// The box sits in front of a mapped file, the heap never allocated it
+			MappedFile::release(&((OwnedBox< Array<U8> >*)box)->object);
+		}
+		else if(base & PAGES_TAG) {
+			base &= ~(PAGES_TAG | ALIGNED_TAG);
+			SYS.freePages((void*)base, *(Uword*)base);
+		}
+		else {
+			SYS.free((void*)(base & ~ALIGNED_TAG));
+		}
+	}
+
+	HeapStats* ExchangeHeap::getStats() {
+	#ifdef OCT_HEAP_STATS
+		return &_stats;
+	#else
+		return nullptr;
+	#endif
+	}
+
+	void ExchangeHeap::setSampleInterval(Uword bytes) {
+	#ifdef OCT_HEAP_STATS
+		SYS.atomicSetUword(&_stats.sampleInterval, bytes);
+	#endif
+	}
+
+	#ifdef OCT_HEAP_STATS
+	static Uword heapSizeClass(Uword size) {
+		Uword c = 0;
+		for(Uword limit = 16; limit < size && c < HEAP_SIZE_CLASSES - 1; limit <<= 1) {
+			++c;
+		}
+		return c;
+	}
+
+	// Open addressing on the Type address. Slots are claimed with a CAS and never given back.
+	HeapTypeStats* ExchangeHeap::getTypeStats(Type* type) {
+		if(!type) {
+			return &_stats.untyped;
+		}
+		Uword start = ((Uword)type >> 4) & (HEAP_TYPE_SLOTS - 1);
+		for(Uword i = 0; i < HEAP_TYPE_SLOTS; ++i) {
+			HeapTypeStats* slot = &_stats.types[(start + i) & (HEAP_TYPE_SLOTS - 1)];
+			Type* current = (Type*)SYS.atomicGetUword((volatile Uword*)&slot->type);
+			if(current == type) {
+				return slot;
+			}
+			if(!current && SYS.atomicCompareExchangeUword((volatile Uword*)&slot->type, 0, (Uword)type)) {
+				return slot;
+			}
+			if((Type*)SYS.atomicGetUword((volatile Uword*)&slot->type) == type) {
+				return slot;
+			}
+		}
+		return &_stats.untyped;
+	}
+
+	void ExchangeHeap::recordAlloc(Context* ctx, OwnedBoxHeader* header, Uword requested, Type* type) {
+		Uword reserved = header->statsReserved;
+		header->statsRequested = requested;
+		header->statsType = type;
+		SYS.atomicAddUword(&_stats.liveObjects, 1);
+		Uword live = SYS.atomicAddUword(&_stats.liveBytes, reserved);
+		SYS.atomicAddUword(&_stats.totalObjects, 1);
+		SYS.atomicAddUword(&_stats.totalBytes, reserved);
+		Uword peak;
+		do {
+			peak = SYS.atomicGetUword(&_stats.peakLiveBytes);
+		} while(live > peak && !SYS.atomicCompareExchangeUword(&_stats.peakLiveBytes, peak, live));
+		HeapClassStats* sizeClass = &_stats.classes[heapSizeClass(reserved)];
+		SYS.atomicAddUword(&sizeClass->liveObjects, 1);
+		SYS.atomicAddUword(&sizeClass->requestedBytes, requested);
+		SYS.atomicAddUword(&sizeClass->reservedBytes, reserved);
+		HeapTypeStats* typeStats = getTypeStats(type);
+		SYS.atomicAddUword(&typeStats->liveObjects, 1);
+		SYS.atomicAddUword(&typeStats->liveBytes, reserved);
+		if(!ctx) {
+			return;
+		}
+		ContextHeapStats& own = ctx->getHeapStats();
+		++own.allocatedObjects;
+		own.allocatedBytes += reserved;
+		Uword interval = _stats.sampleInterval;
+		if(interval && own.allocatedBytes >= own.nextSample) {
+			own.nextSample = own.allocatedBytes + interval;
+			// A reader may see a sample while it is written, the report is only a hint
+			Uword index = SYS.atomicAddUword(&_stats.numSamples, 1) - 1;
+			HeapSample* sample = &_stats.samples[index % HEAP_SAMPLES];
+			sample->size = requested;
+			sample->type = type;
+			sample->numFrames = SYS.captureBacktrace(sample->frames, HEAP_SAMPLE_FRAMES);
+		}
+	}
+
+	void ExchangeHeap::recordFree(OwnedBoxHeader* header) {
+		Uword reserved = header->statsReserved;
+		SYS.atomicAddUword(&_stats.liveObjects, (Uword)-1);
+		SYS.atomicAddUword(&_stats.liveBytes, (Uword)0 - reserved);
+		HeapClassStats* sizeClass = &_stats.classes[heapSizeClass(reserved)];
+		SYS.atomicAddUword(&sizeClass->liveObjects, (Uword)-1);
+		SYS.atomicAddUword(&sizeClass->requestedBytes, (Uword)0 - header->statsRequested);
+		SYS.atomicAddUword(&sizeClass->reservedBytes, (Uword)0 - reserved);
+		HeapTypeStats* typeStats = getTypeStats(header->statsType);
+		SYS.atomicAddUword(&typeStats->liveObjects, (Uword)-1);
+		SYS.atomicAddUword(&typeStats->liveBytes, (Uword)0 - reserved);
+	}
+	#endif
+
+	void ExchangeHeap::printStats(FILE* out) {
+		fprintf(out, "peak rss: %lu bytes\n", (unsigned long)SYS.peakResidentBytes());
+	#ifdef OCT_HEAP_STATS
+		fprintf(out, "live: %lu objects, %lu bytes (peak %lu)\n", (unsigned long)_stats.liveObjects,
+			(unsigned long)_stats.liveBytes, (unsigned long)_stats.peakLiveBytes);
+		fprintf(out, "total: %lu objects, %lu bytes\n", (unsigned long)_stats.totalObjects, (unsigned long)_stats.totalBytes);
+		fprintf(out, "size classes (reserved <= bytes: live objects, requested / reserved bytes):\n");
+		for(Uword c = 0; c < HEAP_SIZE_CLASSES; ++c) {
+			HeapClassStats* sizeClass = &_stats.classes[c];
+			if(sizeClass->liveObjects) {
+				fprintf(out, "  %lu%s: %lu, %lu / %lu\n", (unsigned long)(16UL << c), c == HEAP_SIZE_CLASSES - 1 ? "+" : "",
+					(unsigned long)sizeClass->liveObjects, (unsigned long)sizeClass->requestedBytes,
+					(unsigned long)sizeClass->reservedBytes);
+			}
+		}
+		fprintf(out, "types (live objects, bytes):\n");
+		fprintf(out, "  untyped: %lu, %lu\n", (unsigned long)_stats.untyped.liveObjects, (unsigned long)_stats.untyped.liveBytes);
+		for(Uword i = 0; i < HEAP_TYPE_SLOTS; ++i) {
+			HeapTypeStats* typeStats = &_stats.types[i];
+			if(typeStats->type && typeStats->liveObjects) {
+				if(typeStats->type->name) {
+					fprintf(out, "  %s (size %lu): %lu, %lu\n", typeStats->type->name, (unsigned long)typeStats->type->size,
+						(unsigned long)typeStats->liveObjects, (unsigned long)typeStats->liveBytes);
+				}
+				else {
+					fprintf(out, "  type %p (size %lu): %lu, %lu\n", (void*)typeStats->type, (unsigned long)typeStats->type->size,
+						(unsigned long)typeStats->liveObjects, (unsigned long)typeStats->liveBytes);
+				}
+			}
+		}
+		Uword numSamples = _stats.numSamples;
+		Uword first = numSamples > HEAP_SAMPLES ? numSamples - HEAP_SAMPLES : 0;
+		fprintf(out, "samples (every %lu bytes, %lu taken):\n", (unsigned long)_stats.sampleInterval, (unsigned long)numSamples);
+		for(Uword i = first; i < numSamples; ++i) {
+			HeapSample* sample = &_stats.samples[i % HEAP_SAMPLES];
+			if(sample->type && sample->type->name) {
+				fprintf(out, "  %lu bytes, %s\n", (unsigned long)sample->size, sample->type->name);
+			}
+			else {
+				fprintf(out, "  %lu bytes, type %p\n", (unsigned long)sample->size, (void*)sample->type);
+			}
+			SYS.printBacktrace(sample->frames, sample->numFrames);
+		}
+	#else
+		fprintf(out, "heap statistics are off, build with OCT_HEAP_STATS\n");
+	#endif
+	}
+
+	// TODO: Managed Heap
+
+	// DEF Simd
+	// Plain loops the compiler vectorizes for whatever instruction set the calling variant
+	// is compiled for. Everything is force inlined into the variants below.
+	namespace simd {
+
+		struct Add { template <typename T> static OCT_ALWAYS_INLINE T apply(T a, T b) { return a + b; } };
+		struct Sub { template <typename T> static OCT_ALWAYS_INLINE T apply(T a, T b) { return a - b; } };
+		struct Mul { template <typename T> static OCT_ALWAYS_INLINE T apply(T a, T b) { return a * b; } };
+		struct Min { template <typename T> static OCT_ALWAYS_INLINE T apply(T a, T b) { return b < a ? b : a; } };
+		struct Max { template <typename T> static OCT_ALWAYS_INLINE T apply(T a, T b) { return a < b ? b : a; } };
+
+		struct Eq { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a == b; } };
+		struct Ne { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a != b; } };
+		struct Lt { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a < b; } };
+		struct Le { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a <= b; } };
+		struct Gt { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a > b; } };
+		struct Ge { template <typename T> static OCT_ALWAYS_INLINE U8 apply(T a, T b) { return a >= b; } };
+
+		// One cache line of partial results. They are independent, so the compiler can keep
+		// them in vector registers without having to reassociate floating point math.
+		template <typename T>
+		struct Lanes {
+			static const Uword count = 64 / sizeof(T);
+		};
+
+		template <typename Op, typename T>
+		OCT_ALWAYS_INLINE void mapLoop(const T* a, const T* b, T* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = Op::apply(a[i], b[i]);
+			}
+		}
+
+		template <typename Op, typename T>
+		OCT_ALWAYS_INLINE void mapScalarLoop(const T* a, T b, T* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = Op::apply(a[i], b);
+			}
+		}
+
+		// Acc is T for min and max, which never leave the range of T
+		template <typename Op, typename Acc, typename T>
+		OCT_ALWAYS_INLINE Acc reduceLoop(const T* a, Uword n, Acc identity) {
+			Acc acc[Lanes<Acc>::count];
+			for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+				acc[k] = identity;
+			}
+			Uword i = 0;
+			for(; i + Lanes<Acc>::count <= n; i += Lanes<Acc>::count) {
+				for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+					acc[k] = Op::apply(acc[k], (Acc)a[i + k]);
+				}
+			}
+			Acc result = identity;
+			for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+				result = Op::apply(result, acc[k]);
+			}
+			for(; i < n; ++i) {
+				result = Op::apply(result, (Acc)a[i]);
+			}
+			return result;
+		}
+
+		template <typename Cmp, typename T>
+		OCT_ALWAYS_INLINE void compareLoop(const T* a, const T* b, U8* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = Cmp::apply(a[i], b[i]);
+			}
+		}
+
+		template <typename Cmp, typename T>
+		OCT_ALWAYS_INLINE void compareScalarLoop(const T* a, T b, U8* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = Cmp::apply(a[i], b);
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void map(SimdOp op, const T* a, const T* b, T* out, Uword n) {
+			switch(op) {
+			case SIMD_ADD: mapLoop<Add>(a, b, out, n); break;
+			case SIMD_SUB: mapLoop<Sub>(a, b, out, n); break;
+			case SIMD_MUL: mapLoop<Mul>(a, b, out, n); break;
+			case SIMD_MIN: mapLoop<Min>(a, b, out, n); break;
+			case SIMD_MAX: mapLoop<Max>(a, b, out, n); break;
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void mapScalar(SimdOp op, const T* a, T b, T* out, Uword n) {
+			switch(op) {
+			case SIMD_ADD: mapScalarLoop<Add>(a, b, out, n); break;
+			case SIMD_SUB: mapScalarLoop<Sub>(a, b, out, n); break;
+			case SIMD_MUL: mapScalarLoop<Mul>(a, b, out, n); break;
+			case SIMD_MIN: mapScalarLoop<Min>(a, b, out, n); break;
+			case SIMD_MAX: mapScalarLoop<Max>(a, b, out, n); break;
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE typename SimdWide<T>::Type reduce(SimdOp op, const T* a, Uword n) {
+			typedef typename SimdWide<T>::Acc Acc;
+			typedef typename SimdWide<T>::Type Wide;
+			switch(op) {
+			case SIMD_ADD: return (Wide)reduceLoop<Add>(a, n, Acc(0));
+			case SIMD_MUL: return (Wide)reduceLoop<Mul>(a, n, Acc(1));
+			// min and max are idempotent, so the first element is as good as an identity
+			case SIMD_MIN: return (Wide)reduceLoop<Min>(a, n, a[0]);
+			case SIMD_MAX: return (Wide)reduceLoop<Max>(a, n, a[0]);
+			default: return Wide(0);
+			}
+		}
+
+		// Merges two results of reduce with the same op
+		template <typename T>
+		OCT_ALWAYS_INLINE typename SimdWide<T>::Type combine(SimdOp op, typename SimdWide<T>::Type a, typename SimdWide<T>::Type b) {
+			typedef typename SimdWide<T>::Acc Acc;
+			typedef typename SimdWide<T>::Type Wide;
+			switch(op) {
+			case SIMD_ADD: return (Wide)((Acc)a + (Acc)b);
+			case SIMD_MUL: return (Wide)((Acc)a * (Acc)b);
+			case SIMD_MIN: return Min::apply(a, b);
+			case SIMD_MAX: return Max::apply(a, b);
+			default: return Wide(0);
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE typename SimdWide<T>::Type dot(const T* a, const T* b, Uword n) {
+			typedef typename SimdWide<T>::Acc Acc;
+			Acc acc[Lanes<Acc>::count];
+			for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+				acc[k] = Acc(0);
+			}
+			Uword i = 0;
+			for(; i + Lanes<Acc>::count <= n; i += Lanes<Acc>::count) {
+				for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+					acc[k] += (Acc)a[i + k] * (Acc)b[i + k];
+				}
+			}
+			Acc result = Acc(0);
+			for(Uword k = 0; k < Lanes<Acc>::count; ++k) {
+				result += acc[k];
+			}
+			for(; i < n; ++i) {
+				result += (Acc)a[i] * (Acc)b[i];
+			}
+			return (typename SimdWide<T>::Type)result;
+		}
+
+		// A scan carries a dependency from one element to the next, it stays scalar. The sum is
+		// kept in Acc too, so an integer overflow wraps the stored values instead of being undefined.
+		template <typename T>
+		OCT_ALWAYS_INLINE void prefixSum(const T* a, T* out, Uword n) {
+			typename SimdWide<T>::Acc sum = 0;
+			for(Uword i = 0; i < n; ++i) {
+				sum += (typename SimdWide<T>::Acc)a[i];
+				out[i] = (T)sum;
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void compare(SimdCmp cmp, const T* a, const T* b, U8* out, Uword n) {
+			switch(cmp) {
+			case SIMD_EQ: compareLoop<Eq>(a, b, out, n); break;
+			case SIMD_NE: compareLoop<Ne>(a, b, out, n); break;
+			case SIMD_LT: compareLoop<Lt>(a, b, out, n); break;
+			case SIMD_LE: compareLoop<Le>(a, b, out, n); break;
+			case SIMD_GT: compareLoop<Gt>(a, b, out, n); break;
+			case SIMD_GE: compareLoop<Ge>(a, b, out, n); break;
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void compareScalar(SimdCmp cmp, const T* a, T b, U8* out, Uword n) {
+			switch(cmp) {
+			case SIMD_EQ: compareScalarLoop<Eq>(a, b, out, n); break;
+			case SIMD_NE: compareScalarLoop<Ne>(a, b, out, n); break;
+			case SIMD_LT: compareScalarLoop<Lt>(a, b, out, n); break;
+			case SIMD_LE: compareScalarLoop<Le>(a, b, out, n); break;
+			case SIMD_GT: compareScalarLoop<Gt>(a, b, out, n); break;
+			case SIMD_GE: compareScalarLoop<Ge>(a, b, out, n); break;
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void select(const U8* mask, const T* a, const T* b, T* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = mask[i] ? a[i] : b[i];
+			}
+		}
+
+		// Vectorized reduction first, then a search for the first element equal to it. Falls
+		// back to 0 when there is no match, which only happens with NaNs.
+		template <typename Op, typename T>
+		OCT_ALWAYS_INLINE Uword argLoop(const T* a, Uword n) {
+			T best = reduceLoop<Op>(a, n, a[0]);
+			for(Uword i = 0; i < n; ++i) {
+				if(a[i] == best) {
+					return i;
+				}
+			}
+			return 0;
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void gather(const T* src, const Uword* indices, T* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[i] = src[indices[i]];
+			}
+		}
+
+		template <typename T>
+		OCT_ALWAYS_INLINE void scatter(const T* src, const Uword* indices, T* out, Uword n) {
+			for(Uword i = 0; i < n; ++i) {
+				out[indices[i]] = src[i];
+			}
+		}
+
+	} // namespace simd
+
+	// One set of kernels per instruction set. attr is empty for the baseline build.
+	#define OCT_SIMD_VARIANT(Name, isaName, attr) \
+	template <typename T> \
+	struct Name { \
+		static attr void map(SimdOp op, const T* a, const T* b, T* out, Uword n) { simd::map(op, a, b, out, n); } \
+		static attr void mapScalar(SimdOp op, const T* a, T b, T* out, Uword n) { simd::mapScalar(op, a, b, out, n); } \
+		static attr typename SimdWide<T>::Type reduce(SimdOp op, const T* a, Uword n) { return simd::reduce(op, a, n); } \
+		static attr typename SimdWide<T>::Type dot(const T* a, const T* b, Uword n) { return simd::dot(a, b, n); } \
+		static attr void prefixSum(const T* a, T* out, Uword n) { simd::prefixSum(a, out, n); } \
+		static attr void compare(SimdCmp cmp, const T* a, const T* b, U8* out, Uword n) { simd::compare(cmp, a, b, out, n); } \
+		static attr void compareScalar(SimdCmp cmp, const T* a, T b, U8* out, Uword n) { simd::compareScalar(cmp, a, b, out, n); } \
+		static attr void select(const U8* mask, const T* a, const T* b, T* out, Uword n) { simd::select(mask, a, b, out, n); } \
+		static attr Uword argMin(const T* a, Uword n) { return simd::argLoop<simd::Min>(a, n); } \
+		static attr Uword argMax(const T* a, Uword n) { return simd::argLoop<simd::Max>(a, n); } \
+		static attr void gather(const T* src, const Uword* indices, T* out, Uword n) { simd::gather(src, indices, out, n); } \
+		static attr void scatter(const T* src, const Uword* indices, T* out, Uword n) { simd::scatter(src, indices, out, n); } \
+		static SimdKernels<T> kernels() { \
+			SimdKernels<T> k = { map, mapScalar, reduce, dot, prefixSum, compare, compareScalar, select, argMin, argMax, gather, scatter, isaName }; \
+			return k; \
+		} \
+	};
+
+	OCT_SIMD_VARIANT(SimdBaseline, "baseline", )
+	#ifdef OCT_SIMD_X86
+	OCT_SIMD_VARIANT(SimdSse42, "sse4.2", OCT_TARGET("sse4.2"))
+	OCT_SIMD_VARIANT(SimdAvx2, "avx2", OCT_TARGET("avx2"))
+	OCT_SIMD_VARIANT(SimdAvx512, "avx512", OCT_TARGET("avx512f,avx512bw"))
+	#endif
+
+	template <typename T>
+	SimdKernels<T> Simd<T>::pickKernels() {
+	#ifdef OCT_SIMD_X86
+		Uword features = SYS.cpuFeatures();
+		if(features & CPU_AVX512) {
+			return SimdAvx512<T>::kernels();
+		}
+		if(features & CPU_AVX2) {
+			return SimdAvx2<T>::kernels();
+		}
+		if(features & CPU_SSE42) {
+			return SimdSse42<T>::kernels();
+		}
+	#endif
+		// NEON is part of the aarch64 baseline
+		return SimdBaseline<T>::kernels();
+	}
+
+	// A function local static rather than a static member: the order in which static members
+	// of different template instances are initialized is unspecified, and other static
+	// initializers may already call into the kernels
+	template <typename T>
+	const SimdKernels<T>& Simd<T>::getKernels() {
+		static const SimdKernels<T> kernels = pickKernels();
+		return kernels;
+	}
+
+	template <typename T>
+	void Simd<T>::map(SimdOp op, const Array<T>* a, const Array<T>* b, Array<T>* out) {
+		if(a->size != b->size || a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().map(op, a->data, b->data, out->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::map(SimdOp op, const Array<T>* a, T b, Array<T>* out) {
+		if(a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().mapScalar(op, a->data, b, out->data, a->size);
+	}
+
+	template <typename T>
+	typename Simd<T>::Wide Simd<T>::reduce(SimdOp op, const Array<T>* a) {
+		if(op == SIMD_SUB) {
+			throw Exception(Exception::BAD_ARGUMENT, "subtraction is not a reduction");
+		}
+		if((op == SIMD_MIN || op == SIMD_MAX) && a->size == 0) {
+			throw Exception(Exception::BAD_ARGUMENT, "empty array has no minimum or maximum");
+		}
+		return getKernels().reduce(op, a->data, a->size);
+	}
+
+	template <typename T>
+	typename Simd<T>::Wide Simd<T>::dot(const Array<T>* a, const Array<T>* b) {
+		if(a->size != b->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		return getKernels().dot(a->data, b->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::prefixSum(const Array<T>* a, Array<T>* out) {
+		if(a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().prefixSum(a->data, out->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::compare(SimdCmp cmp, const Array<T>* a, const Array<T>* b, Array<U8>* out) {
+		if(a->size != b->size || a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().compare(cmp, a->data, b->data, out->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::compare(SimdCmp cmp, const Array<T>* a, T b, Array<U8>* out) {
+		if(a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().compareScalar(cmp, a->data, b, out->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::select(const Array<U8>* mask, const Array<T>* a, const Array<T>* b, Array<T>* out) {
+		if(mask->size != a->size || a->size != b->size || a->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+		getKernels().select(mask->data, a->data, b->data, out->data, a->size);
+	}
+
+	template <typename T>
+	T Simd<T>::min(const Array<T>* a) {
+		return (T)reduce(SIMD_MIN, a);
+	}
+
+	template <typename T>
+	T Simd<T>::max(const Array<T>* a) {
+		return (T)reduce(SIMD_MAX, a);
+	}
+
+	template <typename T>
+	Uword Simd<T>::argMin(const Array<T>* a) {
+		if(a->size == 0) {
+			throw Exception(Exception::BAD_ARGUMENT, "empty array has no minimum");
+		}
+		return getKernels().argMin(a->data, a->size);
+	}
+
+	template <typename T>
+	Uword Simd<T>::argMax(const Array<T>* a) {
+		if(a->size == 0) {
+			throw Exception(Exception::BAD_ARGUMENT, "empty array has no maximum");
+		}
+		return getKernels().argMax(a->data, a->size);
+	}
+
+	template <typename T>
+	void Simd<T>::gather(const Array<T>* src, const Array<Uword>* indices, Array<T>* out) {
+		if(indices->size != out->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+	#ifdef OCT_DEBUG
+		for(Uword i = 0; i < indices->size; ++i) {
+			if(indices->data[i] >= src->size) {
+				throw Exception(Exception::BAD_ARGUMENT, "gather index out of range");
+			}
+		}
+	#endif
+		getKernels().gather(src->data, indices->data, out->data, out->size);
+	}
+
+	template <typename T>
+	void Simd<T>::scatter(const Array<T>* src, const Array<Uword>* indices, Array<T>* out) {
+		if(indices->size != src->size) {
+			throw Exception(Exception::BAD_ARGUMENT, "array lengths differ");
+		}
+	#ifdef OCT_DEBUG
+		for(Uword i = 0; i < indices->size; ++i) {
+			if(indices->data[i] >= out->size) {
+				throw Exception(Exception::BAD_ARGUMENT, "scatter index out of range");
+			}
+		}
+	#endif
+		getKernels().scatter(src->data, indices->data, out->data, src->size);
+	}
+
+	// Makes the selected kernels visible to JITed code as oct_simd_<kernel>_<suffix>
+	template <typename T>
+	static void addSimdSymbols(const char* suffix) {
+		const SimdKernels<T>& k = Simd<T>::getKernels();
+		const char* names[] = { "map", "mapScalar", "reduce", "dot", "prefixSum", "compare", "compareScalar", "select", "argMin", "argMax",
+			"gather", "scatter" };
+		void* fns[] = { (void*)k.map, (void*)k.mapScalar, (void*)k.reduce, (void*)k.dot, (void*)k.prefixSum, (void*)k.compare,
+			(void*)k.compareScalar, (void*)k.select, (void*)k.argMin, (void*)k.argMax, (void*)k.gather, (void*)k.scatter };
+		for(Uword i = 0; i < sizeof(fns) / sizeof(fns[0]); ++i) {
+			llvm::sys::DynamicLibrary::AddSymbol(std::string("oct_simd_") + names[i] + "_" + suffix, fns[i]);
+		}
+	}
+
+	static void addSimdSymbols() {
+		addSimdSymbols<F32>("f32");
+		addSimdSymbols<F64>("f64");
+		addSimdSymbols<I32>("i32");
+		addSimdSymbols<I64>("i64");
+		addSimdSymbols<U8>("u8");
+	}
+
+	// DEF Tracer
+	static const char* const traceKindNames[TRACE_KIND_COUNT] = {
+		"jit_compile",
+		"jit_optimize",
+		"jit_emit_object",
+		"alloc_large",
+		"scheduler_steal",
+		"scheduler_park",
+		"scheduler_task_failed",
+		"channel_blocked"
+	};
+	static const char* const tracePhaseNames[] = { "B", "E", "i" };
+
+	Tracer::Tracer(): _buffers(nullptr), _numBuffers(0), _enabled(False), _stop(False), _out(nullptr),
+		_firstEvent(true), _startCycles(0), _startNanos(0) {
+	}
+
+	Tracer::~Tracer() {
+		stop();
+		TraceBuffer* buf = _buffers;
+		while(buf) {
+			TraceBuffer* next = buf->next;
+			SYS.free(buf);
+			buf = next;
+		}
+	}
+
+	bool Tracer::isEnabled() const {
+		return _enabled != False;
+	}
+
+	void Tracer::start(const char* path) {
+		if(_out) {
+			throw Exception(Exception::BAD_ARGUMENT, "tracing already started");
+		}
+		_out = fopen(path, "w");
+		if(!_out) {
+			throw Exception(Exception::IO, "could not open the trace file");
+		}
+		fputs("[", _out);
+		_firstEvent = true;
+		// Whatever an earlier session left in the rings belongs to no file
+		for(TraceBuffer* buf = _buffers; buf; buf = buf->next) {
+			SYS.atomicStoreReleaseUword(&buf->tail, SYS.atomicGetUword(&buf->head));
+			buf->reportedDropped = buf->dropped;
+			buf->named = False;
+		}
+		_startCycles = SYS.cycleTimestamp();
+		_startNanos = SYS.nanoTimestamp();
+		SYS.atomicSetUword(&_stop, False);
+		try {
+			_flushThread = SYS.startThread(flushMain, this);
+		}
+		catch(...) {
+			// Leave the tracer stopped, so a later start may try again
+			fclose(_out);
+			_out = nullptr;
+			throw;
+		}
+		SYS.atomicSetUword(&_enabled, True);
+	}
+
+	void Tracer::stop() {
+		if(!_out) {
+			return;
+		}
+		SYS.atomicSetUword(&_enabled, False);
+		SYS.atomicSetUword(&_stop, True);
+		SYS.joinThread(_flushThread);
+		flush();
+		fputs("\n]\n", _out);
+		fclose(_out);
+		_out = nullptr;
+	}
+
+	TraceBuffer* Tracer::registerBuffer() {
+		// The new owner carries on at head, events the flush thread has not taken yet stay intact
+		TraceBuffer* buf = (TraceBuffer*)SYS.atomicGetUword((volatile Uword*)&_buffers);
+		for(; buf; buf = buf->next) {
+			if(SYS.atomicGetUword(&buf->released) && SYS.atomicCompareExchangeUword(&buf->released, True, False)) {
+				return buf;
+			}
+		}
+		buf = (TraceBuffer*)SYS.alloc(sizeof(TraceBuffer));
+		buf->released = False;
+		buf->head = 0;
+		buf->tail = 0;
+		buf->cachedTail = 0;
+		buf->dropped = 0;
+		buf->reportedDropped = 0;
+		buf->named = False;
+		buf->id = SYS.atomicAddUword(&_numBuffers, 1);
+		do {
+			buf->next = _buffers;
+		} while(!SYS.atomicCompareExchangeUword((volatile Uword*)&_buffers, (Uword)buf->next, (Uword)buf));
+		return buf;
+	}
+
+	void Tracer::releaseBuffer(TraceBuffer* buf) {
+		SYS.atomicStoreReleaseUword(&buf->released, True);
+	}
+
+	void Tracer::flushMain(void* arg) {
+		Tracer* self = (Tracer*)arg;
+		while(!SYS.atomicGetUword(&self->_stop)) {
+			SYS.sleep(TRACE_FLUSH_MILLIS);
+			self->flush();
+		}
+	}
+
+	void Tracer::writeSeparator() {
+		fputs(_firstEvent ? "\n" : ",\n", _out);
+		_firstEvent = false;
+	}
+
+	// Only called by the flush thread, or by stop once it has been joined
+	void Tracer::flush() {
+		// The tick rate over the whole session so far, exact for a constant rate counter
+		U64 cycles = SYS.cycleTimestamp() - _startCycles;
+		U64 nanos = SYS.nanoTimestamp() - _startNanos;
+		F64 microsPerCycle = cycles ? (F64)nanos / cycles / 1000 : 0;
+		Uword pid = SYS.processId();
+		TraceBuffer* buf = (TraceBuffer*)SYS.atomicGetUword((volatile Uword*)&_buffers);
+		for(; buf; buf = buf->next) {
+			if(!buf->named) {
+				writeSeparator();
+				fprintf(_out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"context %lu\"}}",
+					(unsigned long)pid, (unsigned long)buf->id, (unsigned long)buf->id);
+				buf->named = True;
+			}
+			Uword head = SYS.atomicGetUword(&buf->head);
+			Uword tail = buf->tail;
+			for(; tail != head; ++tail) {
+				const TraceEvent& e = buf->events[tail & (TRACE_BUFFER_EVENTS - 1)];
+				F64 micros = (F64)(I64)(e.cycles - _startCycles) * microsPerCycle;
+				writeSeparator();
+				fprintf(_out, "{\"name\":\"%s\",\"cat\":\"octarine\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{\"arg0\":%lu,\"arg1\":%lu}}",
+					e.kind < TRACE_KIND_COUNT ? traceKindNames[e.kind] : "unknown",
+					e.phase <= TRACE_INSTANT ? tracePhaseNames[e.phase] : "i",
+					micros, (unsigned long)pid, (unsigned long)buf->id, (unsigned long)e.arg0, (unsigned long)e.arg1);
+			}
+			// The events are copied out, the producer may overwrite them now
+			SYS.atomicStoreReleaseUword(&buf->tail, tail);
+			Uword dropped = buf->dropped;
+			if(dropped != buf->reportedDropped) {
+				writeSeparator();
+				fprintf(_out, "{\"name\":\"trace_dropped\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{\"events\":%lu}}",
+					(F64)nanos / 1000, (unsigned long)pid, (unsigned long)buf->id, (unsigned long)dropped);
+				buf->reportedDropped = dropped;
+			}
+		}
+		fflush(_out);
+	}
+
+	// DEF PerfListener
+	#ifdef __linux__
+	// Record layouts from tools/perf/Documentation/jitdump-specification.txt in the kernel tree
+	const U32 JITDUMP_MAGIC = 0x4A695444; // "JiTD"
+	const U32 JITDUMP_VERSION = 1;
+	const U32 JITDUMP_CODE_LOAD = 0;
+	const U32 JITDUMP_CODE_DEBUG_INFO = 2;
+	const U32 JITDUMP_CODE_CLOSE = 3;
+
+	struct JitDumpHeader {
+		U32 magic;
+		U32 version;
+		U32 totalSize;
+		U32 elfMachine;
+		U32 pad;
+		U32 pid;
+		U64 timestamp;
+		U64 flags;
+	};
+
+	struct JitDumpRecord {
+		U32 id;
+		U32 totalSize; // Including this header
+		U64 timestamp; // CLOCK_MONOTONIC, the clock perf record -k mono uses
+	};
+
+	// Followed by the function name, zero terminated, and the code bytes
+	struct JitDumpCodeLoad {
+		JitDumpRecord record;
+		U32 pid;
+		U32 tid;
+		U64 vma;
+		U64 codeAddress;
+		U64 codeSize;
+		U64 codeIndex;
+	};
+
+	struct JitDumpDebugInfo {
+		JitDumpRecord record;
+		U64 codeAddress;
+		U64 numEntries;
+	};
+
+	// Followed by the file name, zero terminated
+	struct JitDumpDebugEntry {
+		U64 address;
+		U32 line;
+		U32 discriminator;
+	};
+
+	#if defined (__x86_64__)
+	const U32 JITDUMP_ELF_MACHINE = 62; // EM_X86_64
+	#elif defined (__i386__)
+	const U32 JITDUMP_ELF_MACHINE = 3; // EM_386
+	#elif defined (__aarch64__)
+	const U32 JITDUMP_ELF_MACHINE = 183; // EM_AARCH64
+	#elif defined (__arm__)
+	const U32 JITDUMP_ELF_MACHINE = 40; // EM_ARM
+	#else
+	const U32 JITDUMP_ELF_MACHINE = 0;
+	#endif
+
+	// The perf map's lines, in the order written. They outlive the file's last user, since it is
+	// reopened for append and a rewrite must keep the earlier lines.
+	struct PerfCode {
+		Uword start;
+		Uword size;
+		std::string name;
+		bool freed;
+	};
+
+	// Shared by all listeners of the process, perfLock guards the rest
+	static System::Mutex perfLock;
+	static Uword perfUsers = 0;
+	static char perfMapPath[64];
+	static FILE* perfMap = nullptr;
+	static std::vector<PerfCode> perfCode;
+	static int jitDumpFd = -1;
+	static void* jitDumpMarker = nullptr;
+	static U64 jitDumpCodeIndex = 0;
+
+	static void writeJitDump(const void* data, Uword size) {
+		const U8* bytes = (const U8*)data;
+		while(size > 0) {
+			ssize_t written = write(jitDumpFd, bytes, size);
+			if(written <= 0) {
+				return;
+			}
+			bytes += written;
+			size -= written;
+		}
+	}
+
+	// Profiling is best effort: a file that cannot be created just stays empty
+	PerfListener::PerfListener() {
+		MutexLock lock(perfLock);
+		if(perfUsers++ == 0) {
+			char path[64];
+			Uword pid = SYS.processId();
+			snprintf(perfMapPath, sizeof(perfMapPath), "/tmp/perf-%lu.map", (unsigned long)pid);
+			perfMap = fopen(perfMapPath, "a");
+			snprintf(path, sizeof(path), "/tmp/jit-%lu.dump", (unsigned long)pid);
+			jitDumpFd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+			if(jitDumpFd != -1) {
+				// perf record only picks up the file from an executable mapping of it
+				jitDumpMarker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, jitDumpFd, 0);
+				if(jitDumpMarker == MAP_FAILED) {
+					jitDumpMarker = nullptr;
+				}
+				JitDumpHeader header;
+				memset(&header, 0, sizeof(header));
+				header.magic = JITDUMP_MAGIC;
+				header.version = JITDUMP_VERSION;
+				header.totalSize = sizeof(header);
+				header.elfMachine = JITDUMP_ELF_MACHINE;
+				header.pid = (U32)pid;
+				header.timestamp = SYS.nanoTimestamp();
+				writeJitDump(&header, sizeof(header));
+			}
+		}
+	}
+
+	PerfListener::~PerfListener() {
+		MutexLock lock(perfLock);
+		if(--perfUsers == 0) {
+			if(perfMap) {
+				fclose(perfMap);
+				perfMap = nullptr;
+			}
+			if(jitDumpFd != -1) {
+				JitDumpRecord record;
+				record.id = JITDUMP_CODE_CLOSE;
+				record.totalSize = sizeof(record);
+				record.timestamp = SYS.nanoTimestamp();
+				writeJitDump(&record, sizeof(record));
+				if(jitDumpMarker) {
+					munmap(jitDumpMarker, sysconf(_SC_PAGESIZE));
+					jitDumpMarker = nullptr;
+				}
+				close(jitDumpFd);
+				jitDumpFd = -1;
+			}
+		}
+	}
+
+	void PerfListener::NotifyFunctionEmitted(const llvm::Function& fn, void* code, size_t size, const EmittedFunctionDetails& details) {
+		std::string name = fn.getName().str();
+		U64 timestamp = SYS.nanoTimestamp();
+		MutexLock lock(perfLock);
+		// Freed code under the new range would claim its samples too
+		Uword start = (Uword)code;
+		bool reused = false;
+		for(Uword i = 0; i < perfCode.size(); ) {
+			PerfCode& old = perfCode[i];
+			if(old.freed && old.start < start + size && start < old.start + old.size) {
+				perfCode.erase(perfCode.begin() + i);
+				reused = true;
+			}
+			else {
+				++i;
+			}
+		}
+		PerfCode entry = { start, size, name, false };
+		perfCode.push_back(entry);
+		if(perfMap) {
+			if(reused) {
+				perfMap = freopen(perfMapPath, "w", perfMap);
+			}
+			for(Uword i = reused ? 0 : perfCode.size() - 1; perfMap && i < perfCode.size(); ++i) {
+				fprintf(perfMap, "%lx %lx %s\n", (unsigned long)perfCode[i].start, (unsigned long)perfCode[i].size, perfCode[i].name.c_str());
+			}
+			if(perfMap) {
+				fflush(perfMap);
+			}
+		}
+		if(jitDumpFd != -1) {
+			// perf inject wants the line table before the code it describes
+			writeDebugInfo(fn, code, details, timestamp);
+			JitDumpCodeLoad load;
+			load.record.id = JITDUMP_CODE_LOAD;
+			load.record.totalSize = (U32)(sizeof(load) + name.size() + 1 + size);
+			load.record.timestamp = timestamp;
+			load.pid = (U32)SYS.processId();
+			load.tid = (U32)syscall(SYS_gettid);
+			load.vma = (Uword)code;
+			load.codeAddress = (Uword)code;
+			load.codeSize = size;
+			load.codeIndex = jitDumpCodeIndex++;
+			writeJitDump(&load, sizeof(load));
+			writeJitDump(name.c_str(), name.size() + 1);
+			writeJitDump(code, size);
+		}
+	}
+
+	// The line stays until new code reuses the range, samples taken before the free still need it
+	void PerfListener::NotifyFreeingMachineCode(void* code) {
+		MutexLock lock(perfLock);
+		for(Uword i = 0; i < perfCode.size(); ++i) {
+			if(perfCode[i].start == (Uword)code && !perfCode[i].freed) {
+				perfCode[i].freed = true;
+				break;
+			}
+		}
+	}
+
+	// Called with perfLock held
+	void PerfListener::writeDebugInfo(const llvm::Function& fn, void* code, const EmittedFunctionDetails& details, U64 timestamp) {
+		std::vector<JitDumpDebugEntry> entries;
+		std::vector<std::string> files;
+		Uword size = sizeof(JitDumpDebugInfo);
+		for(Uword i = 0; i < details.LineStarts.size(); ++i) {
+			const llvm::DebugLoc& loc = details.LineStarts[i].Loc;
+			if(loc.isUnknown()) {
+				continue;
+			}
+			llvm::DIScope scope(loc.getScope(fn.getContext()));
+			std::string file = scope.getFilename().str();
+			std::string dir = scope.getDirectory().str();
+			if(!dir.empty() && (file.empty() || file[0] != '/')) {
+				file = dir + "/" + file;
+			}
+			JitDumpDebugEntry entry;
+			entry.address = details.LineStarts[i].Address;
+			entry.line = loc.getLine();
+			entry.discriminator = 0;
+			entries.push_back(entry);
+			files.push_back(file);
+			size += sizeof(entry) + file.size() + 1;
+		}
+		if(entries.empty()) {
+			return;
+		}
+		JitDumpDebugInfo info;
+		info.record.id = JITDUMP_CODE_DEBUG_INFO;
+		info.record.totalSize = (U32)size;
+		info.record.timestamp = timestamp;
+		info.codeAddress = (Uword)code;
+		info.numEntries = entries.size();
+		writeJitDump(&info, sizeof(info));
+		for(Uword i = 0; i < entries.size(); ++i) {
+			writeJitDump(&entries[i], sizeof(entries[i]));
+			writeJitDump(files[i].c_str(), files[i].size() + 1);
+		}
+	}
+	#endif
+
+	// DEF Runtime
+	static volatile Uword didLLVMInit = False;
+	static volatile Uword doingLLVMInit = False;
+	static volatile Uword lastRuntimeId = 0;
+
+	// Native TLS cache in front of Runtime::_currentContext. Looking up the current context is
+	// then a compare and a load instead of a TlsGetValue/pthread_getspecific call. The runtime
+	// id rather than its address guards the cache, so a new Runtime at a recycled address
+	// cannot pick up a stale Context.
+	static OCT_THREAD_LOCAL Uword cachedRuntimeId = 0;
+	static OCT_THREAD_LOCAL Context* cachedContext = nullptr;
+
+	Runtime::Runtime(Uword flags): _jitModule(nullptr), _ee(nullptr), _perf(nullptr), _markGeneration(0), _epoch(0) {
+		do {
+			_id = SYS.atomicGetUword(&lastRuntimeId) + 1;
+		} while(!SYS.atomicCompareExchangeUword(&lastRuntimeId, _id - 1, _id));
+
+		if(SYS.atomicCompareExchangeUword(&doingLLVMInit, False, True)) {
+			bool result = true;
+			if(!SYS.atomicGetUword(&didLLVMInit)) {
+				result = !llvm::InitializeNativeTarget() && !llvm::InitializeNativeTargetAsmPrinter();
+				addSimdSymbols();
+				addBuiltinTypeSymbols();
+				SYS.atomicSetUword(&didLLVMInit, True);
+			}
+			SYS.atomicSetUword(&doingLLVMInit, False);
+			if(!result) {
+				throw Exception(Exception::JIT, "could not initialize the native target");
+			}
+		}
+		else {
+			// Someone else is doing LLVM init, wait for them to complete
+			while(SYS.atomicGetUword(&doingLLVMInit)) {
+				SYS.sleep(0);
+			}
+		}
+		// Init LLVM
+		// Use placement new and allocate in exchange heap?
+		if(!(flags & RUNTIME_NO_JIT)) {
+			_jitModule = new llvm::Module("JITModule", _llvmContext);
+			llvm::TargetOptions options;
+		#ifndef _WIN32
+			// Emit DWARF unwind tables for JITed code and let the JIT register them with the
+			// unwinder, so an Exception unwinds through generated frames like through C++ ones
+			options.JITExceptionHandling = true;
+		#endif
+			// The JIT emits DWARF for each function and hands it to GDB's JIT interface
+			// (__jit_debug_register_code), so breakpoints and backtraces see generated code
+			options.JITEmitDebugInfo = (flags & RUNTIME_GDB_JIT) != 0;
+			std::string error;
+			_ee = llvm::EngineBuilder(_jitModule)
+				.setEngineKind(llvm::EngineKind::JIT)
+				.setErrorStr(&error)
+				.setTargetOptions(options)
+				.create();
+			if(!_ee) {
+				throw Exception(Exception::JIT, "could not create the JIT compiler, unsupported platform?");
+			}
+		#ifdef __linux__
+			if(flags & RUNTIME_PERF_MAP) {
+				_perf = new PerfListener();
+				_ee->RegisterJITEventListener(_perf);
+			}
+		#endif
+		}
+
+		// Create octarine namespace and the main thread context
+		Owned<Namespace> octNs = _exchangeHeap.alloc<Namespace>(nullptr);
+		Context* mainCtx = new Context(this, octNs.obj);
+		octNs->ctor(mainCtx);
+		octNs->name = String::createFromCString(mainCtx, "octarine");
+		_namespaces.ctor(mainCtx);
+		_namespaces.put(mainCtx, octNs->name, octNs);
+		_contexts.push_back(mainCtx);
+		setCurrentContext(mainCtx);
+	}
+	
+	Runtime::~Runtime() {
+		// delete all contexts
+		std::vector<Context*>::iterator ci;
+		for(ci = _contexts.begin(); ci != _contexts.end(); ++ci) {
+			delete (*ci);
+		}
+		// delete all namespaces, through a context of their own as the others are gone
+		{
+			Context ctx(this, nullptr);
+			Array< HashtableEntry< HashtableKey<String>, Owned<Namespace> > >* namespaces = _namespaces.entries.obj;
+			for(Uword i = 0; i < namespaces->size; ++i) {
+				if(namespaces->data[i].key.hasValue()) {
+					Namespace* ns = namespaces->data[i].val.obj;
+					ns->dtor(&ctx);
+					_exchangeHeap.free(ns->name.data.obj);
+					_exchangeHeap.free(ns);
+				}
+			}
+			_namespaces.dtor(&ctx);
+		}
+		// delete LLVM execution engine; this also deletes the JIT module
+		delete _ee;
+		// after the engine, which notifies listeners while freeing machine code
+		delete _perf;
+		// native code goes last, the namespaces pointed into its static data
+		std::vector<NativeLibrary>::iterator li;
+		for(li = _libraries.begin(); li != _libraries.end(); ++li) {
+			SYS.unloadLibrary(li->handle);
+		}
+		std::vector<Image*>::iterator ii;
+		for(ii = _images.begin(); ii != _images.end(); ++ii) {
+			delete *ii;
+		}
+	}
+	
+	ExchangeHeap& Runtime::getExchangeHeap() {
+		return _exchangeHeap;
+	}
+
+	Tracer& Runtime::getTracer() {
+		return _tracer;
+	}
+
+	SymbolTable& Runtime::getSymbols() {
+		return _symbols;
+	}
+
+	Context* Runtime::getCurrentContext() {
+		if(cachedRuntimeId == _id) {
+			return cachedContext;
+		}
+		// First lookup on this thread, or the thread last used another runtime
+		Context* ctx = _currentContext.get();
+		cachedRuntimeId = _id;
+		cachedContext = ctx;
+		return ctx;
+	}
+
+	void Runtime::setCurrentContext(Context* ctx) {
+		_currentContext.set(ctx);
+		cachedRuntimeId = _id;
+		cachedContext = ctx;
+	}
+
+	Context* Runtime::createContext(Namespace* ns) {
+		Context* ctx = new Context(this, ns);
+		MutexLock lock(_contextsLock);
+		_contexts.push_back(ctx);
+		return ctx;
+	}
+
+	// Other contexts may still read what ctx retired, so that is waited for instead of freed
+	void Runtime::destroyContext(Context* ctx) {
+		{
+			MutexLock lock(_contextsLock);
+			std::vector<Context*>::iterator ci;
+			for(ci = _contexts.begin(); ci != _contexts.end(); ++ci) {
+				if(*ci == ctx) {
+					_contexts.erase(ci);
+					break;
+				}
+			}
+		}
+		ctx->drain();
+		delete ctx;
+	}
+
+	Uword Runtime::getEpoch() {
+		return SYS.atomicGetUword(&_epoch);
+	}
+
+	// The global epoch can move on once every context inside a read section has seen the
+	// current one. Anything retired two epochs ago is then unreachable for all readers.
+	bool Runtime::tryAdvanceEpoch() {
+		Uword epoch = getEpoch();
+		MutexLock lock(_contextsLock);
+		std::vector<Context*>::iterator ci;
+		for(ci = _contexts.begin(); ci != _contexts.end(); ++ci) {
+			Uword state = (*ci)->getEpochState();
+			if((state & 1) && (state >> 1) != epoch) {
+				return false;
+			}
+		}
+		return SYS.atomicCompareExchangeUword(&_epoch, epoch, epoch + 1);
+	}
+
+	llvm::ExecutionEngine* Runtime::getEngine() {
+		if(!_ee) {
+			throw Exception(Exception::JIT, "the runtime was created without a JIT");
+		}
+		return _ee;
+	}
+
+	llvm::Module* Runtime::createModule(const char* name) {
+		llvm::ExecutionEngine* ee = getEngine();
+		llvm::Module* module = new llvm::Module(name, _llvmContext);
+		module->setDataLayout(ee->getTargetData()->getStringRepresentation());
+		return module;
+	}
+
+	static void freeRetiredModule(Context* ctx, void* obj) {
+		ctx->getRuntime()->releaseModule((llvm::Module*)obj);
+	}
+
+	// Called after the cell's module changed, so cached frame entries into the old code are dropped
+	static void bumpCodeVersion(NamespaceCell* cell) {
+		Uword v;
+		do {
+			v = SYS.atomicGetUword(&cell->codeVersion);
+		} while(!SYS.atomicCompareExchangeUword(&cell->codeVersion, v, v + 1));
+	}
+
+	// The replaced module is retired rather than freed, so a thread still running its code
+	// inside a read section finishes before the machine code goes away.
+	void Runtime::installModule(Context* ctx, NamespaceCell* cell, llvm::Module* module) {
+		llvm::ExecutionEngine* ee = getEngine();
+		{
+			MutexLock lock(_engineLock);
+			ee->addModule(module);
+		}
+		if(!cell) {
+			return;
+		}
+		llvm::Module* old = cell->module;
+		cell->module = module;
+		cell->frameEntry = nullptr;
+		bumpCodeVersion(cell);
+		if(old) {
+			retireModule(ctx, old);
+		}
+	}
+
+	void Runtime::retireModule(Context* ctx, llvm::Module* module) {
+		ctx->retire(module, freeRetiredModule);
+	}
+
+	// Runs on whichever context reclaims the module, concurrently with compiles elsewhere
+	void Runtime::releaseModule(llvm::Module* module) {
+		MutexLock lock(_engineLock);
+		for(llvm::Module::iterator fi = module->begin(); fi != module->end(); ++fi) {
+			if(!fi->isDeclaration()) {
+				_ee->freeMachineCodeForFunction(&*fi);
+			}
+		}
+		_ee->removeModule(module);
+		delete module;
+	}
+
+	// The -O3 module pipeline runs the inliner, IPSCCP and global DCE across all functions of
+	// the module. Emitters give their helpers internal linkage so those can be dropped once
+	// inlined; the final global DCE catches what the inliner left unreferenced.
+	void Runtime::optimizeModule(llvm::Module* module) {
+		llvm::PassManagerBuilder builder;
+		builder.OptLevel = 3;
+		builder.Inliner = llvm::createFunctionInliningPass(275);
+		llvm::PassManager passes;
+		passes.add(new llvm::TargetData(*getEngine()->getTargetData()));
+		builder.populateModulePassManager(passes);
+		passes.add(llvm::createGlobalDCEPass());
+		OCT_TRACE_EVENT(getCurrentContext(), TRACE_JIT_OPTIMIZE, TRACE_BEGIN, 0, 0);
+		passes.run(*module);
+		OCT_TRACE_EVENT(getCurrentContext(), TRACE_JIT_OPTIMIZE, TRACE_END, 0, 0);
+	}
+
+	void* Runtime::getPointerToFunction(llvm::Function* fn) {
+		llvm::ExecutionEngine* ee = getEngine();
+		MutexLock lock(_engineLock);
+		return ee->getPointerToFunction(fn);
+	}
+
+	// Dependency edges cross namespaces, so one lock covers the graph and the code of all of them
+	System::Mutex& Runtime::getCompileLock() {
+		return _compileLock;
+	}
+
+	Uword Runtime::nextMarkGeneration() {
+		return ++_markGeneration;
+	}
+
+	// Generic CPU, the objects are meant to be shipped to other machines
+	void Runtime::emitObjectFile(llvm::Module* module, const char* path) {
+		std::string error;
+		std::string triple = llvm::sys::getDefaultTargetTriple();
+		const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+		if(!target) {
+			throw Exception(Exception::JIT, "no code generator for the host");
+		}
+		llvm::TargetOptions options;
+		llvm::TargetMachine* machine = target->createTargetMachine(triple, "", "", options,
+			llvm::Reloc::PIC_, llvm::CodeModel::Default, llvm::CodeGenOpt::Aggressive);
+		if(!machine) {
+			throw Exception(Exception::JIT, "could not create the target machine");
+		}
+		module->setTargetTriple(triple);
+		module->setDataLayout(machine->getTargetData()->getStringRepresentation());
+		bool failed;
+		{
+			llvm::raw_fd_ostream file(path, error, llvm::raw_fd_ostream::F_Binary);
+			if(!error.empty()) {
+				delete machine;
+				throw Exception(Exception::IO, "could not create the object file");
+			}
+			llvm::formatted_raw_ostream out(file);
+			llvm::PassManager passes;
+			passes.add(new llvm::TargetData(*machine->getTargetData()));
+			failed = machine->addPassesToEmitFile(passes, out, llvm::TargetMachine::CGFT_ObjectFile);
+			if(!failed) {
+				OCT_TRACE_EVENT(getCurrentContext(), TRACE_JIT_EMIT_OBJECT, TRACE_BEGIN, 0, 0);
+				passes.run(*module);
+				OCT_TRACE_EVENT(getCurrentContext(), TRACE_JIT_EMIT_OBJECT, TRACE_END, 0, 0);
+			}
+		}
+		delete machine;
+		if(failed) {
+			throw Exception(Exception::JIT, "the target cannot emit object files");
+		}
+	}
+
+	// Laid out exactly like Type and TypeField, so compiled code and the runtime read the
+	// descriptors in place. They are named after the type, never its address, so every module
+	// and process agrees on them. Builtins are only declared and resolve to the runtime's own
+	// instances; other types get one descriptor per module, merged by the linker per library.
+	llvm::Constant* Runtime::emitType(llvm::Module* module, Type* type) {
+		if(!type->name) {
+			throw Exception(Exception::BAD_ARGUMENT, "only named types can be emitted");
+		}
+		Type* builtin = findBuiltinType(type->name);
+		std::string name = std::string(builtin ? "oct_type_" : "oct.type.") + type->name;
+		llvm::GlobalVariable* existing = module->getNamedGlobal(name);
+		if(existing) {
+			return existing;
+		}
+		llvm::IntegerType* word = llvm::IntegerType::get(_llvmContext, sizeof(Uword) * 8);
+		llvm::StructType* typeType = module->getTypeByName("oct.Type");
+		llvm::StructType* fieldType = module->getTypeByName("oct.TypeField");
+		if(!typeType) {
+			typeType = llvm::StructType::create(_llvmContext, "oct.Type");
+			fieldType = llvm::StructType::create(_llvmContext, "oct.TypeField");
+			llvm::Type* fieldMembers[] = { llvm::PointerType::getUnqual(typeType), word };
+			fieldType->setBody(fieldMembers);
+			llvm::Type* typeMembers[] = { word, word, word, llvm::PointerType::getUnqual(fieldType), llvm::Type::getInt8PtrTy(_llvmContext) };
+			typeType->setBody(typeMembers);
+		}
+		if(builtin) {
+			if(type != builtin && (type->size != builtin->size || type->alignment != builtin->alignment || type->numFields)) {
+				throw Exception(Exception::BAD_ARGUMENT, "the type redefines a builtin");
+			}
+			return new llvm::GlobalVariable(*module, typeType, true, llvm::GlobalValue::ExternalLinkage, nullptr, name);
+		}
+
+		llvm::Constant* fields = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(fieldType));
+		llvm::Constant* first[] = { llvm::ConstantInt::get(word, 0), llvm::ConstantInt::get(word, 0) };
+		if(type->numFields) {
+			std::vector<llvm::Constant*> entries;
+			for(Uword i = 0; i < type->numFields; ++i) {
+				llvm::Constant* members[] = {
+					emitType(module, type->fields[i].type),
+					llvm::ConstantInt::get(word, type->fields[i].offset)
+				};
+				entries.push_back(llvm::ConstantStruct::get(fieldType, members));
+			}
+			llvm::ArrayType* arrayType = llvm::ArrayType::get(fieldType, type->numFields);
+			llvm::GlobalVariable* array = new llvm::GlobalVariable(*module, arrayType, true,
+				llvm::GlobalValue::PrivateLinkage, llvm::ConstantArray::get(arrayType, entries), "oct.fields");
+			fields = llvm::ConstantExpr::getGetElementPtr(array, first);
+		}
+		llvm::Constant* nameData = llvm::ConstantDataArray::getString(_llvmContext, type->name);
+		llvm::GlobalVariable* nameString = new llvm::GlobalVariable(*module, nameData->getType(), true,
+			llvm::GlobalValue::PrivateLinkage, nameData, "oct.typename");
+		llvm::Constant* members[] = {
+			llvm::ConstantInt::get(word, type->size),
+			llvm::ConstantInt::get(word, type->alignment),
+			llvm::ConstantInt::get(word, type->numFields),
+			fields,
+			llvm::ConstantExpr::getGetElementPtr(nameString, first)
+		};
+		llvm::GlobalVariable* descriptor = new llvm::GlobalVariable(*module, typeType, true,
+			llvm::GlobalValue::LinkOnceODRLinkage, llvm::ConstantStruct::get(typeType, members), name);
+		descriptor->setVisibility(llvm::GlobalValue::HiddenVisibility);
+		return descriptor;
+	}
+
+	// Laid out like the protocol VTables, the type descriptor followed by the functions in the
+	// order of the protocol's Functions struct. Merged per library like the descriptors.
+	llvm::Constant* Runtime::emitVTable(llvm::Module* module, const char* protocol, Type* type, llvm::Function** fns, Uword numFns) {
+		llvm::Constant* descriptor = emitType(module, type);
+		std::string name = std::string("oct.vtable.") + protocol + "." + type->name;
+		llvm::GlobalVariable* existing = module->getNamedGlobal(name);
+		if(existing) {
+			return existing;
+		}
+		std::vector<llvm::Type*> memberTypes;
+		std::vector<llvm::Constant*> members;
+		memberTypes.push_back(descriptor->getType());
+		members.push_back(descriptor);
+		for(Uword i = 0; i < numFns; ++i) {
+			memberTypes.push_back(fns[i]->getType());
+			members.push_back(fns[i]);
+		}
+		llvm::StructType* vtableType = llvm::StructType::get(_llvmContext, memberTypes);
+		llvm::GlobalVariable* vtable = new llvm::GlobalVariable(*module, vtableType, true,
+			llvm::GlobalValue::LinkOnceODRLinkage, llvm::ConstantStruct::get(vtableType, members), name);
+		vtable->setVisibility(llvm::GlobalValue::HiddenVisibility);
+		return vtable;
+	}
+
+	// JIT code first, then native libraries. Call inside a read section, the module may be
+	// retired by a concurrent redefinition.
+	FrameEntry Runtime::findFrameEntry(Namespace* ns, NamespaceCell* cell, const char* name) {
+		FrameEntry published = cell->frameEntry;
+		if(published) {
+			return published;
+		}
+		// The modules and the library list change under the compile lock, the slow path takes it
+		MutexLock lock(_compileLock);
+		std::string symbol = std::string(FRAME_ENTRY_PREFIX) + name;
+		llvm::Module* module = cell->module ? cell->module : ns->batchModule;
+		if(module && _ee) {
+			llvm::Function* fn = module->getFunction(symbol);
+			if(fn) {
+				return (FrameEntry)getPointerToFunction(fn);
+			}
+		}
+		// Another namespace's library may export a definition of the same name
+		std::vector<NativeLibrary>::iterator li;
+		for(li = _libraries.begin(); li != _libraries.end(); ++li) {
+			if(li->ns != ns) {
+				continue;
+			}
+			void* entry = SYS.findSymbol(li->handle, symbol.c_str());
+			if(entry) {
+				return (FrameEntry)entry;
+			}
+		}
+		return nullptr;
+	}
+
+	// Works without a JIT. The library stays loaded for the lifetime of the runtime.
+	void Runtime::loadNative(Context* ctx, Namespace* ns, const char* path) {
+		void* library = SYS.loadLibrary(path);
+		if(!library) {
+			throw Exception(Exception::IO, "could not load the native library");
+		}
+		NativeInit init = (NativeInit)SYS.findSymbol(library, NATIVE_INIT_SYMBOL);
+		if(!init) {
+			SYS.unloadLibrary(library);
+			throw Exception(Exception::BAD_IMAGE, "the library has no octarine entry point");
+		}
+		NativeLibrary native = { ns, library };
+		{
+			MutexLock lock(_compileLock);
+			try {
+				_libraries.push_back(native);
+			}
+			catch(...) {
+				SYS.unloadLibrary(library);
+				throw;
+			}
+		}
+		init(ctx, ns);
+	}
+
+	// Objects in the image may be bound into namespaces, so it stays mapped until they are gone
+	void* Runtime::mapImage(const char* path) {
+		Image* image = new Image(path);
+		MutexLock lock(_compileLock); // Like _namespaces, _images changes under the compile lock
+		_images.push_back(image);
+		return image->getRoot();
+	}
+
+	// Values made only of builtins can be copied byte for byte into an image
+	static bool isPlainData(Type* type, Uword depth) {
+		if(!type || depth > TYPE_MAX_DEPTH) {
+			return false;
+		}
+		if(type->numFields == 0) {
+			return type->name && findBuiltinType(type->name);
+		}
+		for(Uword f = 0; f < type->numFields; ++f) {
+			if(!isPlainData(type->fields[f].type, depth + 1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	Uword Runtime::writeImage(Context* ctx, const char* path) {
+		ImageWriter writer;
+		Uword skipped = 0;
+		Uword rootOffset = writer.reserve(sizeof(ImageRuntime));
+		MutexLock lock(_compileLock);
+		std::vector<Namespace*> namespaces;
+		Array< HashtableEntry< HashtableKey<String>, Owned<Namespace> > >* entries = _namespaces.entries.obj;
+		for(Uword i = 0; i < entries->size; ++i) {
+			if(entries->data[i].key.hasValue()) {
+				namespaces.push_back(entries->data[i].val.obj);
+			}
+		}
+		Uword namespacesOffset = writer.reserve(sizeof(ImageNamespace) * namespaces.size());
+		for(Uword n = 0; n < namespaces.size(); ++n) {
+			Namespace* ns = namespaces[n];
+			Uword nsOffset = namespacesOffset + sizeof(ImageNamespace) * n;
+			writer.writePointer(nsOffset + offsetof(ImageNamespace, name), writer.writeString(ns->name));
+			ReadSection section(ctx);
+			NamespaceBindings* bindings = (NamespaceBindings*)SYS.atomicGetUword((volatile Uword*)&ns->bindings);
+			Array<NamespaceBindings::Entry>* slots = bindings->entries.obj;
+			Uword bindingsOffset = writer.reserve(sizeof(ImageBinding) * bindings->count);
+			Uword numBindings = 0;
+			for(Uword i = 0; i < slots->size; ++i) {
+				if(!slots->data[i].key.hasValue()) {
+					continue;
+				}
+				Uword bindingOffset = bindingsOffset + sizeof(ImageBinding) * numBindings++;
+				writer.writePointer(bindingOffset + offsetof(ImageBinding, name), writer.writeString(*slots->data[i].key.value.self));
+				NamespaceEntry* entry = (NamespaceEntry*)SYS.atomicGetUword((volatile Uword*)&slots->data[i].val->entry);
+				if(!entry || entry->isNothing()) {
+					continue;
+				}
+				Object<Unknown> obj = entry->isOwned() ? entry->getOwnedObject().obj : entry->getConstantObject().obj;
+				Type* type = obj.vtable ? obj.vtable->type : nullptr;
+				if(!isPlainData(type, 0)) {
+					++skipped;
+					continue;
+				}
+				writer.writePointer(bindingOffset + offsetof(ImageBinding, object), writer.writeObject(type, obj.self));
+				writer.writePointer(bindingOffset + offsetof(ImageBinding, vtable), writer.writeObjectVTable(type));
+			}
+			((ImageNamespace*)writer.at(nsOffset))->numBindings = numBindings;
+			writer.writePointer(nsOffset + offsetof(ImageNamespace, bindings), bindingsOffset);
+		}
+		std::vector<Symbol*> symbols;
+		_symbols.collect(&symbols);
+		Uword symbolsOffset = writer.reserve(sizeof(String*) * symbols.size());
+		for(Uword i = 0; i < symbols.size(); ++i) {
+			// Symbols do not count codepoints, like createFromCString the bytes stand in
+			writer.writePointer(symbolsOffset + sizeof(String*) * i, writer.writeString(symbols[i]->name, symbols[i]->length + 1, symbols[i]->length));
+		}
+		ImageRuntime* root = (ImageRuntime*)writer.at(rootOffset);
+		root->magic = IMAGE_RUNTIME_MAGIC;
+		root->numNamespaces = namespaces.size();
+		root->numSymbols = symbols.size();
+		writer.writePointer(rootOffset + offsetof(ImageRuntime, namespaces), namespacesOffset);
+		writer.writePointer(rootOffset + offsetof(ImageRuntime, symbols), symbolsOffset);
+		writer.save(path, rootOffset);
+		return skipped;
+	}
+
+	// Image objects are constants in mapped memory, there is nothing to free or mark
+	static void imageObjectNothing(Context* ctx, Borrowed<Unknown> self) {
+	}
+
+	static bool isImageString(Image* image, String* str) {
+		if(!image->contains(str, 1, sizeof(String))) {
+			return false;
+		}
+		Array<U8>* data = str->data.obj;
+		return image->contains(data, 1, sizeof(Array<U8>))
+			&& data->size > 0
+			&& image->contains(&data->data[0], data->size, 1)
+			&& data->data[data->size - 1] == '\0';
+	}
+
+	static bool isImageType(Image* image, Type* type, Uword depth) {
+		if(depth > TYPE_MAX_DEPTH || !image->contains(type, 1, sizeof(Type))) {
+			return false;
+		}
+		if(!type->name || !image->containsCString(type->name) || (type->alignment & (type->alignment - 1))) {
+			return false;
+		}
+		if(!type->numFields) {
+			return true;
+		}
+		if(!image->contains(type->fields, type->numFields, sizeof(TypeField))) {
+			return false;
+		}
+		for(Uword f = 0; f < type->numFields; ++f) {
+			if(!isImageType(image, type->fields[f].type, depth + 1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The file is untrusted, every pointer is checked before it is followed
+	static bool isImageRuntime(Image* image, ImageRuntime* root) {
+		if(!image->contains(root, 1, sizeof(ImageRuntime))
+			|| root->magic != IMAGE_RUNTIME_MAGIC
+			|| !image->contains(root->namespaces, root->numNamespaces, sizeof(ImageNamespace))
+			|| !image->contains(root->symbols, root->numSymbols, sizeof(String*))) {
+			return false;
+		}
+		for(Uword n = 0; n < root->numNamespaces; ++n) {
+			ImageNamespace* ns = &root->namespaces[n];
+			if(!isImageString(image, ns->name) || !image->contains(ns->bindings, ns->numBindings, sizeof(ImageBinding))) {
+				return false;
+			}
+			for(Uword b = 0; b < ns->numBindings; ++b) {
+				ImageBinding* binding = &ns->bindings[b];
+				if(!isImageString(image, binding->name)) {
+					return false;
+				}
+				if(!binding->object) {
+					continue;
+				}
+				if(!image->contains(binding->vtable, 1, sizeof(ObjectVTable<Unknown>))
+					|| !isImageType(image, binding->vtable->type, 0)
+					|| !isPlainData(binding->vtable->type, 0)
+					|| !image->contains(binding->object, binding->vtable->type->size ? 1 : 0, binding->vtable->type->size)
+					|| ((Uword)binding->object & NamespaceEntry::VARIANT_MASK)) {
+					return false;
+				}
+			}
+		}
+		for(Uword i = 0; i < root->numSymbols; ++i) {
+			if(!isImageString(image, root->symbols[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Every name of the image is interned and those with a value defined to it, replacing the
+	// current one. The values are constants pointing into the mapping, which stays mapped for
+	// the lifetime of the runtime.
+	Uword Runtime::restoreImage(Context* ctx, const char* path) {
+		Image* image = new Image(path);
+		if(!isImageRuntime(image, (ImageRuntime*)image->getRoot())) {
+			delete image;
+			throw Exception(Exception::BAD_IMAGE, "not a runtime image");
+		}
+		ImageRuntime* root = (ImageRuntime*)image->getRoot();
+		MutexLock lock(_compileLock);
+		_images.push_back(image);
+		Uword bound = 0;
+		for(Uword n = 0; n < root->numNamespaces; ++n) {
+			ImageNamespace* imageNs = &root->namespaces[n];
+			Namespace* ns;
+			Option< Owned<Namespace> > found = _namespaces.get(ctx, *imageNs->name);
+			if(found.hasValue()) {
+				ns = found.value.obj;
+			}
+			else {
+				Owned<Namespace> owned = _exchangeHeap.alloc<Namespace>(ctx);
+				ns = owned.obj;
+				ns->ctor(ctx);
+				HashtableKeyTraits<String>::copy(ctx, &ns->name, *imageNs->name);
+				try {
+					_namespaces.put(ctx, ns->name, owned);
+				}
+				catch(...) {
+					ns->dtor(ctx);
+					_exchangeHeap.free(ns->name.data.obj);
+					_exchangeHeap.free(ns);
+					throw;
+				}
+			}
+			std::vector<String> keys;
+			std::vector<NamespaceEntry> values;
+			for(Uword b = 0; b < imageNs->numBindings; ++b) {
+				ImageBinding* binding = &imageNs->bindings[b];
+				keys.push_back(*binding->name);
+				if(!binding->object) {
+					values.push_back(NamespaceEntry());
+					continue;
+				}
+				// Compare first, a vtable already patched keeps its page shared with the file
+				ObjectVTable<Unknown>* vtable = binding->vtable;
+				if(vtable->fns.dtor != imageObjectNothing || vtable->fns.gc_mark != imageObjectNothing) {
+					vtable->fns.dtor = imageObjectNothing;
+					vtable->fns.gc_mark = imageObjectNothing;
+				}
+				Constant< Object<Unknown> > obj;
+				obj.obj.self = (Unknown*)binding->object;
+				obj.obj.vtable = vtable;
+				values.push_back(NamespaceEntry(obj));
+				++bound;
+			}
+			if(!keys.empty()) {
+				ns->defineAll(ctx, &keys[0], &values[0], keys.size());
+			}
+		}
+		for(Uword i = 0; i < root->numSymbols; ++i) {
+			Array<U8>* data = root->symbols[i]->data.obj;
+			_symbols.intern(&data->data[0], data->size - 1);
+		}
+		return bound;
+	}
+
+	// DEF NamespaceEntry
+	static_assert(sizeof(NamespaceEntry) == 2 * sizeof(Uword), "NamespaceEntry must stay two words");
+
+	NamespaceEntry::NamespaceEntry(Owned< Object<Unknown> > obj) {
+		assert((((Uword)obj.obj.self) & VARIANT_MASK) == 0 && "Misaligned object in namespace");
+		taggedSelf = ((Uword)obj.obj.self) | OWNED_OBJECT;
+		vtable = obj.obj.vtable;
+	}
+
+	NamespaceEntry::NamespaceEntry(Constant< Object<Unknown> > obj) {
+		assert((((Uword)obj.obj.self) & VARIANT_MASK) == 0 && "Misaligned object in namespace");
+		taggedSelf = ((Uword)obj.obj.self) | CONSTANT_OBJECT;
+		vtable = obj.obj.vtable;
+	}
+
+	bool NamespaceEntry::isNothing() {
+		return getVariant() == NOTHING;
+	}
+
+	bool NamespaceEntry::isOwned() {
+		return getVariant() == OWNED_OBJECT;
+	}
+
+	bool NamespaceEntry::isConstant() {
+		return getVariant() == CONSTANT_OBJECT;
+	}
+
+	NamespaceEntry::Variant NamespaceEntry::getVariant() {
+		return (Variant)(taggedSelf & VARIANT_MASK);
+	}
+
+	Owned< Object<Unknown> > NamespaceEntry::getOwnedObject() {
+		Owned< Object<Unknown> > ret;
+		ret.obj.self = (Unknown*)(taggedSelf & ~VARIANT_MASK);
+		ret.obj.vtable = vtable;
+		return ret;
+	}
+
+	Constant< Object<Unknown> > NamespaceEntry::getConstantObject() {
+		Constant< Object<Unknown> > ret;
+		ret.obj.self = (Unknown*)(taggedSelf & ~VARIANT_MASK);
+		ret.obj.vtable = vtable;
+		return ret;
+	}
+
+	void NamespaceEntry::dtor(Context* ctx) {
+		if(isOwned()) {
+			getOwnedObject().dtor(ctx);
+		}
+	}
+
+	// DEF Namespace
+	static NamespaceBindings* newBindings(Context* ctx, NamespaceBindings* from) {
+		NamespaceBindings* table = ctx->getRuntime()->getExchangeHeap().alloc<NamespaceBindings>(ctx).obj;
+		if(from) {
+			table->ctor(ctx, from);
+		}
+		else {
+			table->ctor(ctx);
+		}
+		return table;
+	}
+
+	// Only frees the table itself, the cells and keys are shared with the newer version
+	static void freeBindings(Context* ctx, void* obj) {
+		NamespaceBindings* table = (NamespaceBindings*)obj;
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		heap.free(table->entries.obj);
+		heap.free(table);
+	}
+
+	// An owned value dies with the entry that held it, constants belong to someone else
+	static void freeNamespaceEntry(Context* ctx, void* obj) {
+		NamespaceEntry* entry = (NamespaceEntry*)obj;
+		entry->dtor(ctx);
+		ctx->getRuntime()->getExchangeHeap().free(entry);
+	}
+
+	void Namespace::ctor(Context* ctx) {
+		bindings = newBindings(ctx, nullptr);
+		version = 0;
+		batchModule = nullptr;
+	}
+
+	void Namespace::dtor(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		Array< HashtableEntry< HashtableKey<String>, NamespaceCell* > >* entries = bindings->entries.obj;
+		for(Uword i = 0; i < entries->size; ++i) {
+			if(entries->data[i].key.hasValue()) {
+				NamespaceCell* cell = entries->data[i].val;
+				if(cell->entry) {
+					freeNamespaceEntry(ctx, cell->entry);
+				}
+				// The module belongs to the execution engine, which deletes it with the runtime
+				cell->dependencies.dtor(ctx);
+				cell->dependents.dtor(ctx);
+				heap.free(cell);
+			}
+		}
+		bindings->dtor(ctx);
+		heap.free(bindings);
+	}
+
+	NamespaceCell* Namespace::getCell(Context* ctx, String key) {
+		ReadSection section(ctx);
+		NamespaceBindings* table = (NamespaceBindings*)SYS.atomicGetUword((volatile Uword*)&bindings);
+		Option<NamespaceCell*> cell = table->get(ctx, key);
+		return cell.hasValue() ? cell.value : nullptr;
+	}
+
+	static NamespaceCell* newCell(Context* ctx) {
+		NamespaceCell* cell = ctx->getRuntime()->getExchangeHeap().alloc<NamespaceCell>(ctx).obj;
+		cell->entry = nullptr;
+		cell->version = 0;
+		cell->module = nullptr;
+		cell->dependencies.ctor(ctx);
+		cell->dependents.ctor(ctx);
+		cell->mark = 0;
+		cell->codeVersion = 0;
+		cell->frameEntry = nullptr;
+		return cell;
+	}
+
+	// For a table that lost the race to be published: the copy of key that put made belongs
+	// to that table alone
+	static void freeKeyCopy(Context* ctx, NamespaceBindings* table, String key) {
+		String* copy = NamespaceBindings::find(ctx, table->entries.obj, key)->key.value.self;
+		HashtableKeyTraits<String>::free(ctx, copy);
+		ctx->getRuntime()->getExchangeHeap().free(copy);
+	}
+
+	static void publishEntry(Context* ctx, NamespaceCell* cell, NamespaceEntry value) {
+		NamespaceEntry* entry = ctx->getRuntime()->getExchangeHeap().alloc<NamespaceEntry>(ctx).obj;
+		*entry = value;
+		NamespaceEntry* old;
+		do {
+			old = (NamespaceEntry*)SYS.atomicGetUword((volatile Uword*)&cell->entry);
+		} while(!SYS.atomicCompareExchangeUword((volatile Uword*)&cell->entry, (Uword)old, (Uword)entry));
+		Uword v;
+		do {
+			v = SYS.atomicGetUword(&cell->version);
+		} while(!SYS.atomicCompareExchangeUword(&cell->version, v, v + 1));
+		if(old) {
+			ctx->retire(old, freeNamespaceEntry);
+		}
+	}
+
+	NamespaceCell* Namespace::intern(Context* ctx, String key) {
+		NamespaceCell* cell = getCell(ctx, key);
+		if(cell) {
+			return cell;
+		}
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		cell = newCell(ctx);
+		while(true) {
+			// Staying in the read section until after the CAS keeps current alive, so its
+			// address cannot be reused by a newer table while we compare against it
+			ReadSection section(ctx);
+			NamespaceBindings* current = (NamespaceBindings*)SYS.atomicGetUword((volatile Uword*)&bindings);
+			Option<NamespaceCell*> existing = current->get(ctx, key);
+			if(existing.hasValue()) {
+				// Another writer added the name since we looked
+				heap.free(cell);
+				return existing.value;
+			}
+			NamespaceBindings* next = nullptr;
+			try {
+				next = newBindings(ctx, current);
+				next->put(ctx, key, cell);
+			}
+			catch(...) {
+				if(next) {
+					freeBindings(ctx, next);
+				}
+				heap.free(cell);
+				throw;
+			}
+			if(SYS.atomicCompareExchangeUword((volatile Uword*)&bindings, (Uword)current, (Uword)next)) {
+				Uword v;
+				do {
+					v = SYS.atomicGetUword(&version);
+				} while(!SYS.atomicCompareExchangeUword(&version, v, v + 1));
+				ctx->retire(current, freeBindings);
+				return cell;
+			}
+			freeKeyCopy(ctx, next, key);
+			freeBindings(ctx, next);
+		}
+	}
+
+	NamespaceEntry Namespace::lookup(Context* ctx, const ReadSection& section, String key) {
+		NamespaceEntry ret;
+		NamespaceCell* cell = getCell(ctx, key);
+		if(cell) {
+			NamespaceEntry* entry = (NamespaceEntry*)SYS.atomicGetUword((volatile Uword*)&cell->entry);
+			if(entry) {
+				ret = *entry;
+			}
+		}
+		return ret;
+	}
+
+	void Namespace::define(Context* ctx, String key, NamespaceEntry value) {
+		publishEntry(ctx, intern(ctx, key), value);
+	}
+
+	// Like define for each name, but the table is copied and published once for all of them
+	// instead of once per new name. Every key gets a cell up front; the ones whose name turns
+	// out to be bound already are freed once the table is published.
+	void Namespace::defineAll(Context* ctx, const String* keys, const NamespaceEntry* values, Uword count) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		std::vector<NamespaceCell*> fresh(count, (NamespaceCell*)nullptr);
+		std::vector<NamespaceCell*> cells(count, (NamespaceCell*)nullptr);
+		try {
+			for(Uword i = 0; i < count; ++i) {
+				fresh[i] = newCell(ctx);
+			}
+			while(true) {
+				ReadSection section(ctx);
+				NamespaceBindings* current = (NamespaceBindings*)SYS.atomicGetUword((volatile Uword*)&bindings);
+				NamespaceBindings* next = newBindings(ctx, current);
+				Uword added = 0;
+				try {
+					for(; added < count; ++added) {
+						Option<NamespaceCell*> existing = next->get(ctx, keys[added]);
+						cells[added] = existing.hasValue() ? existing.value : fresh[added];
+						if(!existing.hasValue()) {
+							next->put(ctx, keys[added], fresh[added]);
+						}
+					}
+				}
+				catch(...) {
+					for(Uword i = 0; i < added; ++i) {
+						if(cells[i] == fresh[i]) {
+							freeKeyCopy(ctx, next, keys[i]);
+						}
+					}
+					freeBindings(ctx, next);
+					throw;
+				}
+				if(SYS.atomicCompareExchangeUword((volatile Uword*)&bindings, (Uword)current, (Uword)next)) {
+					Uword v;
+					do {
+						v = SYS.atomicGetUword(&version);
+					} while(!SYS.atomicCompareExchangeUword(&version, v, v + 1));
+					ctx->retire(current, freeBindings);
+					break;
+				}
+				for(Uword i = 0; i < count; ++i) {
+					if(cells[i] == fresh[i]) {
+						freeKeyCopy(ctx, next, keys[i]);
+					}
+				}
+				freeBindings(ctx, next);
+			}
+		}
+		catch(...) {
+			for(Uword i = 0; i < count; ++i) {
+				if(fresh[i]) {
+					heap.free(fresh[i]);
+				}
+			}
+			throw;
+		}
+		for(Uword i = 0; i < count; ++i) {
+			if(cells[i] != fresh[i]) {
+				heap.free(fresh[i]);
+			}
+		}
+		for(Uword i = 0; i < count; ++i) {
+			NamespaceEntry value = values[i];
+			if(!value.isNothing()) {
+				publishEntry(ctx, cells[i], value);
+			}
+		}
+	}
+
+	static void removeDependent(NamespaceCell* cell, NamespaceCell* dependent) {
+		for(Uword i = 0; i < cell->dependents.size; ++i) {
+			if(*cell->dependents.at(i) == dependent) {
+				*cell->dependents.at(i) = *cell->dependents.at(cell->dependents.size - 1);
+				--cell->dependents.size;
+				return;
+			}
+		}
+	}
+
+	// Edits the dependents of cells in other namespaces too, so this needs the runtime's compile
+	// lock. DefinitionCompilers already run under it.
+	void Namespace::setDependencies(Context* ctx, NamespaceCell* cell, NamespaceCell* const* deps, Uword count) {
+		for(Uword i = 0; i < cell->dependencies.size; ++i) {
+			removeDependent(*cell->dependencies.at(i), cell);
+		}
+		cell->dependencies.clear();
+		cell->dependencies.append(ctx, deps, count);
+		for(Uword i = 0; i < count; ++i) {
+			deps[i]->dependents.append(ctx, cell);
+		}
+	}
+
+	// Depth first over the dependent edges. The post order lists every cell after all of the
+	// cells that read it, so reversed it starts with changed and compiles dependencies first.
+	// Mutually recursive definitions are cut where the walk meets a cell it already entered,
+	// which is fine as their code only reaches each other through the cells.
+	void Namespace::collectStale(Context* ctx, NamespaceCell* changed, Vector<NamespaceCell*>* out) {
+		Uword generation = ctx->getRuntime()->nextMarkGeneration();
+		Uword first = out->size;
+		Vector<NamespaceCell*> cells;
+		Vector<Uword> next; // Index of the next dependent to visit for each cell on the stack
+		cells.ctor(ctx);
+		next.ctor(ctx);
+		changed->mark = generation;
+		cells.append(ctx, changed);
+		next.append(ctx, (Uword)0);
+		while(cells.size) {
+			NamespaceCell* cell = *cells.at(cells.size - 1);
+			Uword i = *next.at(next.size - 1);
+			if(i < cell->dependents.size) {
+				*next.at(next.size - 1) = i + 1;
+				NamespaceCell* dependent = *cell->dependents.at(i);
+				if(dependent->mark != generation) {
+					dependent->mark = generation;
+					cells.append(ctx, dependent);
+					next.append(ctx, (Uword)0);
+				}
+			}
+			else {
+				out->append(ctx, cell);
+				--cells.size;
+				--next.size;
+			}
+		}
+		for(Uword lo = first, hi = out->size - 1; lo < hi; ++lo, --hi) {
+			NamespaceCell* tmp = *out->at(lo);
+			*out->at(lo) = *out->at(hi);
+			*out->at(hi) = tmp;
+		}
+		cells.dtor(ctx);
+		next.dtor(ctx);
+	}
+
+	// Every other definition keeps its module and machine code. Dependents are recompiled
+	// too, because their code may have been specialized on the entry that was just replaced.
+	void Namespace::redefine(Context* ctx, String key, NamespaceEntry value, DefinitionCompiler compile, void* data) {
+		MutexLock lock(ctx->getRuntime()->getCompileLock());
+		Vector<NamespaceCell*> stale;
+		stale.ctor(ctx);
+		try {
+			define(ctx, key, value);
+			collectStale(ctx, getCell(ctx, key), &stale);
+			Runtime* rt = ctx->getRuntime();
+			for(Uword i = 0; i < stale.size; ++i) {
+				NamespaceCell* cell = *stale.at(i);
+				OCT_TRACE_EVENT(ctx, TRACE_JIT_COMPILE, TRACE_BEGIN, cell, 0);
+				llvm::Module* module = compile(ctx, cell, data);
+				if(module) {
+					rt->installModule(ctx, cell, module);
+				}
+				OCT_TRACE_EVENT(ctx, TRACE_JIT_COMPILE, TRACE_END, cell, 0);
+			}
+		}
+		catch(...) {
+			stale.dtor(ctx);
+			throw;
+		}
+		stale.dtor(ctx);
+	}
+
+	// Emits every bound definition into one module and optimizes it as a unit, so calls between
+	// definitions can be inlined and unused code dropped. The per definition modules are retired.
+	// Redefining a name afterwards goes through redefine as usual; dependents that inlined the
+	// old code are recompiled into their own modules, the batch module stays for the rest.
+	// The batch defines the same symbols as the modules it replaces, which stay in the engine
+	// until they are reclaimed. Its frame entries are therefore resolved from the batch module
+	// itself and published to the cells before anything is retired, never looked up by name.
+	void Namespace::compileBatch(Context* ctx, DefinitionEmitter emit, void* data) {
+		MutexLock lock(ctx->getRuntime()->getCompileLock());
+		Runtime* rt = ctx->getRuntime();
+		Vector<NamespaceCell*> cells;
+		std::vector<std::string> symbols;
+		cells.ctor(ctx);
+		llvm::Module* module = nullptr; // Ours to delete until the engine has it
+		llvm::Module* batch = nullptr;
+		try {
+			{
+				ReadSection section(ctx);
+				NamespaceBindings* table = (NamespaceBindings*)SYS.atomicGetUword((volatile Uword*)&bindings);
+				Array< HashtableEntry< HashtableKey<String>, NamespaceCell* > >* entries = table->entries.obj;
+				for(Uword i = 0; i < entries->size; ++i) {
+					if(entries->data[i].key.hasValue() && entries->data[i].val->entry) {
+						cells.append(ctx, entries->data[i].val);
+						String* name = entries->data[i].key.getValue().self;
+						symbols.push_back(std::string(FRAME_ENTRY_PREFIX) + (const char*)&name->data->data[0]);
+					}
+				}
+			}
+
+			OCT_TRACE_EVENT(ctx, TRACE_JIT_COMPILE, TRACE_BEGIN, cells.size, 0);
+			module = rt->createModule("batch");
+			for(Uword i = 0; i < cells.size; ++i) {
+				emit(ctx, *cells.at(i), module, data);
+			}
+			rt->optimizeModule(module);
+			rt->installModule(ctx, nullptr, module);
+			batch = module;
+			module = nullptr;
+			OCT_TRACE_EVENT(ctx, TRACE_JIT_COMPILE, TRACE_END, cells.size, 0);
+		}
+		catch(...) {
+			delete module;
+			cells.dtor(ctx);
+			throw;
+		}
+		std::vector<FrameEntry> frameEntries(cells.size, (FrameEntry)nullptr);
+		for(Uword i = 0; i < cells.size; ++i) {
+			llvm::Function* fn = batch->getFunction(symbols[i]);
+			if(fn) {
+				frameEntries[i] = (FrameEntry)rt->getPointerToFunction(fn);
+			}
+		}
+		llvm::Module* oldBatch = batchModule;
+		std::vector<llvm::Module*> old;
+		batchModule = batch;
+		for(Uword i = 0; i < cells.size; ++i) {
+			NamespaceCell* cell = *cells.at(i);
+			if(cell->module) {
+				old.push_back(cell->module);
+				cell->module = nullptr;
+			}
+			cell->frameEntry = frameEntries[i];
+			bumpCodeVersion(cell);
+		}
+		cells.dtor(ctx);
+		for(Uword i = 0; i < old.size(); ++i) {
+			rt->retireModule(ctx, old[i]);
+		}
+		if(oldBatch) {
+			rt->retireModule(ctx, oldBatch);
+		}
+	}
+
+	// DEF Context
+	Context::Context(Runtime* rt, Namespace* ns): _rt(rt), _ns(ns), _scheduler(nullptr), _epochState(0), _epochDepth(0), _retired(nullptr), _trace(nullptr) {
+		_heapStats.allocatedObjects = 0;
+		_heapStats.allocatedBytes = 0;
+		_heapStats.since = SYS.nanoTimestamp();
+		_heapStats.nextSample = 0;
+	}
+	
+	Context::~Context() {
+		reclaim(true);
+		if(_trace) {
+			_rt->getTracer().releaseBuffer(_trace);
+		}
+	}
+	
+	ContextHeapStats& Context::getHeapStats() {
+		return _heapStats;
+	}
+
+	// Only this context writes to its buffer, so taking a slot is a plain store; the release
+	// store of head hands the event to the flush thread.
+	void Context::trace(U32 kind, U32 phase, Uword arg0, Uword arg1) {
+		Tracer& tracer = _rt->getTracer();
+		if(OCT_LIKELY(!tracer.isEnabled())) {
+			return;
+		}
+		TraceBuffer* buf = _trace;
+		if(OCT_UNLIKELY(!buf)) {
+			buf = _trace = tracer.registerBuffer();
+		}
+		Uword head = buf->head;
+		if(OCT_UNLIKELY(head - buf->cachedTail >= TRACE_BUFFER_EVENTS)) {
+			buf->cachedTail = SYS.atomicGetUword(&buf->tail);
+			if(head - buf->cachedTail >= TRACE_BUFFER_EVENTS) {
+				buf->dropped = buf->dropped + 1;
+				return;
+			}
+		}
+		TraceEvent* e = &buf->events[head & (TRACE_BUFFER_EVENTS - 1)];
+		e->cycles = SYS.cycleTimestamp();
+		e->kind = kind;
+		e->phase = phase;
+		e->arg0 = arg0;
+		e->arg1 = arg1;
+		SYS.atomicStoreReleaseUword(&buf->head, head + 1);
+	}
+
+	Namespace* Context::getNamespace() const {
+		return _ns;
+	}
+
+	void Context::setNamespace(Namespace* ns) {
+		_ns = ns;
+	}
+    
+    Runtime* Context::getRuntime() const {
+        return _rt;
+    }
+
+	Scheduler* Context::getScheduler() const {
+		return _scheduler;
+	}
+
+	void Context::setScheduler(Scheduler* scheduler) {
+		_scheduler = scheduler;
+	}
+
+	void Context::yield() {
+		if(_scheduler) {
+			_scheduler->yield();
+		}
+		else {
+			SYS.sleep(0);
+		}
+	}
+
+	// JITed code running in oct_call's section reads the namespaces through their own sections,
+	// those must not end the outer one
+	void Context::enterEpoch() {
+		if(_epochDepth++ == 0) {
+			// atomicSetUword is a full barrier, so the epoch is visible before any shared read
+			SYS.atomicSetUword(&_epochState, (_rt->getEpoch() << 1) | 1);
+		}
+	}
+
+	void Context::exitEpoch() {
+		assert(_epochDepth > 0 && "exitEpoch without enterEpoch");
+		if(--_epochDepth == 0) {
+			SYS.atomicSetUword(&_epochState, 0);
+		}
+	}
+
+	Uword Context::getEpochState() {
+		return SYS.atomicGetUword(&_epochState);
+	}
+
+	void Context::retire(void* obj, void (*free)(Context* ctx, void* obj)) {
+		Retired* r = (Retired*)SYS.alloc(sizeof(Retired));
+		r->obj = obj;
+		r->free = free;
+		r->epoch = _rt->getEpoch();
+		r->next = _retired;
+		_retired = r;
+		_rt->tryAdvanceEpoch();
+		reclaim(false);
+	}
+
+	void Context::drain() {
+		reclaim(false);
+		while(_retired) {
+			SYS.sleep(1);
+			_rt->tryAdvanceEpoch();
+			reclaim(false);
+		}
+	}
+
+	void Context::reclaim(bool all) {
+		Uword epoch = _rt->getEpoch();
+		Retired** link = &_retired;
+		while(*link) {
+			Retired* r = *link;
+			if(all || r->epoch + 2 <= epoch) {
+				*link = r->next;
+				r->free(this, r->obj);
+				SYS.free(r);
+			}
+			else {
+				link = &r->next;
+			}
+		}
+	}
+
+	// DEF Fiber
+	Fiber::Fiber(): _fn(nullptr), _arg(nullptr), _ctx(nullptr), _return(nullptr), _done(False) {
+	#ifdef _WIN32
+		_handle = ConvertThreadToFiberEx(nullptr, FIBER_FLAG_FLOAT_SWITCH);
+		if(!_handle) {
+			throw std::bad_alloc();
+		}
+	#else
+		_sp = nullptr;
+		_stack = nullptr;
+		_stackSize = 0;
+	#endif
+	}
+
+	Fiber::Fiber(void (*fn)(Context* ctx, void* arg), void* arg, Context* ctx, Uword stackSize)
+	: _fn(fn), _arg(arg), _ctx(ctx), _return(nullptr), _done(False) {
+	#ifdef _WIN32
+		// Windows commits fiber stacks on demand, only the first pages are backed up front
+		_handle = CreateFiberEx(16 * 1024, stackSize, FIBER_FLAG_FLOAT_SWITCH, windowsEntry, this);
+		if(!_handle) {
+			throw std::bad_alloc();
+		}
+	#elif defined (OCT_FIBERS)
+		_stackSize = stackSize;
+		_stack = SYS.allocStack(stackSize);
+		// Lay out a frame that oct_fiber_switch can pop, returning into the trampoline. The
+		// fiber starts with the creating thread's floating point control state.
+		Uword* top = (Uword*)(((Uword)_stack + stackSize) & ~(Uword)15);
+		#if defined (__x86_64__)
+		Uword* sp = top - 2 - 8; // The stack is 16 byte aligned after the final ret
+		sp[0] = 0;
+		__asm__ __volatile__("stmxcsr %0" : "=m" (*(U32*)&sp[0]));
+		__asm__ __volatile__("fnstcw %0" : "=m" (*((U16*)&sp[0] + 2)));
+		sp[1] = 0; // r15
+		sp[2] = 0; // r14
+		sp[3] = (Uword)&Fiber::start; // r13
+		sp[4] = (Uword)this; // r12
+		sp[5] = 0; // rbx
+		sp[6] = 0; // rbp
+		sp[7] = (Uword)&oct_fiber_trampoline;
+		#elif defined (__aarch64__)
+		Uword* sp = top - 22;
+		memset(sp, 0, 22 * sizeof(Uword));
+		sp[0] = (Uword)this; // x19
+		sp[1] = (Uword)&Fiber::start; // x20
+		sp[11] = (Uword)&oct_fiber_trampoline; // x30
+		__asm__ __volatile__("mrs %0, fpcr" : "=r" (sp[20]));
+		#endif
+		_sp = sp;
+	#else
+		throw Exception(Exception::UNSUPPORTED, "fibers are not implemented for this architecture");
+	#endif
+	}
+
+	Fiber::~Fiber() {
+	#ifdef _WIN32
+		if(_fn) {
+			DeleteFiber(_handle);
+		}
+		else {
+			ConvertFiberToThread();
+		}
+	#else
+		if(_stack) {
+			SYS.freeStack(_stack, _stackSize);
+		}
+	#endif
+	}
+
+	#ifdef _WIN32
+	VOID CALLBACK Fiber::windowsEntry(LPVOID param) {
+		start((Fiber*)param);
+	}
+	#endif
+
+	void Fiber::start(Fiber* self) {
+		// Unwinding cannot go past the bottom of the fiber's stack
+		try {
+			self->_fn(self->_ctx, self->_arg);
+		}
+		catch(...) {
+			self->_error = std::current_exception();
+		}
+		self->_done = True;
+		self->suspend();
+		// Never resumed after this
+	}
+
+	void Fiber::resume(Fiber* from) {
+		_return = from;
+	#ifdef _WIN32
+		SwitchToFiber(_handle);
+	#elif defined (OCT_FIBERS)
+		oct_fiber_switch(&from->_sp, _sp);
+	#endif
+		if(_error) {
+			std::exception_ptr error = _error;
+			_error = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	void Fiber::suspend() {
+	#ifdef _WIN32
+		SwitchToFiber(_return->_handle);
+	#elif defined (OCT_FIBERS)
+		oct_fiber_switch(&_sp, _return->_sp);
+	#endif
+	}
+
+	bool Fiber::isDone() {
+		return _done == True;
+	}
+
+	// DEF WorkDeque
+	WorkDeque::WorkDeque(): _top(0), _bottom(0) {
+		_buffer = createBuffer(256, nullptr);
+	}
+
+	WorkDeque::~WorkDeque() {
+		Buffer* buffer = _buffer;
+		while(buffer) {
+			Buffer* previous = buffer->previous;
+			SYS.free(buffer);
+			buffer = previous;
+		}
+	}
+
+	WorkDeque::Buffer* WorkDeque::createBuffer(Word capacity, Buffer* previous) {
+		Buffer* buffer = (Buffer*)SYS.alloc(sizeof(Buffer) + sizeof(Task*) * (capacity - 1));
+		buffer->capacity = capacity;
+		buffer->previous = previous;
+		return buffer;
+	}
+
+	WorkDeque::Buffer* WorkDeque::grow(Buffer* buffer, Word top, Word bottom) {
+		Buffer* bigger = createBuffer(buffer->capacity * 2, buffer);
+		for(Word i = top; i < bottom; ++i) {
+			bigger->tasks[i & (bigger->capacity - 1)] = buffer->tasks[i & (buffer->capacity - 1)];
+		}
+		SYS.memoryBarrier();
+		_buffer = bigger;
+		return bigger;
+	}
+
+	void WorkDeque::push(Task* task) {
+		Word bottom = (Word)_bottom;
+		Word top = (Word)SYS.atomicGetUword(&_top);
+		Buffer* buffer = _buffer;
+		if(bottom - top > buffer->capacity - 1) {
+			buffer = grow(buffer, top, bottom);
+		}
+		buffer->tasks[bottom & (buffer->capacity - 1)] = task;
+		SYS.atomicSetUword(&_bottom, (Uword)(bottom + 1));
+	}
+
+	Task* WorkDeque::pop() {
+		Word bottom = (Word)_bottom - 1;
+		Buffer* buffer = _buffer;
+		SYS.atomicSetUword(&_bottom, (Uword)bottom);
+		Word top = (Word)SYS.atomicGetUword(&_top);
+		if(top > bottom) {
+			_bottom = (Uword)(bottom + 1);
+			return nullptr;
+		}
+		Task* task = buffer->tasks[bottom & (buffer->capacity - 1)];
+		if(top == bottom) {
+			// Last task, race the thieves for it
+			if(!SYS.atomicCompareExchangeUword(&_top, (Uword)top, (Uword)(top + 1))) {
+				task = nullptr;
+			}
+			_bottom = (Uword)(bottom + 1);
+		}
+		return task;
+	}
+
+	Task* WorkDeque::steal(bool* contended) {
+		Word top = (Word)SYS.atomicGetUword(&_top);
+		SYS.memoryBarrier();
+		Word bottom = (Word)SYS.atomicGetUword(&_bottom);
+		if(top >= bottom) {
+			return nullptr;
+		}
+		Buffer* buffer = _buffer;
+		Task* task = buffer->tasks[top & (buffer->capacity - 1)];
+		if(!SYS.atomicCompareExchangeUword(&_top, (Uword)top, (Uword)(top + 1))) {
+			*contended = true;
+			return nullptr;
+		}
+		return task;
+	}
+
+	bool WorkDeque::isEmpty() {
+		return (Word)SYS.atomicGetUword(&_top) >= (Word)SYS.atomicGetUword(&_bottom);
+	}
+
+	// DEF Scheduler
+	Scheduler::Scheduler(Runtime* rt, Uword numWorkers): _rt(rt), _injected(nullptr), _running(True), _failed(0) {
+		if(numWorkers == 0) {
+			numWorkers = SYS.processorCount();
+		}
+		Namespace* ns = rt->getCurrentContext()->getNamespace();
+		for(Uword i = 0; i < numWorkers; ++i) {
+			Worker* w = new Worker();
+			w->scheduler = this;
+			w->ctx = rt->createContext(ns);
+			w->ctx->setScheduler(this);
+			w->index = i;
+			w->random = (i + 1) * 0x9E3779B9;
+			w->tick = 0;
+			w->parked = False;
+			w->threadFiber = nullptr;
+			w->running = nullptr;
+			w->parking = False;
+			w->numParked = 0;
+			w->woken = nullptr;
+			w->readyHead = nullptr;
+			w->readyTail = nullptr;
+			w->yieldedHead = nullptr;
+			w->yieldedTail = nullptr;
+			_workers.push_back(w);
+		}
+		// Start the threads only when the worker list is complete, they steal from each other
+		for(Uword i = 0; i < numWorkers; ++i) {
+			_workers[i]->thread = SYS.startThread(workerMain, _workers[i]);
+		}
+	}
+
+	Scheduler::~Scheduler() {
+		shutdown();
+		std::vector<Worker*>::iterator wi;
+		for(wi = _workers.begin(); wi != _workers.end(); ++wi) {
+			_rt->destroyContext((*wi)->ctx);
+			delete (*wi);
+		}
+	}
+
+	void Scheduler::newTask(Task* task, void (*fn)(Context* ctx, void* arg), void* arg, Uword stackSize) {
+		task->fn = fn;
+		task->arg = arg;
+		task->next = nullptr;
+		task->stackSize = stackSize;
+		task->fiber = nullptr;
+		task->worker = nullptr;
+		task->parkState = TASK_RUNNING;
+	}
+
+	void Scheduler::spawn(void (*fn)(Context* ctx, void* arg), void* arg) {
+		Task* task = (Task*)SYS.alloc(sizeof(Task));
+		newTask(task, fn, arg, 0);
+		enqueue(task);
+	}
+
+	void Scheduler::spawnFiber(void (*fn)(Context* ctx, void* arg), void* arg, Uword stackSize) {
+	#ifndef OCT_FIBERS
+		throw Exception(Exception::UNSUPPORTED, "fibers are not implemented for this architecture");
+	#endif
+		Task* task = (Task*)SYS.alloc(sizeof(Task));
+		newTask(task, fn, arg, stackSize);
+		enqueue(task);
+	}
+
+	void Scheduler::yield() {
+		Worker* w = _currentWorker.get();
+		if(w && w->running) {
+			w->running->fiber->suspend();
+		}
+		else {
+			SYS.sleep(0);
+		}
+	}
+
+	Task* Scheduler::getCurrentFiber() {
+		Worker* w = _currentWorker.get();
+		return w ? w->running : nullptr;
+	}
+
+	void Scheduler::park() {
+		Worker* w = _currentWorker.get();
+		Task* task = w->running;
+		if(SYS.atomicCompareExchangeUword(&task->parkState, TASK_NOTIFIED, TASK_RUNNING)) {
+			return;
+		}
+		w->parking = True;
+		task->fiber->suspend();
+	}
+
+	void Scheduler::unpark(Task* task) {
+		while(true) {
+			Uword state = SYS.atomicGetUword(&task->parkState);
+			if(state == TASK_NOTIFIED) {
+				return;
+			}
+			if(state == TASK_RUNNING) {
+				if(SYS.atomicCompareExchangeUword(&task->parkState, TASK_RUNNING, TASK_NOTIFIED)) {
+					return;
+				}
+				continue;
+			}
+			if(SYS.atomicCompareExchangeUword(&task->parkState, TASK_PARKED, TASK_RUNNING)) {
+				break;
+			}
+		}
+		// Off its stack and owned by us now, hand it back to its worker
+		Worker* w = task->worker;
+		while(true) {
+			Task* head = w->woken;
+			task->next = head;
+			if(SYS.atomicCompareExchangeUword((volatile Uword*)&w->woken, (Uword)head, (Uword)task)) {
+				break;
+			}
+		}
+		if(SYS.atomicCompareExchangeUword(&w->parked, True, False)) {
+			w->parker.unpark();
+		}
+	}
+
+	void Scheduler::enqueue(Task* task) {
+		Worker* w = _currentWorker.get();
+		if(w) {
+			w->deque.push(task);
+		}
+		else {
+			while(true) {
+				Task* head = _injected;
+				task->next = head;
+				if(SYS.atomicCompareExchangeUword((volatile Uword*)&_injected, (Uword)head, (Uword)task)) {
+					break;
+				}
+			}
+		}
+		wakeOne();
+	}
+
+	void Scheduler::shutdown() {
+		if(!SYS.atomicCompareExchangeUword(&_running, True, False)) {
+			return;
+		}
+		std::vector<Worker*>::iterator wi;
+		for(wi = _workers.begin(); wi != _workers.end(); ++wi) {
+			(*wi)->parker.unpark();
+		}
+		for(wi = _workers.begin(); wi != _workers.end(); ++wi) {
+			SYS.joinThread((*wi)->thread);
+		}
+	}
+
+	Uword Scheduler::getWorkerCount() {
+		return _workers.size();
+	}
+
+	Uword Scheduler::getFailedCount() {
+		return SYS.atomicGetUword(&_failed);
+	}
+
+	// Nothing waits on a task, so its exception has nowhere to go. It must not reach the
+	// worker's thread entry, that would terminate the process.
+	void Scheduler::failed(Worker* w) {
+		SYS.atomicAddUword(&_failed, 1);
+		OCT_TRACE_EVENT(w->ctx, TRACE_SCHEDULER_TASK_FAILED, TRACE_INSTANT, w->index, 0);
+	}
+
+	void Scheduler::workerMain(void* arg) {
+		Worker* w = (Worker*)arg;
+		Scheduler* self = w->scheduler;
+		self->_currentWorker.set(w);
+		self->_rt->setCurrentContext(w->ctx);
+		w->threadFiber = new Fiber();
+		while(true) {
+			Task* task = self->findTask(w);
+			if(task) {
+				self->run(w, task);
+				continue;
+			}
+			// Parked fibers live on this worker, it stays until they are done
+			bool stopping = !SYS.atomicGetUword(&self->_running) && w->numParked == 0;
+			if(stopping) {
+				break;
+			}
+			// Announce that we are going to sleep, then look again so that a spawn or an
+			// unpark racing with us either sees the flag or we see its task.
+			SYS.atomicSetUword(&w->parked, True);
+			if(self->hasWork() || SYS.atomicGetUword((volatile Uword*)&w->woken) ||
+				(!SYS.atomicGetUword(&self->_running) && w->numParked == 0)) {
+				if(!SYS.atomicCompareExchangeUword(&w->parked, True, False)) {
+					// Someone already woke us, eat the permit
+					w->parker.park();
+				}
+				continue;
+			}
+			OCT_TRACE_EVENT(w->ctx, TRACE_SCHEDULER_PARK, TRACE_BEGIN, 0, 0);
+			w->parker.park();
+			OCT_TRACE_EVENT(w->ctx, TRACE_SCHEDULER_PARK, TRACE_END, 0, 0);
+			SYS.atomicSetUword(&w->parked, False);
+		}
+		delete w->threadFiber;
+	}
+
+	void Scheduler::run(Worker* w, Task* task) {
+		if(task->stackSize == 0) {
+			try {
+				task->fn(w->ctx, task->arg);
+			}
+			catch(...) {
+				failed(w);
+			}
+			SYS.free(task);
+			return;
+		}
+		if(!task->fiber) {
+			task->fiber = new Fiber(task->fn, task->arg, w->ctx, task->stackSize);
+			task->worker = w;
+		}
+		w->running = task;
+		try {
+			task->fiber->resume(w->threadFiber);
+		}
+		catch(...) {
+			// The fiber is done, it failed like a plain task would
+			w->running = nullptr;
+			delete task->fiber;
+			SYS.free(task);
+			failed(w);
+			return;
+		}
+		w->running = nullptr;
+		if(task->fiber->isDone()) {
+			delete task->fiber;
+			SYS.free(task);
+			return;
+		}
+		if(w->parking) {
+			w->parking = False;
+			if(SYS.atomicCompareExchangeUword(&task->parkState, TASK_RUNNING, TASK_PARKED)) {
+				// unpark puts it on woken from now on
+				++w->numParked;
+				return;
+			}
+			// Unparked while it was still switching out, run it again like a yielded fiber
+			SYS.atomicSetUword(&task->parkState, TASK_RUNNING);
+		}
+		// A started fiber lives on this worker's stack and Context, keep it here
+		task->next = nullptr;
+		if(w->yieldedTail) {
+			w->yieldedTail->next = task;
+		}
+		else {
+			w->yieldedHead = task;
+		}
+		w->yieldedTail = task;
+	}
+
+	// Yielded fibers come after everything else: they gave up the thread so that other work,
+	// possibly the work they wait for, can run. A fiber that yields in a loop still cannot
+	// keep injected or stealable tasks from running.
+	Task* Scheduler::findTask(Worker* w) {
+		Task* task;
+		if(++w->tick % SCHEDULER_FAIRNESS_INTERVAL == 0) {
+			task = takeInjected(w);
+			if(task) {
+				return task;
+			}
+			task = takeYielded(w);
+			if(task) {
+				return task;
+			}
+		}
+		task = w->deque.pop();
+		if(task) {
+			return task;
+		}
+		task = takeWoken(w);
+		if(task) {
+			return task;
+		}
+		task = takeInjected(w);
+		if(task) {
+			return task;
+		}
+		task = steal(w);
+		if(task) {
+			return task;
+		}
+		return takeYielded(w);
+	}
+
+	Task* Scheduler::takeYielded(Worker* w) {
+		Task* task = w->yieldedHead;
+		if(task) {
+			w->yieldedHead = task->next;
+			if(!w->yieldedHead) {
+				w->yieldedTail = nullptr;
+			}
+		}
+		return task;
+	}
+
+	Task* Scheduler::takeWoken(Worker* w) {
+		if(!w->readyHead && SYS.atomicGetUword((volatile Uword*)&w->woken)) {
+			Task* head;
+			do {
+				head = w->woken;
+			} while(!SYS.atomicCompareExchangeUword((volatile Uword*)&w->woken, (Uword)head, (Uword)nullptr));
+			// Pushed newest first, reverse into wake order
+			w->readyTail = head;
+			while(head) {
+				Task* next = head->next;
+				head->next = w->readyHead;
+				w->readyHead = head;
+				head = next;
+			}
+		}
+		Task* task = w->readyHead;
+		if(task) {
+			w->readyHead = task->next;
+			if(!w->readyHead) {
+				w->readyTail = nullptr;
+			}
+			--w->numParked;
+		}
+		return task;
+	}
+
+	Task* Scheduler::steal(Worker* w) {
+		Task* task;
+		// Steal from victims starting at a random worker, retry while thieves collide
+		Uword count = _workers.size();
+		bool contended = true;
+		while(contended) {
+			contended = false;
+			w->random ^= w->random << 13;
+			w->random ^= w->random >> 7;
+			w->random ^= w->random << 17;
+			Uword start = w->random % count;
+			for(Uword i = 0; i < count; ++i) {
+				Worker* victim = _workers[(start + i) % count];
+				if(victim == w) {
+					continue;
+				}
+				task = victim->deque.steal(&contended);
+				if(task) {
+					OCT_TRACE_EVENT(w->ctx, TRACE_SCHEDULER_STEAL, TRACE_INSTANT, victim->index, 0);
+					return task;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	Task* Scheduler::takeInjected(Worker* w) {
+		// Take the whole list at once so there is no ABA problem, run one and queue the rest locally
+		Task* head;
+		do {
+			head = _injected;
+			if(!head) {
+				return nullptr;
+			}
+		} while(!SYS.atomicCompareExchangeUword((volatile Uword*)&_injected, (Uword)head, (Uword)nullptr));
+		Task* rest = head->next;
+		while(rest) {
+			Task* next = rest->next;
+			w->deque.push(rest);
+			rest = next;
+		}
+		if(head->next) {
+			wakeOne();
+		}
+		return head;
+	}
+
+	bool Scheduler::hasWork() {
+		if(SYS.atomicGetUword((volatile Uword*)&_injected)) {
+			return true;
+		}
+		std::vector<Worker*>::iterator wi;
+		for(wi = _workers.begin(); wi != _workers.end(); ++wi) {
+			if(!(*wi)->deque.isEmpty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Scheduler::wakeOne() {
+		SYS.memoryBarrier();
+		std::vector<Worker*>::iterator wi;
+		for(wi = _workers.begin(); wi != _workers.end(); ++wi) {
+			if(SYS.atomicGetUword(&(*wi)->parked) && SYS.atomicCompareExchangeUword(&(*wi)->parked, True, False)) {
+				(*wi)->parker.unpark();
+				return;
+			}
+		}
+	}
+
+	// DEF WaitQueue
+	WaitQueue::WaitQueue(): _head(nullptr), _tail(nullptr), _count(0) {
+	}
+
+	void WaitQueue::enqueue(Context* ctx, Waiter* waiter) {
+		waiter->scheduler = ctx->getScheduler();
+		waiter->task = waiter->scheduler ? waiter->scheduler->getCurrentFiber() : nullptr;
+		waiter->woken = False;
+		waiter->next = nullptr;
+		MutexLock lock(_mutex);
+		if(_tail) {
+			_tail->next = waiter;
+		}
+		else {
+			_head = waiter;
+		}
+		_tail = waiter;
+		// A full barrier, the recheck that follows cannot be ordered before it
+		SYS.atomicAddUword(&_count, 1);
+	}
+
+	void WaitQueue::cancel(Waiter* waiter) {
+		MutexLock lock(_mutex);
+		if(waiter->woken) {
+			return; // Already taken off by wakeOne
+		}
+		Waiter** link = &_head;
+		Waiter* previous = nullptr;
+		while(*link != waiter) {
+			previous = *link;
+			link = &(*link)->next;
+		}
+		*link = waiter->next;
+		if(_tail == waiter) {
+			_tail = previous;
+		}
+		SYS.atomicAddUword(&_count, (Uword)-1);
+	}
+
+	void WaitQueue::park(Waiter* waiter) {
+		while(true) {
+			{
+				// wakeOne sets woken and unparks under the mutex, so the waiter, which lives on
+				// the parked stack, cannot go away while wakeOne still touches it
+				MutexLock lock(_mutex);
+				if(waiter->woken) {
+					return;
+				}
+			}
+			if(waiter->task) {
+				waiter->scheduler->park();
+			}
+			else {
+				waiter->parker.park();
+			}
+		}
+	}
+
+	void WaitQueue::wakeOne() {
+		// Orders the caller's send or receive before the look at _count, pairs with enqueue
+		SYS.memoryBarrier();
+		if(!SYS.atomicGetUword(&_count)) {
+			return;
+		}
+		MutexLock lock(_mutex);
+		Waiter* waiter = _head;
+		if(!waiter) {
+			return;
+		}
+		_head = waiter->next;
+		if(!_head) {
+			_tail = nullptr;
+		}
+		SYS.atomicAddUword(&_count, (Uword)-1);
+		waiter->woken = True;
+		if(waiter->task) {
+			waiter->scheduler->unpark(waiter->task);
+		}
+		else {
+			waiter->parker.unpark();
+		}
+	}
+
+	// DEF Channel
+	template <typename T, ChannelKind K>
+	Channel<T, K>::Channel(Uword capacity): _tail(0), _cachedHead(0), _head(0), _cachedTail(0) {
+		Uword size = 2;
+		while(size < capacity) {
+			size <<= 1;
+		}
+		_mask = size - 1;
+		_slots = (Slot*)SYS.alloc(sizeof(Slot) * size);
+		for(Uword i = 0; i < size; ++i) {
+			_slots[i].sequence = i;
+		}
+	}
+
+	template <typename T, ChannelKind K>
+	Channel<T, K>::~Channel() {
+		// Objects still in flight belong to nobody and are leaked, drain before destroying
+		SYS.free(_slots);
+	}
+
+	template <typename T, ChannelKind K>
+	Uword Channel<T, K>::getCapacity() {
+		return _mask + 1;
+	}
+
+	template <typename T, ChannelKind K>
+	void Channel<T, K>::wake(WaitQueue* queue, Uword count) {
+		for(Uword i = 0; i < count; ++i) {
+			queue->wakeOne();
+		}
+	}
+
+	template <typename T, ChannelKind K>
+	bool Channel<T, K>::trySend(Owned<T> obj) {
+		if(!push(obj)) {
+			return false;
+		}
+		_receivers.wakeOne();
+		return true;
+	}
+
+	template <typename T, ChannelKind K>
+	Option< Owned<T> > Channel<T, K>::tryReceive() {
+		Option< Owned<T> > ret = pop();
+		if(ret.hasValue()) {
+			_senders.wakeOne();
+		}
+		return ret;
+	}
+
+	template <typename T, ChannelKind K>
+	Uword Channel<T, K>::trySendBatch(Owned<T>* objs, Uword count) {
+		Uword n = pushBatch(objs, count);
+		wake(&_receivers, n);
+		return n;
+	}
+
+	template <typename T, ChannelKind K>
+	Uword Channel<T, K>::tryReceiveBatch(Owned<T>* objs, Uword max) {
+		Uword n = popBatch(objs, max);
+		wake(&_senders, n);
+		return n;
+	}
+
+	template <typename T, ChannelKind K>
+	bool Channel<T, K>::push(Owned<T> obj) {
+		if(K == SPSC) {
+			Uword tail = _tail;
+			if(tail - _cachedHead > _mask) {
+				_cachedHead = SYS.atomicGetUword(&_head);
+				if(tail - _cachedHead > _mask) {
+					return false;
+				}
+			}
+			_slots[tail & _mask].obj = obj;
+			SYS.atomicSetUword(&_tail, tail + 1);
+			return true;
+		}
+		// Bounded MPMC queue after Vyukov: a slot is free for position pos when its
+		// sequence equals pos, and holds a value for pos when it equals pos + 1.
+		Uword pos = SYS.atomicGetUword(&_tail);
+		Slot* slot;
+		while(true) {
+			slot = &_slots[pos & _mask];
+			Word diff = (Word)SYS.atomicGetUword(&slot->sequence) - (Word)pos;
+			if(diff == 0) {
+				if(SYS.atomicCompareExchangeUword(&_tail, pos, pos + 1)) {
+					break;
+				}
+			}
+			else if(diff < 0) {
+				return false;
+			}
+			pos = SYS.atomicGetUword(&_tail);
+		}
+		slot->obj = obj;
+		SYS.atomicSetUword(&slot->sequence, pos + 1);
+		return true;
+	}
+
+	template <typename T, ChannelKind K>
+	Option< Owned<T> > Channel<T, K>::pop() {
+		Option< Owned<T> > ret;
+		if(K == SPSC) {
+			Uword head = _head;
+			if(head == _cachedTail) {
+				_cachedTail = SYS.atomicGetUword(&_tail);
+				if(head == _cachedTail) {
+					return ret;
+				}
+			}
+			ret = Option< Owned<T> >(_slots[head & _mask].obj);
+			SYS.atomicSetUword(&_head, head + 1);
+			return ret;
+		}
+		Uword pos = SYS.atomicGetUword(&_head);
+		Slot* slot;
+		while(true) {
+			slot = &_slots[pos & _mask];
+			Word diff = (Word)SYS.atomicGetUword(&slot->sequence) - (Word)(pos + 1);
+			if(diff == 0) {
+				if(K == MPSC) {
+					// Single consumer, nobody to race for the slot
+					_head = pos + 1;
+					break;
+				}
+				if(SYS.atomicCompareExchangeUword(&_head, pos, pos + 1)) {
+					break;
+				}
+			}
+			else if(diff < 0) {
+				return ret;
+			}
+			pos = SYS.atomicGetUword(&_head);
+		}
+		ret = Option< Owned<T> >(slot->obj);
+		SYS.atomicSetUword(&slot->sequence, pos + _mask + 1);
+		return ret;
+	}
+
+	template <typename T, ChannelKind K>
+	Uword Channel<T, K>::pushBatch(Owned<T>* objs, Uword count) {
+		if(K == SPSC) {
+			// Fill as many slots as fit and publish them with a single store
+			Uword tail = _tail;
+			Uword space = _mask + 1 - (tail - _cachedHead);
+			if(space < count) {
+				_cachedHead = SYS.atomicGetUword(&_head);
+				space = _mask + 1 - (tail - _cachedHead);
+			}
+			Uword n = count < space ? count : space;
+			for(Uword i = 0; i < n; ++i) {
+				_slots[(tail + i) & _mask].obj = objs[i];
+			}
+			if(n) {
+				SYS.atomicSetUword(&_tail, tail + n);
+			}
+			return n;
+		}
+		Uword n = 0;
+		while(n < count && push(objs[n])) {
+			++n;
+		}
+		return n;
+	}
+
+	template <typename T, ChannelKind K>
+	Uword Channel<T, K>::popBatch(Owned<T>* objs, Uword max) {
+		if(K == SPSC) {
+			Uword head = _head;
+			Uword available = _cachedTail - head;
+			if(available < max) {
+				_cachedTail = SYS.atomicGetUword(&_tail);
+				available = _cachedTail - head;
+			}
+			Uword n = max < available ? max : available;
+			for(Uword i = 0; i < n; ++i) {
+				objs[i] = _slots[(head + i) & _mask].obj;
+			}
+			if(n) {
+				SYS.atomicSetUword(&_head, head + n);
+			}
+			return n;
+		}
+		Uword n = 0;
+		while(n < max) {
+			Option< Owned<T> > obj = pop();
+			if(!obj.hasValue()) {
+				break;
+			}
+			objs[n++] = obj.value;
+		}
+		return n;
+	}
+
+	template <typename T, ChannelKind K>
+	void Channel<T, K>::send(Context* ctx, Owned<T> obj) {
+		if(!push(obj)) {
+			OCT_TRACE_EVENT(ctx, TRACE_CHANNEL_BLOCKED, TRACE_BEGIN, this, 0);
+			while(true) {
+				WaitQueue::Waiter waiter;
+				_senders.enqueue(ctx, &waiter);
+				if(push(obj)) {
+					_senders.cancel(&waiter);
+					break;
+				}
+				_senders.park(&waiter);
+				if(push(obj)) {
+					break;
+				}
+			}
+			OCT_TRACE_EVENT(ctx, TRACE_CHANNEL_BLOCKED, TRACE_END, this, 0);
+		}
+		_receivers.wakeOne();
+	}
+
+	template <typename T, ChannelKind K>
+	Owned<T> Channel<T, K>::receive(Context* ctx) {
+		Option< Owned<T> > obj = pop();
+		if(!obj.hasValue()) {
+			OCT_TRACE_EVENT(ctx, TRACE_CHANNEL_BLOCKED, TRACE_BEGIN, this, 1);
+			while(true) {
+				WaitQueue::Waiter waiter;
+				_receivers.enqueue(ctx, &waiter);
+				obj = pop();
+				if(obj.hasValue()) {
+					_receivers.cancel(&waiter);
+					break;
+				}
+				_receivers.park(&waiter);
+				obj = pop();
+				if(obj.hasValue()) {
+					break;
+				}
+			}
+			OCT_TRACE_EVENT(ctx, TRACE_CHANNEL_BLOCKED, TRACE_END, this, 1);
+		}
+		_senders.wakeOne();
+		return obj.value;
+	}
+
+	// DEF Hashable
+	template <typename T>
+	Uword Hashable<T>::hash(Context* ctx) {
+		Borrowed<T> self;
+		self.obj = this->self;
+		return this->vtable->fns.hash(ctx, self);
+	}
+
+	// DEF HashtableKey
+	template <typename T>
+	Uword HashtableKey<T>::hash(Context* ctx) {
+		Borrowed<T> self;
+		self.obj = this->self;
+		return this->vtable->fns.b.hash(ctx, self);
+	}
+
+	template <typename T>
+	Bool HashtableKey<T>::equals(Context* ctx, Borrowed< Object<T> > other) {
+		return this->vtable->fns.a.equals(ctx, *this->self, other);
+	}
+
+	// DEF Hashtable
+	// The load limit keeps an empty slot in every table, so probing always ends
+	template <typename TKey, typename TVal>
+	typename Hashtable<TKey, TVal>::Entry* Hashtable<TKey, TVal>::find(Context* ctx, Array<Entry>* slots, TKey& key) {
+		HashtableKey<TKey> probe;
+		probe.self = &key;
+		probe.vtable = HashtableKeyTraits<TKey>::getVTable();
+		// equals only looks at the other key's self
+		Object<TKey> other;
+		other.self = &key;
+		other.vtable = nullptr;
+		Borrowed< Object<TKey> > borrowed;
+		borrowed.obj = other;
+		Uword mask = slots->size - 1;
+		for(Uword i = probe.hash(ctx) & mask; ; i = (i + 1) & mask) {
+			Entry* entry = &slots->data[i];
+			if(!entry->key.hasValue() || entry->key.value.equals(ctx, borrowed)) {
+				return entry;
+			}
+		}
+	}
+
+	// The keys move with their slots, only the slot array is new
+	template <typename TKey, typename TVal>
+	void Hashtable<TKey, TVal>::grow(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		Array<Entry>* slots = heap.allocArray<Entry>(ctx, entries->size * 2).obj;
+		for(Uword i = 0; i < slots->size; ++i) {
+			new (&slots->data[i]) Entry();
+		}
+		for(Uword i = 0; i < entries->size; ++i) {
+			Entry* entry = &entries->data[i];
+			if(entry->key.hasValue()) {
+				*find(ctx, slots, *entry->key.value.self) = *entry;
+			}
+		}
+		heap.free(entries.obj);
+		entries.obj = slots;
+	}
+
+	template <typename TKey, typename TVal>
+	void Hashtable<TKey, TVal>::ctor(Context* ctx, Uword capacity) {
+		Uword size = HASHTABLE_MIN_CAPACITY;
+		while(size < capacity) {
+			size *= 2;
+		}
+		entries = ctx->getRuntime()->getExchangeHeap().allocArray<Entry>(ctx, size);
+		for(Uword i = 0; i < size; ++i) {
+			new (&entries->data[i]) Entry();
+		}
+		count = 0;
+	}
+
+	template <typename TKey, typename TVal>
+	void Hashtable<TKey, TVal>::ctor(Context* ctx, Hashtable<TKey, TVal>* other) {
+		Uword size = other->entries->size;
+		entries = ctx->getRuntime()->getExchangeHeap().allocArray<Entry>(ctx, size);
+		memcpy(&entries->data[0], &other->entries->data[0], sizeof(Entry) * size);
+		count = other->count;
+	}
+
+	template <typename TKey, typename TVal>
+	void Hashtable<TKey, TVal>::dtor(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		for(Uword i = 0; i < entries->size; ++i) {
+			if(entries->data[i].key.hasValue()) {
+				TKey* key = entries->data[i].key.value.self;
+				HashtableKeyTraits<TKey>::free(ctx, key);
+				heap.free(key);
+			}
+		}
+		heap.free(entries.obj);
+	}
+
+	template <typename TKey, typename TVal>
+	void Hashtable<TKey, TVal>::put(Context* ctx, TKey key, TVal val) {
+		Entry* entry = find(ctx, entries.obj, key);
+		if(entry->key.hasValue()) {
+			entry->val = val;
+			return;
+		}
+		if((count + 1) * 100 > entries->size * HASHTABLE_MAX_LOAD_PERCENT) {
+			grow(ctx);
+			entry = find(ctx, entries.obj, key);
+		}
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		TKey* stored = heap.alloc<TKey>(ctx).obj;
+		try {
+			HashtableKeyTraits<TKey>::copy(ctx, stored, key);
+		}
+		catch(...) {
+			heap.free(stored);
+			throw;
+		}
+		entry->key.value.self = stored;
+		entry->key.value.vtable = HashtableKeyTraits<TKey>::getVTable();
+		entry->val = val;
+		++count;
+	}
+
+	template <typename TKey, typename TVal>
+	Option<TVal> Hashtable<TKey, TVal>::get(Context* ctx, TKey key) {
+		Entry* entry = find(ctx, entries.obj, key);
+		if(entry->key.hasValue()) {
+			return Option<TVal>(entry->val);
+		}
+		return Option<TVal>();
+	}
+
+
+	// DEF Option
+	template <typename T, bool niche>
+	bool Option<T, niche>::hasValue() {
+		return variant == SOMETHING;
+	}
+
+	template <typename T, bool niche>
+	T Option<T, niche>::getValue() {
+	#ifdef OCT_DEBUG
+		if(OCT_UNLIKELY(variant == NOTHING)) {
+			throw Exception(Exception::NO_VALUE, "getValue on an empty Option");
+		}
+	#endif
+		return value;
+	}
+
+	template <typename T>
+	bool Option<T, true>::hasValue() {
+		return !t::niche<T>::isNiche(value);
+	}
+
+	template <typename T>
+	T Option<T, true>::getValue() {
+	#ifdef OCT_DEBUG
+		if(OCT_UNLIKELY(t::niche<T>::isNiche(value))) {
+			throw Exception(Exception::NO_VALUE, "getValue on an empty Option");
+		}
+	#endif
+		return value;
+	}
+
+	static_assert(sizeof(Option< Owned<Namespace> >) == sizeof(Uword), "Option of a pointer must not need a variant");
+	static_assert(sizeof(Option< HashtableKey<String> >) == sizeof(HashtableKey<String>), "Empty hashtable keys must use the niche");
+
+    // DEF String
+    String String::createFromCString(Context* ctx, const char* str) {
+        Uword len = strlen(str);
+        String s;
+        s.data = ctx->getRuntime()->getExchangeHeap().allocArray<U8>(ctx, len + 1);
+        memcpy(&s.data->data[0], str, len);
+        s.data->data[len] = '\0';
+        s.data->size = len + 1;
+        s.numCodepoints = len; // This is not correct. Need to account for multibyte chars.
+        return s;
+    }
+
+	// FNV-1a over the UTF-8 bytes
+	static Uword stringHash(Context* ctx, Borrowed<String> self) {
+		const Array<U8>* data = self.obj->data.obj;
+		U64 h = 14695981039346656037ULL;
+		for(Uword i = 0; i < data->size; ++i) {
+			h = (h ^ data->data[i]) * 1099511628211ULL;
+		}
+		return (Uword)h;
+	}
+
+	static Bool stringEquals(Context* ctx, String self, Borrowed< Object<String> > other) {
+		const Array<U8>* a = self.data.obj;
+		const Array<U8>* b = other.obj.self->data.obj;
+		return a->size == b->size && memcmp(a->data, b->data, a->size) == 0 ? True : False;
+	}
+
+	static HashtableKeyVTable<String> stringHashtableKey = { nullptr, { { stringEquals }, { stringHash } } };
+
+	HashtableKeyVTable<String>* HashtableKeyTraits<String>::getVTable() {
+		return &stringHashtableKey;
+	}
+
+	void HashtableKeyTraits<String>::copy(Context* ctx, String* to, String key) {
+		Uword size = key.data->size;
+		to->data = ctx->getRuntime()->getExchangeHeap().allocArray<U8>(ctx, size);
+		memcpy(&to->data->data[0], &key.data->data[0], size);
+		to->numCodepoints = key.numCodepoints;
+	}
+
+	void HashtableKeyTraits<String>::free(Context* ctx, String* key) {
+		ctx->getRuntime()->getExchangeHeap().free(key->data.obj);
+	}
+
+	// DEF Vector
+	template <typename T>
+	void Vector<T>::ctor(Context* ctx, Uword capacity) {
+		items.obj = nullptr;
+		size = 0;
+		if(capacity) {
+			reserve(ctx, capacity);
+		}
+	}
+
+	template <typename T>
+	void Vector<T>::dtor(Context* ctx) {
+		if(items.obj) {
+			clear();
+			ctx->getRuntime()->getExchangeHeap().free(items.obj);
+			items.obj = nullptr;
+		}
+		size = 0;
+	}
+
+	template <typename T>
+	Uword Vector<T>::getCapacity() {
+		return items.obj ? items->size : 0;
+	}
+
+	template <typename T>
+	T* Vector<T>::at(Uword index) {
+		assert(index < size && "Vector index out of range");
+		return &items->data[index];
+	}
+
+	template <typename T>
+	void Vector<T>::append(Context* ctx, T val) {
+		if(OCT_UNLIKELY(size == getCapacity())) {
+			reserve(ctx, size + 1);
+		}
+		new (&items->data[size]) T(val);
+		++size;
+	}
+
+	template <typename T>
+	void Vector<T>::append(Context* ctx, const Array<T>* vals) {
+		append(ctx, &vals->data[0], vals->size);
+	}
+
+	template <typename T>
+	void Vector<T>::append(Context* ctx, const T* vals, Uword count) {
+		if(size + count > getCapacity()) {
+			// vals may be a run of this vector, which moves with the storage
+			Uword data = items.obj ? (Uword)&items->data[0] : 0;
+			Uword offset = (Uword)vals - data;
+			bool own = items.obj && offset < size * sizeof(T);
+			reserve(ctx, size + count);
+			if(own) {
+				vals = (const T*)((U8*)&items->data[0] + offset);
+			}
+		}
+		if(t::trivially_relocatable<T>::value) {
+			memcpy(&items->data[size], vals, sizeof(T) * count);
+		}
+		else {
+			for(Uword i = 0; i < count; ++i) {
+				new (&items->data[size + i]) T(vals[i]);
+			}
+		}
+		size += count;
+	}
+
+	template <typename T>
+	void Vector<T>::reserve(Context* ctx, Uword capacity) {
+		Uword current = getCapacity();
+		if(capacity <= current) {
+			return;
+		}
+		// Geometric growth, at least one cache line of elements to begin with
+		Uword grown = current * 2;
+		Uword minimum = ARRAY_ALIGNMENT / sizeof(T) ? ARRAY_ALIGNMENT / sizeof(T) : 1;
+		if(grown < minimum) {
+			grown = minimum;
+		}
+		if(grown < capacity) {
+			grown = capacity;
+		}
+		if(!items.obj) {
+			items = ctx->getRuntime()->getExchangeHeap().allocArray<T>(ctx, grown, ALLOC_HUGE_PAGES);
+		}
+		else {
+			setCapacity(ctx, grown);
+		}
+	}
+
+	template <typename T>
+	void Vector<T>::setCapacity(Context* ctx, Uword capacity) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		if(t::trivially_relocatable<T>::value) {
+			items = heap.reallocArray<T>(ctx, items, capacity, ALLOC_HUGE_PAGES);
+			return;
+		}
+		// reallocArray would copy the whole capacity, the slots past size are raw memory
+		Owned< Array<T> > moved = heap.allocArray<T>(ctx, capacity, ALLOC_HUGE_PAGES);
+		for(Uword i = 0; i < size; ++i) {
+			new (&moved->data[i]) T(std::move(items->data[i]));
+			items->data[i].~T();
+		}
+		heap.free(items.obj);
+		items = moved;
+	}
+
+	template <typename T>
+	void Vector<T>::shrink(Context* ctx) {
+		if(!items.obj || size == items->size) {
+			return;
+		}
+		if(size == 0) {
+			dtor(ctx);
+			return;
+		}
+		setCapacity(ctx, size);
+	}
+
+	template <typename T>
+	void Vector<T>::clear() {
+		if(!std::is_trivially_destructible<T>::value) {
+			for(Uword i = 0; i < size; ++i) {
+				items->data[i].~T();
+			}
+		}
+		size = 0;
+	}
+
+	// DEF Table
+	// Rows are processed in batches of this many, small enough for their scratch to stay in L1
+	static const Uword TABLE_BATCH = 1024;
+
+	// Copies count elements of size bytes between two strided layouts. The common sizes get a
+	// typed loop the compiler can unroll, everything else goes through memcpy.
+	template <typename T>
+	static void copyStrided(U8* dst, Uword dstStride, const U8* src, Uword srcStride, Uword count) {
+		for(Uword i = 0; i < count; ++i) {
+			memcpy(dst + i * dstStride, src + i * srcStride, sizeof(T));
+		}
+	}
+
+	static void copyStrided(U8* dst, Uword dstStride, const U8* src, Uword srcStride, Uword size, Uword count) {
+		switch(size) {
+		case 1: copyStrided<U8>(dst, dstStride, src, srcStride, count); break;
+		case 2: copyStrided<U16>(dst, dstStride, src, srcStride, count); break;
+		case 4: copyStrided<U32>(dst, dstStride, src, srcStride, count); break;
+		case 8: copyStrided<U64>(dst, dstStride, src, srcStride, count); break;
+		default:
+			for(Uword i = 0; i < count; ++i) {
+				memcpy(dst + i * dstStride, src + i * srcStride, size);
+			}
+		}
+	}
+
+	void Table::ctor(Context* ctx, Type* recordType, Uword capacity) {
+		if(recordType->numFields == 0) {
+			throw Exception(Exception::BAD_ARGUMENT, "table records need fields");
+		}
+		this->recordType = recordType;
+		numRows = 0;
+		this->capacity = capacity;
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		columns = heap.allocArray< Owned< Array<Unknown> > >(ctx, recordType->numFields);
+		for(Uword f = 0; f < recordType->numFields; ++f) {
+			columns->data[f] = heap.allocArray(ctx, recordType->fields[f].type, capacity, ALLOC_ALIGNED);
+			columns->data[f]->size = 0;
+		}
+	}
+
+	void Table::dtor(Context* ctx) {
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		for(Uword f = 0; f < columns->size; ++f) {
+			heap.free(columns->data[f].obj);
+		}
+		heap.free(columns.obj);
+		numRows = 0;
+		capacity = 0;
+	}
+
+	// Row indices come from callers, possibly from another table, so they are checked up front
+	static void checkRows(const Uword* rows, Uword count, Uword numRows) {
+		for(Uword i = 0; i < count; ++i) {
+			if(OCT_UNLIKELY(rows[i] >= numRows)) {
+				throw Exception(Exception::BAD_ARGUMENT, "table row out of range");
+			}
+		}
+	}
+
+	Array<Unknown>* Table::getColumn(Uword field) {
+		if(field >= recordType->numFields) {
+			throw Exception(Exception::BAD_ARGUMENT, "table field out of range");
+		}
+		return columns->data[field].obj;
+	}
+
+	template <typename T>
+	Array<T>* Table::getColumn(Uword field) {
+		Array<Unknown>* column = getColumn(field);
+		Type* type = BuiltinType<T>::get();
+		if(!type || !isSameType(recordType->fields[field].type, type)) {
+			throw Exception(Exception::BAD_ARGUMENT, "column read as the wrong type");
+		}
+		// Every array keeps its data at the same offset, only the element type differs
+		return (Array<T>*)column;
+	}
+
+	void Table::reserve(Context* ctx, Uword capacity) {
+		if(capacity <= this->capacity) {
+			return;
+		}
+		Uword grown = this->capacity * 2;
+		if(grown < capacity) {
+			grown = capacity;
+		}
+		ExchangeHeap& heap = ctx->getRuntime()->getExchangeHeap();
+		for(Uword f = 0; f < columns->size; ++f) {
+			columns->data[f] = heap.reallocArray(ctx, columns->data[f], grown);
+			columns->data[f]->size = numRows;
+		}
+		this->capacity = grown;
+	}
+
+	void Table::appendRows(Context* ctx, const void* records, Uword count) {
+		if(numRows + count > capacity) {
+			reserve(ctx, numRows + count);
+		}
+		// Column by column, so each pass writes one array sequentially
+		for(Uword f = 0; f < recordType->numFields; ++f) {
+			TypeField& field = recordType->fields[f];
+			Uword size = field.type->size;
+			Array<Unknown>* column = columns->data[f].obj;
+			copyStrided((U8*)&column->data[0] + numRows * size, size, (const U8*)records + field.offset, recordType->size, size, count);
+			column->size = numRows + count;
+		}
+		numRows += count;
+	}
+
+	void Table::getRows(const Uword* rows, Uword count, void* records) {
+		checkRows(rows, count, numRows);
+		for(Uword f = 0; f < recordType->numFields; ++f) {
+			TypeField& field = recordType->fields[f];
+			Uword size = field.type->size;
+			const U8* column = (const U8*)&columns->data[f]->data[0];
+			U8* dst = (U8*)records + field.offset;
+			for(Uword i = 0; i < count; ++i) {
+				memcpy(dst + i * recordType->size, column + rows[i] * size, size);
+			}
+		}
+	}
+
+	template <typename T>
+	void Table::filter(Context* ctx, Uword field, SimdCmp cmp, T value, Vector<Uword>* rows) {
+		const SimdKernels<T>& k = Simd<T>::getKernels();
+		const T* column = getColumn<T>(field)->data;
+		U8 mask[TABLE_BATCH];
+		for(Uword start = 0; start < numRows; start += TABLE_BATCH) {
+			Uword n = numRows - start < TABLE_BATCH ? numRows - start : TABLE_BATCH;
+			k.compareScalar(cmp, column + start, value, mask, n);
+			rows->reserve(ctx, rows->size + n);
+			// Branch free compaction, the write index only advances on a match
+			Uword* out = &rows->items->data[0];
+			Uword size = rows->size;
+			for(Uword i = 0; i < n; ++i) {
+				out[size] = start + i;
+				size += mask[i];
+			}
+			rows->size = size;
+		}
+	}
+
+	template <typename T>
+	typename SimdWide<T>::Type Table::aggregate(Uword field, SimdOp op) {
+		return Simd<T>::reduce(op, getColumn<T>(field));
+	}
+
+	template <typename T>
+	typename SimdWide<T>::Type Table::aggregate(Uword field, SimdOp op, const Uword* rows, Uword count) {
+		if(op == SIMD_SUB) {
+			throw Exception(Exception::BAD_ARGUMENT, "subtraction is not a reduction");
+		}
+		if((op == SIMD_MIN || op == SIMD_MAX) && count == 0) {
+			throw Exception(Exception::BAD_ARGUMENT, "no rows have no minimum or maximum");
+		}
+		const SimdKernels<T>& k = Simd<T>::getKernels();
+		const T* column = getColumn<T>(field)->data;
+		T batch[TABLE_BATCH];
+		typename SimdWide<T>::Type result = op == SIMD_MUL ? 1 : 0;
+		for(Uword start = 0; start < count; start += TABLE_BATCH) {
+			Uword n = count - start < TABLE_BATCH ? count - start : TABLE_BATCH;
+			checkRows(rows + start, n, numRows);
+			k.gather(column, rows + start, batch, n);
+			typename SimdWide<T>::Type partial = k.reduce(op, batch, n);
+			result = start == 0 ? partial : simd::combine<T>(op, result, partial);
+		}
+		return result;
+	}
+
+	Owned< Array<Unknown> > Table::project(Context* ctx, Uword field, const Uword* rows, Uword count) {
+		const U8* column = (const U8*)&getColumn(field)->data[0];
+		checkRows(rows, count, numRows);
+		Type* type = recordType->fields[field].type;
+		Owned< Array<Unknown> > ret = ctx->getRuntime()->getExchangeHeap().allocArray(ctx, type, count);
+		U8* dst = (U8*)&ret->data[0];
+		switch(type->size) {
+		case 4: Simd<I32>::getKernels().gather((const I32*)column, rows, (I32*)dst, count); break;
+		case 8: Simd<I64>::getKernels().gather((const I64*)column, rows, (I64*)dst, count); break;
+		case 1: Simd<U8>::getKernels().gather(column, rows, dst, count); break;
+		default:
+			for(Uword i = 0; i < count; ++i) {
+				memcpy(dst + i * type->size, column + rows[i] * type->size, type->size);
+			}
+		}
+		return ret;
+	}
+
+	// DEF Arena
+	Arena::Arena(Uword chunkSize): _chunks(nullptr), _top(nullptr), _end(nullptr), _chunkSize(chunkSize) {
+	}
+
+	Arena::~Arena() {
+		reset();
+	}
+
+	void* Arena::alloc(Uword size) {
+		size = (size + sizeof(Uword) - 1) & ~(sizeof(Uword) - 1);
+		if(OCT_LIKELY((Uword)(_end - _top) >= size)) {
+			void* place = _top;
+			_top += size;
+			return place;
+		}
+		if(size > _chunkSize / 2) {
+			// Big requests get a chunk of their own behind the current one, so its free space stays usable
+			Chunk* chunk = (Chunk*)SYS.alloc(sizeof(Chunk) + size);
+			if(_chunks) {
+				chunk->next = _chunks->next;
+				_chunks->next = chunk;
+			}
+			else {
+				chunk->next = nullptr;
+				_chunks = chunk;
+			}
+			return chunk + 1;
+		}
+		Chunk* chunk = (Chunk*)SYS.alloc(sizeof(Chunk) + _chunkSize);
+		chunk->next = _chunks;
+		_chunks = chunk;
+		_top = (U8*)(chunk + 1) + size;
+		_end = (U8*)(chunk + 1) + _chunkSize;
+		return chunk + 1;
+	}
+
+	void Arena::reset() {
+		while(_chunks) {
+			Chunk* next = _chunks->next;
+			SYS.free(_chunks);
+			_chunks = next;
+		}
+		_top = nullptr;
+		_end = nullptr;
+	}
+
+	// DEF SymbolTable
+	SymbolTable::SymbolTable(): _mask(1023), _count(0) {
+		_slots = (Symbol**)SYS.alloc(sizeof(Symbol*) * (_mask + 1));
+		memset(_slots, 0, sizeof(Symbol*) * (_mask + 1));
+	}
+
+	SymbolTable::~SymbolTable() {
+		SYS.free(_slots);
+	}
+
+	// Eight bytes per step, finished with a multiply-xorshift so short names spread well too
+	Uword SymbolTable::hash(const U8* bytes, Uword length) {
+		U64 h = 0x9e3779b97f4a7c15ULL ^ length;
+		Uword i = 0;
+		for(; i + 8 <= length; i += 8) {
+			U64 word;
+			memcpy(&word, bytes + i, 8);
+			h = (h ^ word) * 0xff51afd7ed558ccdULL;
+			h ^= h >> 32;
+		}
+		if(i < length) {
+			U64 word = 0;
+			memcpy(&word, bytes + i, length - i);
+			h = (h ^ word) * 0xff51afd7ed558ccdULL;
+		}
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return (Uword)h;
+	}
+
+	Symbol* SymbolTable::intern(const U8* name, Uword length) {
+		Uword h = hash(name, length);
+		MutexLock lock(_lock);
+		Uword i = h & _mask;
+		while(Symbol* sym = _slots[i]) {
+			if(sym->hash == h && sym->length == length && memcmp(sym->name, name, length) == 0) {
+				return sym;
+			}
+			i = (i + 1) & _mask;
+		}
+		Symbol* sym = (Symbol*)_arena.alloc(sizeof(Symbol) + length + 1);
+		sym->hash = h;
+		sym->length = length;
+		memcpy(sym->name, name, length);
+		sym->name[length] = '\0';
+		_slots[i] = sym;
+		if(++_count * 2 > _mask) {
+			grow();
+		}
+		return sym;
+	}
+
+	Symbol* SymbolTable::intern(const char* name) {
+		return intern((const U8*)name, strlen(name));
+	}
+
+	Uword SymbolTable::getCount() {
+		MutexLock lock(_lock);
+		return _count;
+	}
+
+	void SymbolTable::collect(std::vector<Symbol*>* out) {
+		MutexLock lock(_lock);
+		for(Uword i = 0; i <= _mask; ++i) {
+			if(_slots[i]) {
+				out->push_back(_slots[i]);
+			}
+		}
+	}
+
+	void SymbolTable::grow() {
+		Uword mask = _mask * 2 + 1;
+		Symbol** slots = (Symbol**)SYS.alloc(sizeof(Symbol*) * (mask + 1));
+		memset(slots, 0, sizeof(Symbol*) * (mask + 1));
+		for(Uword i = 0; i <= _mask; ++i) {
+			if(Symbol* sym = _slots[i]) {
+				Uword j = sym->hash & mask;
+				while(slots[j]) {
+					j = (j + 1) & mask;
+				}
+				slots[j] = sym;
+			}
+		}
+		SYS.free(_slots);
+		_slots = slots;
+		_mask = mask;
+	}
+
+	// DEF ImageWriter
+	ImageWriter::ImageWriter(Uword baseAddress): _baseAddress(baseAddress) {
+	}
+
+	Uword ImageWriter::reserve(Uword size) {
+		// Keep every object pointer aligned
+		Uword offset = _data.size();
+		Uword aligned = (size + sizeof(Uword) - 1) & ~(sizeof(Uword) - 1);
+		_data.resize(offset + aligned, 0);
+		return offset;
+	}
+
+	void* ImageWriter::at(Uword offset) {
+		return &_data[offset];
+	}
+
+	Uword ImageWriter::write(const void* src, Uword size) {
+		Uword offset = reserve(size);
+		memcpy(at(offset), src, size);
+		return offset;
+	}
+
+	void ImageWriter::writePointer(Uword slot, Uword target) {
+		*(Uword*)at(slot) = _baseAddress + sizeof(ImageHeader) + target;
+		_relocations.push_back(slot);
+	}
+
+	Uword ImageWriter::writeArray(const void* elements, Uword elementSize, Uword length, Type* elementType) {
+		// Pad so the data is as aligned in the mapped image as an ALLOC_ALIGNED heap array.
+		// The mapping starts on a page, so offsets from it are enough.
+		Uword dataOffset = sizeof(ImageHeader) + _data.size() + sizeof(OwnedBoxHeader) + sizeof(Array<U8>);
+		Uword padding = (ARRAY_ALIGNMENT - (dataOffset & (ARRAY_ALIGNMENT - 1))) & (ARRAY_ALIGNMENT - 1);
+		if(padding) {
+			reserve(padding);
+		}
+		Uword typeOffset = elementType ? writeType(elementType) : 0;
+		Uword boxOffset = reserve(sizeof(OwnedBoxHeader) + sizeof(Array<U8>) + elementSize * length);
+		Uword objectOffset = boxOffset + sizeof(OwnedBoxHeader);
+		Array<U8>* arr = (Array<U8>*)at(objectOffset);
+		arr->size = length;
+		memcpy(&arr->data[0], elements, elementSize * length);
+		if(elementType) {
+			writePointer(objectOffset + offsetof(Array<U8>, elementType), typeOffset);
+		}
+		return objectOffset;
+	}
+
+	Uword ImageWriter::writeString(const String& str) {
+		return writeString(&str.data.obj->data[0], str.data.obj->size, str.numCodepoints);
+	}
+
+	Uword ImageWriter::writeString(const U8* data, Uword size, Uword numCodepoints) {
+		Uword dataOffset = writeArray(data, 1, size, &oct_type_U8);
+		Uword strOffset = reserve(sizeof(String));
+		String* s = (String*)at(strOffset);
+		s->numCodepoints = numCodepoints;
+		writePointer(strOffset + ((U8*)&s->data.obj - (U8*)s), dataOffset);
+		return strOffset;
+	}
+
+	// Builtins are written too, readers match descriptors by name (isSameType). The offset is
+	// recorded before the fields are written, so a record may refer back to itself.
+	// reserve may move _data, so nothing written is held by pointer across it.
+	Uword ImageWriter::writeType(Type* type) {
+		std::map<Type*, Uword>::iterator found = _types.find(type);
+		if(found != _types.end()) {
+			return found->second;
+		}
+		Uword typeOffset = reserve(sizeof(Type));
+		_types[type] = typeOffset;
+		Type* t = (Type*)at(typeOffset);
+		t->size = type->size;
+		t->alignment = type->alignment;
+		t->numFields = type->numFields;
+		if(type->name) {
+			writePointer(typeOffset + offsetof(Type, name), write(type->name, strlen(type->name) + 1));
+		}
+		if(type->numFields) {
+			Uword fieldsOffset = reserve(sizeof(TypeField) * type->numFields);
+			writePointer(typeOffset + offsetof(Type, fields), fieldsOffset);
+			for(Uword f = 0; f < type->numFields; ++f) {
+				Uword fieldOffset = fieldsOffset + sizeof(TypeField) * f;
+				((TypeField*)at(fieldOffset))->offset = type->fields[f].offset;
+				writePointer(fieldOffset + offsetof(TypeField, type), writeType(type->fields[f].type));
+			}
+		}
+		return typeOffset;
+	}
+
+	// Copies the object's bytes as they are, so type must not contain pointers
+	Uword ImageWriter::writeObject(Type* type, const void* obj) {
+		Uword alignment = type->alignment ? type->alignment : 1;
+		Uword padding = (alignment - ((sizeof(ImageHeader) + _data.size()) & (alignment - 1))) & (alignment - 1);
+		if(padding) {
+			reserve(padding);
+		}
+		return write(obj, type->size);
+	}
+
+	Uword ImageWriter::writeObjectVTable(Type* type) {
+		std::map<Type*, Uword>::iterator found = _vtables.find(type);
+		if(found != _vtables.end()) {
+			return found->second;
+		}
+		Uword typeOffset = writeType(type);
+		Uword vtableOffset = reserve(sizeof(ObjectVTable<Unknown>));
+		writePointer(vtableOffset + offsetof(ObjectVTable<Unknown>, type), typeOffset);
+		_vtables[type] = vtableOffset;
+		return vtableOffset;
+	}
+
+	void ImageWriter::save(const char* path, Uword rootOffset) {
+		if(!trySave(path, rootOffset)) {
+			throw Exception(Exception::IO, "could not write image");
+		}
+	}
+
+	bool ImageWriter::trySave(const char* path, Uword rootOffset) {
+		ImageHeader header;
+		header.magic = IMAGE_MAGIC;
+		header.version = IMAGE_VERSION;
+		header.wordSize = sizeof(Uword);
+		header.baseAddress = _baseAddress;
+		header.dataSize = _data.size();
+		header.rootOffset = rootOffset;
+		header.numRelocations = _relocations.size();
+		FILE* f = fopen(path, "wb");
+		if(!f) {
+			return false;
+		}
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		if(ok && !_data.empty()) {
+			ok = fwrite(&_data[0], _data.size(), 1, f) == 1;
+		}
+		if(ok && !_relocations.empty()) {
+			ok = fwrite(&_relocations[0], sizeof(Uword) * _relocations.size(), 1, f) == 1;
+		}
+		return fclose(f) == 0 && ok;
+	}
+
+	// DEF Image
+	Image::Image(): _place(nullptr), _size(0), _header(nullptr) {
+	}
+
+	Image::Image(const char* path): _place(nullptr), _size(0), _header(nullptr) {
+		if(!load(path)) {
+			throw Exception(Exception::BAD_IMAGE, "could not map image");
+		}
+	}
+
+	Option<Image*> Image::open(const char* path) {
+		Image* image = new Image();
+		if(!image->load(path)) {
+			delete image;
+			return Option<Image*>();
+		}
+		return Option<Image*>(image);
+	}
+
+	// The file is untrusted. Sizes are checked by subtraction so a huge count cannot wrap the
+	// sum, and every relocation must be a whole, aligned word inside the data.
+	bool Image::isValid() {
+		if(_size < sizeof(ImageHeader)
+			|| _header->magic != IMAGE_MAGIC
+			|| _header->version != IMAGE_VERSION
+			|| _header->wordSize != sizeof(Uword)) {
+			return false;
+		}
+		Uword dataSize = _header->dataSize;
+		Uword payload = _size - sizeof(ImageHeader);
+		if(dataSize > payload
+			|| (dataSize & (sizeof(Uword) - 1))
+			|| _header->numRelocations > (payload - dataSize) / sizeof(Uword)
+			|| _header->rootOffset > dataSize) {
+			return false;
+		}
+		const Uword* relocations = (const Uword*)(getData() + dataSize);
+		for(Uword i = 0; i < _header->numRelocations; ++i) {
+			if(dataSize < sizeof(Uword) || relocations[i] > dataSize - sizeof(Uword) || (relocations[i] & (sizeof(Uword) - 1))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Image::load(const char* path) {
+		// Map anywhere first to find out where the image wants to live. If the preferred
+		// address is free we remap there and skip relocation entirely.
+		_place = SYS.mapFile(path, &_size);
+		if(!_place) {
+			return false;
+		}
+		_header = (ImageHeader*)_place;
+		if(!isValid()) {
+			SYS.unmapFile(_place, _size);
+			_place = nullptr;
+			return false;
+		}
+		void* preferred = (void*)_header->baseAddress;
+		if(_place != preferred) {
+			Uword size;
+			void* place = SYS.mapFile(path, &size, preferred);
+			if(place == preferred && size == _size) {
+				SYS.unmapFile(_place, _size);
+				_place = place;
+				_header = (ImageHeader*)_place;
+			}
+			else if(place) {
+				SYS.unmapFile(place, size);
+			}
+		}
+		U8* data = getData();
+		Uword delta = (Uword)_place - _header->baseAddress;
+		if(delta != 0) {
+			// Only the pages holding pointers get copied
+			Uword* relocations = (Uword*)(data + _header->dataSize);
+			for(Uword i = 0; i < _header->numRelocations; ++i) {
+				*(Uword*)(data + relocations[i]) += delta;
+			}
+		}
+		return true;
+	}
+
+	Image::~Image() {
+		if(_place) {
+			SYS.unmapFile(_place, _size);
+		}
+	}
+
+	U8* Image::getData() {
+		return ((U8*)_place) + sizeof(ImageHeader);
+	}
+
+	void* Image::getRoot() {
+		return getData() + _header->rootOffset;
+	}
+
+	bool Image::contains(const void* place, Uword count, Uword size) {
+		Uword offset = (Uword)place - (Uword)getData();
+		Uword dataSize = _header->dataSize;
+		return (Uword)place >= (Uword)getData()
+			&& offset <= dataSize
+			&& (size == 0 || count <= (dataSize - offset) / size);
+	}
+
+	bool Image::containsCString(const char* str) {
+		if(!contains(str, 0, 1)) {
+			return false;
+		}
+		Uword left = _header->dataSize - ((Uword)str - (Uword)getData());
+		return memchr(str, '\0', left) != nullptr;
+	}
+
+	// DEF MappedFile
+	MappedFile::Header* MappedFile::getHeader(const Array<U8>* arr) {
+		return (Header*)(OwnedBox< Array<U8> >::getBox((Array<U8>*)arr)->header.allocBase & ~ExchangeHeap::MAPPED_TAG);
+	}
+
+	Option< Constant< Array<U8> > > MappedFile::tryMapArray(Context* ctx, const char* path, AccessAdvice advice) {
+		Option< Constant< Array<U8> > > ret;
+		Uword lead = SYS.mappingGranularity();
+		Uword size;
+		U8* place = (U8*)SYS.mapFileReadOnly(path, lead, &size);
+		if(!place) {
+			return ret;
+		}
+		Header* header = (Header*)place;
+		header->refs = 1;
+		header->lead = lead;
+		header->size = size;
+		// The box ends where the file starts, so data[0] is the first byte of the file
+		OwnedBox< Array<U8> >* box = (OwnedBox< Array<U8> >*)(place + lead - sizeof(OwnedBox< Array<U8> >));
+		box->header.allocBase = (Uword)header | ExchangeHeap::MAPPED_TAG;
+		box->object.elementType = nullptr;
+		box->object.size = size;
+		if(size && advice != ACCESS_NORMAL) {
+			SYS.adviseAccess(place + lead, size, advice);
+		}
+		ret.value.obj = &box->object;
+		return ret;
+	}
+
+	Constant< Array<U8> > MappedFile::mapArray(Context* ctx, const char* path, AccessAdvice advice) {
+		Option< Constant< Array<U8> > > ret = tryMapArray(ctx, path, advice);
+		if(!ret.hasValue()) {
+			throw Exception(Exception::IO, "could not map file");
+		}
+		return ret.value;
+	}
+
+	Constant<String> MappedFile::mapString(Context* ctx, const char* path, AccessAdvice advice) {
+		Constant< Array<U8> > arr = mapArray(ctx, path, advice);
+		Header* header = getHeader(arr.obj);
+		header->string.numCodepoints = arr->size;
+		header->string.data.obj = arr.obj;
+		Constant<String> ret;
+		ret.obj = &header->string;
+		return ret;
+	}
+
+	void MappedFile::advise(const Array<U8>* arr, AccessAdvice advice) {
+		if(arr->size) {
+			SYS.adviseAccess((void*)&arr->data[0], arr->size, advice);
+		}
+	}
+
+	void MappedFile::retain(const Array<U8>* arr) {
+		Header* header = getHeader(arr);
+		Uword refs;
+		do {
+			refs = SYS.atomicGetUword(&header->refs);
+			assert(refs > 0 && "retain of an unmapped file");
+		} while(!SYS.atomicCompareExchangeUword(&header->refs, refs, refs + 1));
+	}
+
+	void MappedFile::release(const Array<U8>* arr) {
+		Header* header = getHeader(arr);
+		Uword refs;
+		do {
+			refs = SYS.atomicGetUword(&header->refs);
+			assert(refs > 0 && "release of an unmapped file");
+		} while(!SYS.atomicCompareExchangeUword(&header->refs, refs, refs - 1));
+		if(refs == 1) {
+			SYS.unmapFileReadOnly(header, header->lead, header->size);
+		}
+	}
+
+	void MappedFile::retain(const String* str) {
+		retain(str->data.obj);
+	}
+
+	void MappedFile::release(const String* str) {
+		release(str->data.obj);
+	}
+
+	// DEF Reader
+	enum {
+		CHAR_SPACE = 1, // Skipped between forms
+		CHAR_DELIMITER = 2 // Ends an atom
+	};
+
+	struct ReaderCharClasses {
+		U8 table[256];
+		ReaderCharClasses() {
+			memset(table, 0, sizeof(table));
+			for(int c = 0; c <= ' '; ++c) {
+				table[c] = CHAR_DELIMITER;
+			}
+			for(const char* c = " \t\n\r,"; *c; ++c) {
+				table[(U8)*c] = CHAR_SPACE | CHAR_DELIMITER;
+			}
+			for(const char* c = "()[]{}\";"; *c; ++c) {
+				table[(U8)*c] = CHAR_DELIMITER;
+			}
+		}
+	};
+
+	static const ReaderCharClasses readerChars;
+
+	// The scanners test 16 bytes at a time and fall back to the table for the tail. A match mask
+	// has SCAN_BITS bits per byte, one from SSE2 movemask and four from the NEON narrowing shift.
+	#if defined (__SSE2__) || defined (_M_X64)
+	#define OCT_READER_SIMD
+	typedef __m128i ScanVector;
+	static const Uword SCAN_BITS = 1;
+	static const U64 SCAN_ALL = 0xffff;
+	static OCT_ALWAYS_INLINE ScanVector scanLoad(const U8* p) { return _mm_loadu_si128((const __m128i*)p); }
+	static OCT_ALWAYS_INLINE ScanVector scanEq(ScanVector v, U8 c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)); }
+	static OCT_ALWAYS_INLINE ScanVector scanLe(ScanVector v, U8 c) { return _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8((char)c)), v); }
+	static OCT_ALWAYS_INLINE ScanVector scanOr(ScanVector a, ScanVector b) { return _mm_or_si128(a, b); }
+	static OCT_ALWAYS_INLINE U64 scanMask(ScanVector m) { return (U64)_mm_movemask_epi8(m); }
+	#elif defined (__aarch64__)
+	#define OCT_READER_SIMD
+	typedef uint8x16_t ScanVector;
+	static const Uword SCAN_BITS = 4;
+	static const U64 SCAN_ALL = ~0ULL;
+	static OCT_ALWAYS_INLINE ScanVector scanLoad(const U8* p) { return vld1q_u8(p); }
+	static OCT_ALWAYS_INLINE ScanVector scanEq(ScanVector v, U8 c) { return vceqq_u8(v, vdupq_n_u8(c)); }
+	static OCT_ALWAYS_INLINE ScanVector scanLe(ScanVector v, U8 c) { return vcleq_u8(v, vdupq_n_u8(c)); }
+	static OCT_ALWAYS_INLINE ScanVector scanOr(ScanVector a, ScanVector b) { return vorrq_u8(a, b); }
+	static OCT_ALWAYS_INLINE U64 scanMask(ScanVector m) {
+		return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+	}
+	#endif
+
+	#ifdef OCT_READER_SIMD
+	static OCT_ALWAYS_INLINE Uword countTrailingZeros(U64 x) {
+	#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, x);
+		return index;
+	#else
+		return __builtin_ctzll(x);
+	#endif
+	}
+	#endif
+
+	// First byte at or after i that is not a space, or end
+	static Uword skipSpace(const U8* s, Uword i, Uword end) {
+		// Most runs are a single space or newline
+		if(i < end && !(readerChars.table[s[i]] & CHAR_SPACE)) {
+			return i;
+		}
+	#ifdef OCT_READER_SIMD
+		for(; i + 16 <= end; i += 16) {
+			ScanVector v = scanLoad(s + i);
+			ScanVector space = scanOr(scanOr(scanEq(v, ' '), scanEq(v, '\n')), scanOr(scanOr(scanEq(v, '\t'), scanEq(v, '\r')), scanEq(v, ',')));
+			U64 mask = scanMask(space) ^ SCAN_ALL;
+			if(mask) {
+				return i + countTrailingZeros(mask) / SCAN_BITS;
+			}
+		}
+	#endif
+		while(i < end && (readerChars.table[s[i]] & CHAR_SPACE)) {
+			++i;
+		}
+		return i;
+	}
+
+	// First delimiter at or after i, or end
+	static Uword scanDelimiter(const U8* s, Uword i, Uword end) {
+	#ifdef OCT_READER_SIMD
+		for(; i + 16 <= end; i += 16) {
+			ScanVector v = scanLoad(s + i);
+			ScanVector brackets = scanOr(scanOr(scanOr(scanEq(v, '('), scanEq(v, ')')), scanOr(scanEq(v, '['), scanEq(v, ']'))),
+				scanOr(scanEq(v, '{'), scanEq(v, '}')));
+			ScanVector other = scanOr(scanOr(scanLe(v, ' '), scanEq(v, ',')), scanOr(scanEq(v, '"'), scanEq(v, ';')));
+			U64 mask = scanMask(scanOr(brackets, other));
+			if(mask) {
+				return i + countTrailingZeros(mask) / SCAN_BITS;
+			}
+		}
+	#endif
+		while(i < end && !(readerChars.table[s[i]] & CHAR_DELIMITER)) {
+			++i;
+		}
+		return i;
+	}
+
+	// First quote or backslash at or after i, or end
+	static Uword scanString(const U8* s, Uword i, Uword end) {
+	#ifdef OCT_READER_SIMD
+		for(; i + 16 <= end; i += 16) {
+			ScanVector v = scanLoad(s + i);
+			U64 mask = scanMask(scanOr(scanEq(v, '"'), scanEq(v, '\\')));
+			if(mask) {
+				return i + countTrailingZeros(mask) / SCAN_BITS;
+			}
+		}
+	#endif
+		while(i < end && s[i] != '"' && s[i] != '\\') {
+			++i;
+		}
+		return i;
+	}
+
+	Reader::Reader(Context* ctx): _ctx(ctx), _symbols(&ctx->getRuntime()->getSymbols()), _input(nullptr), _length(0), _cursor(0),
+		_consumed(0), _inForm(false), _formMark(0), _formStart(0), _scanned(0), _escaped(false), _finished(false), _error(nullptr),
+		_errorPosition(0) {
+		_nodes.ctor(ctx);
+		_open.ctor(ctx);
+		_buffer.ctor(ctx);
+	}
+
+	Reader::~Reader() {
+		_nodes.dtor(_ctx);
+		_open.dtor(_ctx);
+		_buffer.dtor(_ctx);
+	}
+
+	void Reader::feed(const U8* bytes, Uword length) {
+		assert(!_finished && "feed after finish or setInput");
+		// Drop what has been read, the rest is at most one unfinished token
+		if(_cursor) {
+			Uword rest = _buffer.size - _cursor;
+			if(rest) {
+				memmove(&_buffer.items->data[0], &_buffer.items->data[_cursor], rest);
+			}
+			_buffer.size = rest;
+			_consumed += _cursor;
+			_cursor = 0;
+		}
+		if(length) {
+			_buffer.append(_ctx, bytes, length);
+		}
+		_input = _buffer.items.obj ? &_buffer.items->data[0] : nullptr;
+		_length = _buffer.size;
+	}
+
+	void Reader::setInput(const U8* bytes, Uword length) {
+		_buffer.clear();
+		_input = bytes;
+		_length = length;
+		_cursor = 0;
+		_consumed = 0;
+		_inForm = false;
+		_open.clear();
+		_scanned = 0;
+		_finished = true;
+	}
+
+	void Reader::finish() {
+		_finished = true;
+	}
+
+	Uword Reader::pushNode(SyntaxKind kind, Uword position) {
+		SyntaxNode node;
+		node.kind = kind;
+		node.position = position;
+		node.span = 1;
+		node.count = 0;
+		node.integer = 0;
+		_nodes.append(_ctx, node);
+		return _nodes.size - 1;
+	}
+
+	Reader::Result Reader::fail(const char* message, Uword position, Uword mark) {
+		_error = message;
+		_errorPosition = position;
+		_nodes.size = mark;
+		_inForm = false;
+		_scanned = 0;
+		// There is no telling where the broken form ends, so the rest of the input goes too
+		_cursor = _length;
+		return ERROR;
+	}
+
+	// _cursor is at the token cut off by the end of input, the nodes and _open are kept
+	Reader::Result Reader::more(Uword scanned) {
+		_scanned = scanned;
+		return MORE;
+	}
+
+	// Collections are pushed when opened and pop off _open when closed. Every finished element
+	// is counted in the collection on top, and a quote closes as soon as its element is done.
+	// After MORE the next call carries on with the same form, so fed input is parsed once.
+	Reader::Result Reader::read(Uword* form) {
+		if(!_inForm) {
+			_formMark = _nodes.size;
+			_open.clear();
+		}
+		Uword mark = _formMark;
+		while(true) {
+			_cursor = skipSpace(_input, _cursor, _length);
+			if(_cursor == _length) {
+				if(!_inForm) {
+					return _finished ? END : MORE;
+				}
+				if(!_finished) {
+					return more(0);
+				}
+				return fail("unexpected end of input inside a form", _formStart, mark);
+			}
+			U8 c = _input[_cursor];
+			Uword position = _consumed + _cursor;
+			if(!_inForm) {
+				_inForm = true;
+				_formStart = position;
+			}
+			switch(c) {
+			case ';': {
+				const U8* newline = (const U8*)memchr(_input + _cursor + _scanned, '\n', _length - _cursor - _scanned);
+				if(!newline && !_finished) {
+					// The rest of the line may still come, it must not be read as code
+					if(_nodes.size == mark) {
+						_inForm = false;
+					}
+					return more(_length - _cursor);
+				}
+				_scanned = 0;
+				_cursor = newline ? (newline - _input) + 1 : _length;
+				if(_nodes.size == mark) {
+					_inForm = false;
+				}
+				continue;
+			}
+			case '(':
+				_open.append(_ctx, pushNode(SYNTAX_LIST, position));
+				++_cursor;
+				continue;
+			case '[':
+				_open.append(_ctx, pushNode(SYNTAX_VECTOR, position));
+				++_cursor;
+				continue;
+			case '{':
+				_open.append(_ctx, pushNode(SYNTAX_MAP, position));
+				++_cursor;
+				continue;
+			case '\'':
+				_open.append(_ctx, pushNode(SYNTAX_QUOTE, position));
+				++_cursor;
+				continue;
+			case ')':
+			case ']':
+			case '}': {
+				U32 kind = c == ')' ? SYNTAX_LIST : (c == ']' ? SYNTAX_VECTOR : SYNTAX_MAP);
+				if(_open.size == 0) {
+					return fail("unbalanced closing delimiter", position, mark);
+				}
+				Uword open = *_open.at(_open.size - 1);
+				if(_nodes.at(open)->kind == SYNTAX_QUOTE) {
+					return fail("quote without a form", position, mark);
+				}
+				if(_nodes.at(open)->kind != kind) {
+					return fail("unbalanced closing delimiter", position, mark);
+				}
+				if(kind == SYNTAX_MAP && (_nodes.at(open)->count & 1)) {
+					return fail("map literal with an odd number of forms", position, mark);
+				}
+				--_open.size;
+				_nodes.at(open)->span = (U32)(_nodes.size - open);
+				++_cursor;
+				break;
+			}
+			default: {
+				Result result = c == '"' ? readString(mark) : readAtom(mark);
+				if(result == MORE) {
+					if(!_finished) {
+						return MORE;
+					}
+					return fail("unterminated string", position, mark);
+				}
+				if(result == ERROR) {
+					return result;
+				}
+			}
+			}
+			// An element is done
+			while(true) {
+				if(_open.size == 0) {
+					_inForm = false;
+					*form = mark;
+					return FORM;
+				}
+				Uword parent = *_open.at(_open.size - 1);
+				SyntaxNode* node = _nodes.at(parent);
+				++node->count;
+				if(node->kind != SYNTAX_QUOTE) {
+					break;
+				}
+				node->span = (U32)(_nodes.size - parent);
+				--_open.size;
+			}
+		}
+	}
+
+	// Returns MORE when the input ends before the closing quote
+	Reader::Result Reader::readString(Uword mark) {
+		Uword begin = _cursor + 1;
+		Uword end = _scanned ? _cursor + _scanned : begin;
+		bool escaped = _scanned ? _escaped : false;
+		while(true) {
+			end = scanString(_input, end, _length);
+			if(end >= _length) {
+				_escaped = escaped;
+				return more(end - _cursor);
+			}
+			if(_input[end] == '"') {
+				break;
+			}
+			escaped = true;
+			end += 2; // Skip the escaped byte, it cannot end the string
+		}
+		SyntaxString* str = (SyntaxString*)_arena.alloc(sizeof(SyntaxString) + (end - begin) + 1);
+		Uword length = end - begin;
+		if(!escaped) {
+			memcpy(str->data, _input + begin, length);
+		}
+		else {
+			length = 0;
+			for(Uword i = begin; i < end; ++i) {
+				U8 c = _input[i];
+				if(c == '\\') {
+					switch(_input[++i]) {
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'r': c = '\r'; break;
+					case '0': c = '\0'; break;
+					case '\\': c = '\\'; break;
+					case '"': c = '"'; break;
+					default:
+						return fail("unknown escape in string", _consumed + i - 1, mark);
+					}
+				}
+				str->data[length++] = c;
+			}
+		}
+		str->data[length] = '\0';
+		str->length = length;
+		Uword index = pushNode(SYNTAX_STRING, _consumed + _cursor);
+		_nodes.at(index)->string = str;
+		_cursor = end + 1;
+		_scanned = 0;
+		return FORM;
 	}
-	
-	template <typename T>
-	void Object<T>::gc_mark(Context *ctx) {
-		this->vtable->fns.gc_mark(ctx, this->self);
+
+	// Returns MORE when the atom runs up to the end of input that is not finished yet
+	Reader::Result Reader::readAtom(Uword mark) {
+		Uword begin = _cursor;
+		Uword end = scanDelimiter(_input, begin + _scanned, _length);
+		if(end == _length && !_finished) {
+			return more(end - begin);
+		}
+		_scanned = 0;
+		Uword position = _consumed + begin;
+		if(end == begin) {
+			return fail("unexpected character", position, mark);
+		}
+		const U8* s = _input + begin;
+		Uword length = end - begin;
+		U8 c = s[0];
+		Uword index;
+		if((c >= '0' && c <= '9') || ((c == '-' || c == '+') && length > 1 && s[1] >= '0' && s[1] <= '9')) {
+			bool negative = c == '-';
+			Uword i = (c == '-' || c == '+') ? 1 : 0;
+			U64 value = 0;
+			bool overflow = false;
+			for(; i < length && s[i] >= '0' && s[i] <= '9'; ++i) {
+				if(value > (~0ULL - 9) / 10) {
+					overflow = true;
+				}
+				value = value * 10 + (s[i] - '0');
+			}
+			if(i == length) {
+				if(overflow || value > 0x7fffffffffffffffULL + (negative ? 1 : 0)) {
+					return fail("integer literal out of range", position, mark);
+				}
+				index = pushNode(SYNTAX_INTEGER, position);
+				_nodes.at(index)->integer = negative ? (I64)(0 - value) : (I64)value;
+			}
+			else {
+				// Reals are rare enough to go through strtod, on a terminated copy
+				char copy[64];
+				if(length >= sizeof(copy)) {
+					return fail("malformed number", position, mark);
+				}
+				memcpy(copy, s, length);
+				copy[length] = '\0';
+				char* stop;
+				F64 real = strtod(copy, &stop);
+				if(stop != copy + length) {
+					return fail("malformed number", position, mark);
+				}
+				index = pushNode(SYNTAX_REAL, position);
+				_nodes.at(index)->real = real;
+			}
+		}
+		else if(c == ':') {
+			if(length == 1) {
+				return fail("empty keyword", position, mark);
+			}
+			index = pushNode(SYNTAX_KEYWORD, position);
+			_nodes.at(index)->symbol = _symbols->intern(s + 1, length - 1);
+		}
+		else {
+			index = pushNode(SYNTAX_SYMBOL, position);
+			_nodes.at(index)->symbol = _symbols->intern(s, length);
+		}
+		_cursor = end;
+		return FORM;
 	}
 
-	namespace t {
-		template <typename T>
-		struct is_protocol< Object<T> > {
-			static const bool value = true;
-		};
+	SyntaxNode* Reader::getNode(Uword index) {
+		return _nodes.at(index);
 	}
 
-	// DEF EqComparable protocol.
-	template <typename T>
-	Bool EqComparable<T>::equals(Context* ctx, Borrowed<Object<T> > other) {
-		return this->vtable->fns.equals(ctx, this->self, other);
-	};
+	void Reader::clear() {
+		assert(!_inForm && "clear would drop the unfinished form");
+		_nodes.clear();
+		_arena.reset();
+	}
 
-	namespace t {
-		template <typename T>
-		struct is_protocol< EqComparable<T> > {
-			static const bool value = true;
-		};
+	bool Reader::isInForm() {
+		return _inForm;
 	}
 
-	// DEF OwnedBox
-	template <typename T>
-	OwnedBox<T>* OwnedBox<T>::getBox(T* object) {
-		return (OwnedBox<T>*)(((U8*)object) - sizeof(OwnedBoxHeader));
+	const char* Reader::getError() {
+		return _error;
 	}
 
-	// DEF ManagedBox
-	template <typename T>
-	ManagedBox<T>* ManagedBox<T>::getBox(T* object) {
-		return (ManagedBox<T>*)(((U8*)object) - sizeof(ManagedBoxHeader));
+	Uword Reader::getErrorPosition() {
+		return _errorPosition;
 	}
 
-	// DEF ExchangeHeap
-	ExchangeHeap::ExchangeHeap() {
+	void Reader::print(FILE* out, Uword form) {
+		printNode(out, form);
 	}
 
-	ExchangeHeap::~ExchangeHeap() {
+	// Returns the index of the next sibling
+	Uword Reader::printNode(FILE* out, Uword index) {
+		SyntaxNode* node = _nodes.at(index);
+		switch(node->kind) {
+		case SYNTAX_LIST:
+		case SYNTAX_VECTOR:
+		case SYNTAX_MAP: {
+			static const char* brackets[] = { "()", "[]", "{}" };
+			const char* bracket = brackets[node->kind];
+			fputc(bracket[0], out);
+			Uword child = index + 1;
+			for(Uword i = 0; i < node->count; ++i) {
+				if(i) {
+					fputc(' ', out);
+				}
+				child = printNode(out, child);
+			}
+			fputc(bracket[1], out);
+			break;
+		}
+		case SYNTAX_QUOTE:
+			fputc('\'', out);
+			printNode(out, index + 1);
+			break;
+		case SYNTAX_KEYWORD:
+			fputc(':', out);
+			// Fall through
+		case SYNTAX_SYMBOL:
+			fwrite(node->symbol->name, 1, node->symbol->length, out);
+			break;
+		case SYNTAX_INTEGER:
+			fprintf(out, "%lld", (long long)node->integer);
+			break;
+		case SYNTAX_REAL: {
+			// Shortest of the two precisions that reads back the same
+			char text[32];
+			snprintf(text, sizeof(text), "%.15g", node->real);
+			if(strtod(text, nullptr) != node->real) {
+				snprintf(text, sizeof(text), "%.17g", node->real);
+			}
+			fputs(text, out);
+			if(!strpbrk(text, ".en")) {
+				fputs(".0", out);
+			}
+			break;
+		}
+		case SYNTAX_STRING: {
+			fputc('"', out);
+			SyntaxString* str = node->string;
+			for(Uword i = 0; i < str->length; ++i) {
+				switch(str->data[i]) {
+				case '\n': fputs("\\n", out); break;
+				case '\t': fputs("\\t", out); break;
+				case '\r': fputs("\\r", out); break;
+				case '\0': fputs("\\0", out); break;
+				case '\\': fputs("\\\\", out); break;
+				case '"': fputs("\\\"", out); break;
+				default: fputc(str->data[i], out);
+				}
+			}
+			fputc('"', out);
+			break;
+		}
+		}
+		return index + node->span;
 	}
 
-	template <typename T>
-	Owned<T> ExchangeHeap::alloc(Context* ctx) {
-		OwnedBox<T>* box = (OwnedBox<T>*)SYS.alloc(sizeof(OwnedBox<T>));
-		if(!box) {
-			throw Exception(); // TODO: message
+	// DEF Exception
+	volatile Uword Exception::_captureBacktraces = False;
+
+	// Only the addresses are taken here, symbolizing waits for printBacktrace. Walking the stack
+	// costs more than the throw itself, so it is opt in.
+	Exception::Exception(Kind kind, const char* message): _kind(kind), _message(message), _numFrames(0) {
+		if(OCT_UNLIKELY(SYS.atomicGetUword(&_captureBacktraces)) && kind != OUT_OF_MEMORY) {
+			_numFrames = SYS.captureBacktrace(_frames, MAX_FRAMES);
 		}
-		Owned<T> ret;
-		ret.obj = &box->object;
-		return ret;
 	}
-	
-	template <typename T>
-	Owned< Array<T> > ExchangeHeap::allocArray(Context* ctx, Uword length) {
-		OwnedBox< Array<T> >* box = (OwnedBox< Array<T> >*)SYS.alloc(sizeof(Array<T>) + sizeof(T) * length);
-		if(!box) {
-			throw Exception(); // TODO: message
+
+	// The first backtrace() loads the unwinder, which allocates. That happens here rather
+	// than inside some later throw.
+	void Exception::setCaptureBacktraces(bool capture) {
+		if(capture) {
+			void* frame;
+			SYS.captureBacktrace(&frame, 1);
 		}
-		Owned< Array<T> > ret;
-		ret.obj = &box->object;
-		return ret;
+		SYS.atomicSetUword(&_captureBacktraces, capture ? True : False);
 	}
-	
-	void ExchangeHeap::free(void* object) {
-		// Cast to nothing to please template. Type does not matter here, only THE BOX.
-		SYS.free(OwnedBox<Nothing>::getBox((Nothing*)object));
+
+	Exception::Kind Exception::getKind() const {
+		return _kind;
 	}
 
-	// TODO: Managed Heap
+	const char* Exception::what() const throw() {
+		return _message;
+	}
 
-	// DEF Runtime
-	static volatile Uword didLLVMInit = False;
-	static volatile Uword doingLLVMInit = False;
+	String Exception::getMessage(Context* ctx) const {
+		return String::createFromCString(ctx, _message);
+	}
 
-	Runtime::Runtime() {
-		if(SYS.atomicCompareExchangeUword(&doingLLVMInit, False, True)) {
-			bool result = true;
-			if(!SYS.atomicGetUword(&didLLVMInit)) {
-				llvm::InitializeNativeTarget();
-				SYS.atomicSetUword(&didLLVMInit, True);
+	void Exception::printBacktrace() const {
+		SYS.printBacktrace((void**)_frames, _numFrames);
+	}
+
+	// DEF Repl
+
+	// Prints the forms read from the files in argc, or from stdin
+	static int runRepl(int argv, char* argc[]) {
+		Runtime rt(getenv("OCT_PERF_MAP") ? RUNTIME_PERF_MAP : RUNTIME_DEFAULT);
+		Context* ctx = rt.getCurrentContext();
+	#ifdef OCT_TRACE
+		const char* tracePath = getenv("OCT_TRACE_FILE");
+		if(tracePath) {
+			try {
+				rt.getTracer().start(tracePath);
 			}
-			SYS.atomicSetUword(&doingLLVMInit, False);
-			if(!result) {
-				throw Exception();
+			catch(const Exception& e) {
+				fprintf(stderr, "%s: %s, running without tracing\n", tracePath, e.what());
 			}
 		}
-		else {
-			// Someone else is doing LLVM init, wait for them to complete
-			while(SYS.atomicGetUword(&doingLLVMInit)) {
-				SYS.sleep(0);
+	#endif
+		Reader reader(ctx);
+		Uword form;
+		Reader::Result result;
+
+		// Source files are mapped and read in place
+		for(int i = 1; i < argv; ++i) {
+			Option< Constant< Array<U8> > > source =
+				MappedFile::tryMapArray(ctx, argc[i], ACCESS_SEQUENTIAL);
+			if(!source.hasValue()) {
+				fprintf(stderr, "%s: could not read file\n", argc[i]);
+				return 1;
+			}
+			reader.setInput(&source.value->data[0], source.value->size);
+			while((result = reader.read(&form)) == Reader::FORM) {
+				reader.print(stdout, form);
+				fputc('\n', stdout);
+				reader.clear();
+			}
+			MappedFile::release(source.value.obj);
+			if(result == Reader::ERROR) {
+				fprintf(stderr, "%s:%lu: %s\n", argc[i], (unsigned long)reader.getErrorPosition(), reader.getError());
+				return 1;
 			}
 		}
-		// Init LLVM
-		// Use placement new and allocate in exchange heap?
-		_jitModule = new llvm::Module("JITModule", _llvmContext);
-		_ee = llvm::ExecutionEngine::createJIT(_jitModule);
-		assert(_ee && "Could not create JIT compiler. Unsupported platform?");
+		if(argv > 1) {
+			return 0;
+		}
 
-		// Create octarine namespace and the main thread context
-		Owned<Namespace> octNs = _exchangeHeap.alloc<Namespace>(nullptr);
-		Context* mainCtx = new Context(this, octNs.obj);
-		octNs->name = String::createFromCString(mainCtx, "octarine");
-		_namespaces.put(octNs->name, octNs);
-		_contexts.push_back(mainCtx);
-		_currentContext.set(mainCtx);
-	}
-	
-	Runtime::~Runtime() {
-		// delete all contexts
-		std::vector<Context*>::iterator ci;
-		for(ci = _contexts.begin(); ci != _contexts.end(); ++ci) {
-			delete (*ci);
+		// Otherwise stdin line by line, printing each form as it is read. A line that is
+		// exactly :heap between forms prints the heap statistics instead.
+		char line[4096];
+		bool more = true;
+		bool lineStart = true; // fgets splits lines longer than the buffer
+		while(more) {
+			more = fgets(line, sizeof(line), stdin) != nullptr;
+			bool wholeLine = lineStart;
+			lineStart = more && strchr(line, '\n');
+			if(more && wholeLine && !reader.isInForm() && strcspn(line, "\r\n") == 5 && strncmp(line, ":heap", 5) == 0) {
+				rt.getExchangeHeap().printStats(stdout);
+				continue;
+			}
+			if(more) {
+				reader.feed((const U8*)line, strlen(line));
+			}
+			else {
+				reader.finish();
+			}
+			while((result = reader.read(&form)) == Reader::FORM) {
+				reader.print(stdout, form);
+				fputc('\n', stdout);
+				reader.clear();
+			}
+			if(result == Reader::ERROR) {
+				fprintf(stderr, "error at byte %lu: %s\n", (unsigned long)reader.getErrorPosition(), reader.getError());
+			}
 		}
-		// delete all namespaces
-		_namespaces.dtor(nullptr);
-		// delete LLVM execution engine; this also deletes the JIT module
-		delete _ee;
+
+		return 0;
 	}
-	
-	ExchangeHeap& Runtime::getExchangeHeap() {
-		return _exchangeHeap;
+
+	static int repl(int argv, char* argc[]) {
+		if(getenv("OCT_BACKTRACE")) {
+			Exception::setCaptureBacktraces(true);
+		}
+		try {
+			return runRepl(argv, argc);
+		}
+		catch(const Exception& e) {
+			fprintf(stderr, "error: %s\n", e.what());
+			e.printBacktrace();
+			return 1;
+		}
 	}
 
-	Context* Runtime::getCurrentContext() {
-		return _currentContext.get();
+	// DEF End
+
+} // namespace octarine
+
+#ifdef OCT_EMBED
+
+// Opaque to the host, these are the runtime's own objects. Everything returns a status, an
+// Exception never crosses the API; oct_last_error has the message for the calling thread.
+#define OCT_IMPORT OCT_EXPORT
+#include "../include/octarine.h"
+
+static_assert(sizeof(OctValue) == sizeof(octarine::FrameValue), "OctValue is a FrameValue");
+static_assert(OCT_UNSUPPORTED == OCT_ERROR + (int)octarine::Exception::UNSUPPORTED, "OCT_UNSUPPORTED is an Exception kind");
+static_assert(OCT_RUNTIME_NO_JIT == (int)octarine::RUNTIME_NO_JIT && OCT_RUNTIME_PERF_MAP == (int)octarine::RUNTIME_PERF_MAP && OCT_RUNTIME_GDB_JIT == (int)octarine::RUNTIME_GDB_JIT, "OCT_RUNTIME_* are the RuntimeFlags");
+
+namespace octarine {
+
+	// Behind OctFunction, resolved once by oct_function_lookup. The frame entry is cached and
+	// only looked up again after the definition was recompiled, so a call costs a load and a
+	// compare on top of the indirect call. A handle belongs to the context that looked it up.
+	struct FunctionHandle {
+		Namespace* ns;
+		NamespaceCell* cell;
+		Uword codeVersion;
+		FrameEntry entry;
+		char name[1];
+	};
+
+	static OCT_THREAD_LOCAL const char* lastError = nullptr;
+
+	static int fail(const Exception& e) {
+		lastError = e.what();
+		return OCT_ERROR + e.getKind();
 	}
 
-	// DEF NamespaceEntry
-	bool NamespaceEntry::isNothing() {
-		return variant == NOTHING;
+	// For catch(...): whatever else a native library or the C++ library throws must not
+	// unwind into the host's C frames. Only static messages, the exception dies here.
+	static int failForeign() {
+		try {
+			throw;
+		}
+		catch(const Exception& e) {
+			return fail(e);
+		}
+		catch(const std::bad_alloc&) {
+			lastError = "out of memory";
+			return OCT_ERROR + Exception::OUT_OF_MEMORY;
+		}
+		catch(...) {
+			lastError = "unexpected exception";
+			return OCT_ERROR + Exception::GENERIC;
+		}
 	}
 
-	bool NamespaceEntry::isOwned() {
-		return variant == OWNED_OBJECT;
+	// Keeps a read section open for the caller, so a concurrent redefinition cannot free the
+	// code between resolving the entry and returning from it
+	static FrameEntry resolveFrameEntry(Context* ctx, FunctionHandle* fn) {
+		Uword version = SYS.atomicGetUword(&fn->cell->codeVersion);
+		if(fn->entry && version == fn->codeVersion) {
+			return fn->entry;
+		}
+		while(true) {
+			FrameEntry entry = ctx->getRuntime()->findFrameEntry(fn->ns, fn->cell, fn->name);
+			Uword after = SYS.atomicGetUword(&fn->cell->codeVersion);
+			if(after == version) {
+				fn->entry = entry;
+				fn->codeVersion = version;
+				return entry;
+			}
+			version = after;
+		}
 	}
 
-	bool NamespaceEntry::isConstant() {
-		return variant == CONSTANT_OBJECT;
+} // namespace octarine
+
+extern "C" {
+
+	OCT_EXPORT const char* oct_last_error() {
+		return octarine::lastError;
 	}
 
-	NamespaceEntry::Variant NamespaceEntry::getVariant() {
-		return variant;
+	OCT_EXPORT OctRuntime* oct_runtime_create(unsigned flags) {
+		try {
+			return (OctRuntime*)new octarine::Runtime(flags);
+		}
+		catch(...) {
+			octarine::failForeign();
+			return nullptr;
+		}
 	}
 
-	Owned< Object<Unknown> > NamespaceEntry::getOwnedObject() {
-		return owned;
+	OCT_EXPORT void oct_runtime_destroy(OctRuntime* rt) {
+		delete (octarine::Runtime*)rt;
 	}
 
-	Constant< Object<Unknown> > NamespaceEntry::getConstantObject() {
-		return constant;
+	// The context of the thread that created the runtime
+	OCT_EXPORT OctContext* oct_context_main(OctRuntime* rt) {
+		return (OctContext*)((octarine::Runtime*)rt)->getCurrentContext();
 	}
 
-	void NamespaceEntry::dtor(Context* ctx) {
-		if(isOwned()) {
-			owned.dtor(ctx);
+	// One per host thread, in the namespace of the main context. Not thread safe.
+	OCT_EXPORT OctContext* oct_context_create(OctRuntime* rt) {
+		octarine::Runtime* runtime = (octarine::Runtime*)rt;
+		try {
+			return (OctContext*)runtime->createContext(runtime->getCurrentContext()->getNamespace());
+		}
+		catch(...) {
+			octarine::failForeign();
+			return nullptr;
 		}
 	}
 
-	// DEF Context
-	Context::Context(Runtime* rt, Namespace* ns): _rt(rt), _ns(ns) {
+	// Gives back the memory of a context from oct_context_create, including its trace ring. No
+	// other call may use it afterwards.
+	OCT_EXPORT void oct_context_destroy(OctContext* c) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		ctx->getRuntime()->destroyContext(ctx);
 	}
-	
-	Context::~Context() {
+
+	OCT_EXPORT int oct_load_native(OctContext* c, const char* path) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		try {
+			ctx->getRuntime()->loadNative(ctx, ctx->getNamespace(), path);
+			return OCT_OK;
+		}
+		catch(...) {
+			return octarine::failForeign();
+		}
 	}
-	
-	Namespace* Context::getNamespace() const {
-		return _ns;
+
+	OCT_EXPORT int oct_image_write(OctContext* c, const char* path, size_t* skipped) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		try {
+			octarine::Uword count = ctx->getRuntime()->writeImage(ctx, path);
+			if(skipped) {
+				*skipped = count;
+			}
+			return OCT_OK;
+		}
+		catch(...) {
+			return octarine::failForeign();
+		}
 	}
 
-	void Context::setNamespace(Namespace* ns) {
-		_ns = ns;
+	OCT_EXPORT int oct_image_restore(OctContext* c, const char* path, size_t* bound) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		try {
+			octarine::Uword count = ctx->getRuntime()->restoreImage(ctx, path);
+			if(bound) {
+				*bound = count;
+			}
+			return OCT_OK;
+		}
+		catch(...) {
+			return octarine::failForeign();
+		}
 	}
-    
-    Runtime* Context::getRuntime() const {
-        return _rt;
-    }
 
-	// DEF Hashable
-	template <typename T>
-	Uword Hashable<T>::hash(Context* ctx) {
-		return this->vtable->fns.hash(ctx, this->self);
+	// nullptr if the name was never bound in the context's namespace
+	OCT_EXPORT OctFunction* oct_function_lookup(OctContext* c, const char* name) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		try {
+			octarine::Namespace* ns = ctx->getNamespace();
+			octarine::String key = octarine::String::createFromCString(ctx, name);
+			octarine::NamespaceCell* cell = ns->getCell(ctx, key);
+			ctx->getRuntime()->getExchangeHeap().free(key.data.obj);
+			if(!cell) {
+				return nullptr;
+			}
+			octarine::Uword length = strlen(name);
+			octarine::FunctionHandle* fn = (octarine::FunctionHandle*)malloc(sizeof(octarine::FunctionHandle) + length);
+			if(!fn) {
+				throw octarine::Exception(octarine::Exception::OUT_OF_MEMORY, "out of memory");
+			}
+			fn->ns = ns;
+			fn->cell = cell;
+			fn->codeVersion = 0;
+			fn->entry = nullptr;
+			memcpy(fn->name, name, length + 1);
+			return (OctFunction*)fn;
+		}
+		catch(...) {
+			octarine::failForeign();
+			return nullptr;
+		}
 	}
 
-	// DEF HashtableKey
-	template <typename T>
-	Uword HashtableKey<T>::hash(Context* ctx) {
-		return this->vtable->fns.b.hash(ctx, this->self);
+	OCT_EXPORT void oct_function_release(OctFunction* fn) {
+		free(fn);
 	}
 
-	template <typename T>
-	Bool HashtableKey<T>::equals(Context* ctx, Borrowed< Object<T> > other) {
-		return this->vtable->fns.a.equals(ctx, this->self, other);
+	// args is the caller's frame, laid out as the definition's parameters
+	OCT_EXPORT int oct_call(OctContext* c, OctFunction* fn, const OctValue* args, OctValue* result) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		octarine::ReadSection section(ctx);
+		try {
+			octarine::FrameEntry entry = octarine::resolveFrameEntry(ctx, (octarine::FunctionHandle*)fn);
+			if(!entry) {
+				octarine::lastError = "the function has not been compiled";
+				return OCT_UNBOUND;
+			}
+			entry(ctx, (const octarine::FrameValue*)args, (octarine::FrameValue*)result);
+		}
+		catch(...) {
+			return octarine::failForeign();
+		}
+		return OCT_OK;
 	}
-    
-    // DEF Hashtable
-    template <typename TKey, typename TVal>
-    void Hashtable<TKey, TVal>::put(TKey key, TVal val) {
-#error implement!
-        
-    }
-    
-    template <typename TKey, typename TVal>
-    Option<TVal> Hashtable<TKey, TVal>::get(TKey key) {
-#error implement!
-        
-    }
-    
-    template <typename TKey, typename TVal>
-    void Hashtable<TKey, TVal>::ctor(Context* ctx) {
-        entries = ctx->getRuntime()->getExchangeHeap().allocArray<HashtableEntry< HashtableKey<TKey>, TVal> >(ctx, 100);
-    }
 
-    template <typename TKey, typename TVal>
-    void Hashtable<TKey, TVal>::dtor(Context* ctx) {
-        entries.dtor(ctx);
-    }
+	// count calls with frames stride values apart, one result each. The entry is resolved and
+	// the read section entered once for the whole batch. On error *done has the number of calls
+	// that completed.
+	OCT_EXPORT int oct_call_batch(OctContext* c, OctFunction* fn, const OctValue* args, size_t stride, OctValue* results, size_t count, size_t* done) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		size_t i = 0;
+		octarine::ReadSection section(ctx);
+		try {
+			octarine::FrameEntry entry = octarine::resolveFrameEntry(ctx, (octarine::FunctionHandle*)fn);
+			if(!entry) {
+				*done = 0;
+				octarine::lastError = "the function has not been compiled";
+				return OCT_UNBOUND;
+			}
+			for(; i < count; ++i) {
+				entry(ctx, (const octarine::FrameValue*)(args + i * stride), (octarine::FrameValue*)(results + i));
+			}
+		}
+		catch(...) {
+			*done = i;
+			return octarine::failForeign();
+		}
+		*done = i;
+		return OCT_OK;
+	}
 
+	// Borrowed, valid while the host keeps the array or string alive
+	OCT_EXPORT const void* oct_array_data(const OctArray* array, size_t* length) {
+		const octarine::Array<octarine::U8>* a = (const octarine::Array<octarine::U8>*)array;
+		*length = a->size;
+		return a->data;
+	}
 
-	// DEF Option
-	template <typename T>
-	bool Option<T>::hasValue() {
-		return variant == SOMETHING;
+	OCT_EXPORT const uint8_t* oct_string_bytes(const OctString* string, size_t* size) {
+		const octarine::String* s = (const octarine::String*)string;
+		*size = s->data.obj->size;
+		return s->data.obj->data;
 	}
 
-	template <typename T>
-	T Option<T>::getValue() {
-		if(variant == NOTHING) {
-			throw Exception(); // TODO: message
+	// Only peakResidentBytes is filled in without OCT_HEAP_STATS
+	OCT_EXPORT int oct_heap_stats(OctRuntime* rt, OctHeapStats* stats) {
+		memset(stats, 0, sizeof(OctHeapStats));
+		stats->peakResidentBytes = octarine::SYS.peakResidentBytes();
+		octarine::HeapStats* heap = ((octarine::Runtime*)rt)->getExchangeHeap().getStats();
+		if(!heap) {
+			octarine::lastError = "heap statistics are off, build with OCT_HEAP_STATS";
+			return OCT_UNSUPPORTED;
 		}
-		return value;
+		stats->liveObjects = heap->liveObjects;
+		stats->liveBytes = heap->liveBytes;
+		stats->peakLiveBytes = heap->peakLiveBytes;
+		stats->totalObjects = heap->totalObjects;
+		stats->totalBytes = heap->totalBytes;
+		return OCT_OK;
 	}
 
-    // DEF String
-    String String::createFromCString(Context* ctx, const char* str) {
-        Uword len = strlen(str);
-        String s;
-        s.data = ctx->getRuntime()->getExchangeHeap().allocArray<U8>(ctx, len + 1);
-        memcpy(&s.data->data[0], str, len);
-        s.data->data[len] = '\0';
-        s.data->size = len + 1;
-        s.numCodepoints = len; // This is not correct. Need to account for multibyte chars.
-        return s;
-    }
-    
-	// DEF End
+	// Allocations made through the context since it was created, and their rate
+	OCT_EXPORT int oct_heap_context_stats(OctContext* c, uint64_t* objects, uint64_t* bytes, double* bytesPerSecond) {
+		octarine::Context* ctx = (octarine::Context*)c;
+		if(!ctx->getRuntime()->getExchangeHeap().getStats()) {
+			octarine::lastError = "heap statistics are off, build with OCT_HEAP_STATS";
+			return OCT_UNSUPPORTED;
+		}
+		octarine::ContextHeapStats& stats = ctx->getHeapStats();
+		octarine::U64 elapsed = octarine::SYS.nanoTimestamp() - stats.since;
+		*objects = stats.allocatedObjects;
+		*bytes = stats.allocatedBytes;
+		*bytesPerSecond = elapsed ? stats.allocatedBytes * 1e9 / elapsed : 0;
+		return OCT_OK;
+	}
 
-} // namespace octarine
+	// Zero turns sampling off
+	OCT_EXPORT void oct_heap_set_sample_interval(OctRuntime* rt, size_t bytes) {
+		((octarine::Runtime*)rt)->getExchangeHeap().setSampleInterval(bytes);
+	}
 
-#ifdef OCT_EMBED
+	OCT_EXPORT void oct_heap_report(OctRuntime* rt, FILE* out) {
+		((octarine::Runtime*)rt)->getExchangeHeap().printStats(out);
+	}
 
-extern "C" {
+	// Writes a Chrome trace to path until oct_trace_stop or oct_runtime_destroy
+	OCT_EXPORT int oct_trace_start(OctRuntime* rt, const char* path) {
+	#ifdef OCT_TRACE
+		try {
+			((octarine::Runtime*)rt)->getTracer().start(path);
+			return OCT_OK;
+		}
+		catch(...) {
+			return octarine::failForeign();
+		}
+	#else
+		octarine::lastError = "tracing is off, build with OCT_TRACE";
+		return OCT_UNSUPPORTED;
+	#endif
+	}
+
+	OCT_EXPORT void oct_trace_stop(OctRuntime* rt) {
+		((octarine::Runtime*)rt)->getTracer().stop();
+	}
 
-	// TODO: C-API goes here
+	OCT_EXPORT int oct_main(int argv, char* argc[]) {
+		return octarine::repl(argv, argc);
+	}
 
 } // extern "C"
 
 #else
 
-extern "C" {
-
-	int main(int argv, char* argc[]) {
-		octarine::Runtime rt;
-
-		// TODO: implement repl
-
-		return 0;
-	}
-
-} // extern "C"
+int main(int argv, char* argc[]) {
+	return octarine::repl(argv, argc);
+}
 
 #endif
 
-#endif // #ifndef octarine
+#endif // #ifndef OCTARINE_CPP